@@ -0,0 +1,335 @@
+// Load generator: N clients, each sending `pipeline` requests at a time and
+// waiting for all the replies before sending the next batch.
+//
+//   bench [--host 127.0.0.1] [--port 1234] [--unixsocket path]
+//         [--clients 50] [--pipeline 1] [--seconds 5] [--command get|set]
+//         [--keys 100000] [--value-size 32] [--shm 0|1] [--resp 0|1]
+//
+// `--shm 1` moves each unix socket client onto the shared-memory rings.
+// `--resp 1` speaks RESP2 instead of the native framing.
+//
+// Prints throughput and the round-trip time of a batch.
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "shm.hpp"
+
+struct Options {
+  std::string host = "127.0.0.1";
+  uint16_t port = 1234;
+  std::string unixsocket;
+  int clients = 50;
+  int pipeline = 1;
+  int seconds = 5;
+  std::string command = "get";
+  uint32_t keys = 100000;
+  uint32_t value_size = 32;
+  bool shm = false;
+  bool resp = false;
+};
+
+static bool parse_args(int argc, char *argv[], Options &out) {
+  for (int i = 1; i < argc; i += 2) {
+    if (strncmp(argv[i], "--", 2) != 0 || i + 1 >= argc) {
+      fprintf(stderr, "bad argument: %s\n", argv[i]);
+      return false;
+    }
+    std::string name = argv[i] + 2;
+    const char *value = argv[i + 1];
+    if (name == "host") {
+      out.host = value;
+    } else if (name == "port") {
+      out.port = (uint16_t)atoi(value);
+    } else if (name == "unixsocket") {
+      out.unixsocket = value;
+    } else if (name == "clients") {
+      out.clients = atoi(value);
+    } else if (name == "pipeline") {
+      out.pipeline = atoi(value);
+    } else if (name == "seconds") {
+      out.seconds = atoi(value);
+    } else if (name == "command") {
+      out.command = value;
+    } else if (name == "keys") {
+      out.keys = (uint32_t)atoi(value);
+    } else if (name == "value-size") {
+      out.value_size = (uint32_t)atoi(value);
+    } else if (name == "shm") {
+      out.shm = atoi(value) != 0;
+    } else if (name == "resp") {
+      out.resp = atoi(value) != 0;
+    } else {
+      fprintf(stderr, "unknown option: --%s\n", name.c_str());
+      return false;
+    }
+  }
+  if (out.clients <= 0 || out.pipeline <= 0 || out.seconds <= 0 ||
+      out.keys == 0 || (out.command != "get" && out.command != "set") ||
+      (out.shm && out.unixsocket.empty()) || (out.shm && out.resp)) {
+    fprintf(stderr, "bad option value\n");
+    return false;
+  }
+  return true;
+}
+
+static int connect_to(const Options &opt) {
+  int fd = -1;
+  if (!opt.unixsocket.empty()) {
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, opt.unixsocket.c_str(), sizeof(addr.sun_path) - 1);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+      perror("connect");
+      exit(1);
+    }
+  } else {
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(opt.port);
+    inet_pton(AF_INET, opt.host.c_str(), &addr.sin_addr);
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+      perror("connect");
+      exit(1);
+    }
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  }
+  return fd;
+}
+
+static void put_u32(std::string &out, uint32_t v) {
+  out.append((const char *)&v, 4);
+}
+
+static void encode(const std::vector<std::string> &cmd, std::string &out) {
+  uint32_t len = 4;
+  for (const std::string &s : cmd) {
+    len += 4 + s.size();
+  }
+  put_u32(out, len);
+  put_u32(out, cmd.size());
+  for (const std::string &s : cmd) {
+    put_u32(out, s.size());
+    out += s;
+  }
+}
+
+static void encode_resp(const std::vector<std::string> &cmd,
+                        std::string &out) {
+  out += "*" + std::to_string(cmd.size()) + "\r\n";
+  for (const std::string &s : cmd) {
+    out += "$" + std::to_string(s.size()) + "\r\n";
+    out += s;
+    out += "\r\n";
+  }
+}
+
+// Reads RESP replies off a socket. Only what get and set return is
+// understood: simple strings, errors, integers, bulk strings and nil.
+class RespReader {
+public:
+  explicit RespReader(int fd) : fd_(fd), buf_(64 * 1024) {}
+
+  bool skip_reply() {
+    std::string line;
+    if (!read_line(line) || line.empty()) {
+      return false;
+    }
+    if (line[0] != '$') {
+      return line[0] == '+' || line[0] == '-' || line[0] == ':' ||
+             line[0] == '_';
+    }
+    long len = atol(line.c_str() + 1);
+    return len < 0 || skip((size_t)len + 2);
+  }
+
+private:
+  int fd_;
+  std::vector<char> buf_;
+  size_t begin_ = 0;
+  size_t end_ = 0;
+
+  bool fill() {
+    if (begin_ == end_) {
+      begin_ = end_ = 0;
+    }
+    ssize_t rv = read(fd_, buf_.data() + end_, buf_.size() - end_);
+    if (rv <= 0) {
+      return false;
+    }
+    end_ += rv;
+    return true;
+  }
+
+  bool read_line(std::string &out) {
+    while (true) {
+      char *start = buf_.data() + begin_;
+      char *nl = (char *)memchr(start, '\n', end_ - begin_);
+      if (nl) {
+        out.assign(start, nl - start);
+        begin_ += nl + 1 - start;
+        return true;
+      }
+      if (end_ == buf_.size()) {
+        if (begin_ == 0) {
+          return false; // a line longer than the buffer
+        }
+        memmove(buf_.data(), start, end_ - begin_);
+        end_ -= begin_;
+        begin_ = 0;
+      }
+      if (!fill()) {
+        return false;
+      }
+    }
+  }
+
+  bool skip(size_t len) {
+    while (end_ - begin_ < len) {
+      len -= end_ - begin_;
+      begin_ = end_;
+      if (!fill()) {
+        return false;
+      }
+    }
+    begin_ += len;
+    return true;
+  }
+};
+
+static bool read_full(int fd, char *buf, size_t len) {
+  while (len > 0) {
+    ssize_t rv = read(fd, buf, len);
+    if (rv <= 0) {
+      return false;
+    }
+    buf += rv;
+    len -= rv;
+  }
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  Options opt;
+  if (!parse_args(argc, argv, opt)) {
+    return 1;
+  }
+
+  std::atomic<bool> stop{false};
+  std::atomic<uint64_t> total{0};
+  std::mutex mu;
+  std::vector<uint64_t> rtts_ns; // one per batch, all clients
+  std::vector<std::thread> threads;
+  for (int c = 0; c < opt.clients; c++) {
+    threads.emplace_back([&, c]() {
+      int fd = connect_to(opt);
+      std::unique_ptr<ShmClient> shm;
+      if (opt.shm) {
+        shm.reset(new ShmClient());
+        if (!shm->attach(fd)) {
+          fprintf(stderr, "shmattach failed\n");
+          exit(1);
+        }
+      }
+      auto send_all = [&](const std::string &data) {
+        if (shm) {
+          return shm->send((const uint8_t *)data.data(), data.size());
+        }
+        return write(fd, data.data(), data.size()) == (ssize_t)data.size();
+      };
+      auto recv_all = [&](char *buf, size_t len) {
+        if (shm) {
+          return shm->recv((uint8_t *)buf, len);
+        }
+        return read_full(fd, buf, len);
+      };
+      RespReader resp(fd);
+      std::string value(opt.value_size, 'v');
+      std::string batch;
+      std::vector<char> reply(1 << 20);
+      std::vector<uint64_t> rtts;
+      uint64_t key = (uint64_t)c * 7919;
+      uint64_t n = 0;
+      while (!stop.load(std::memory_order_relaxed)) {
+        batch.clear();
+        for (int i = 0; i < opt.pipeline; i++) {
+          std::string k = "key:" + std::to_string(key++ % opt.keys);
+          auto enc = opt.resp ? encode_resp : encode;
+          if (opt.command == "set") {
+            enc({"set", k, value}, batch);
+          } else {
+            enc({"get", k}, batch);
+          }
+        }
+        auto start = std::chrono::steady_clock::now();
+        if (!send_all(batch)) {
+          perror("write");
+          exit(1);
+        }
+        for (int i = 0; i < opt.pipeline; i++) {
+          if (opt.resp) {
+            if (!resp.skip_reply()) {
+              fprintf(stderr, "connection lost\n");
+              exit(1);
+            }
+            continue;
+          }
+          uint32_t len = 0;
+          if (!recv_all((char *)&len, 4) || len > reply.size() ||
+              !recv_all(reply.data(), len)) {
+            fprintf(stderr, "connection lost\n");
+            exit(1);
+          }
+        }
+        auto end = std::chrono::steady_clock::now();
+        rtts.push_back(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+                .count());
+        n += opt.pipeline;
+      }
+      close(fd);
+      total += n;
+      std::lock_guard<std::mutex> lock(mu);
+      rtts_ns.insert(rtts_ns.end(), rtts.begin(), rtts.end());
+    });
+  }
+  std::this_thread::sleep_for(std::chrono::seconds(opt.seconds));
+  stop = true;
+  for (std::thread &t : threads) {
+    t.join();
+  }
+
+  std::sort(rtts_ns.begin(), rtts_ns.end());
+  auto pct = [&](double p) {
+    if (rtts_ns.empty()) {
+      return 0.0;
+    }
+    size_t idx = std::min(rtts_ns.size() - 1, (size_t)(rtts_ns.size() * p));
+    return rtts_ns[idx] / 1000.0;
+  };
+  printf("%s via %s%s, %d clients, pipeline %d\n", opt.command.c_str(),
+         opt.shm ? "shm" : opt.unixsocket.empty() ? "tcp" : "unix",
+         opt.resp ? " (resp)" : "", opt.clients, opt.pipeline);
+  printf("  %.0f ops/s\n", total.load() / (double)opt.seconds);
+  printf("  batch rtt us: p50 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+         pct(0.5), pct(0.99), pct(0.999), pct(1.0));
+  return 0;
+}
@@ -0,0 +1,121 @@
+// ClientPool benchmark: `threads` callers each making blocking calls, all
+// sharing `connections` pooled connections, so concurrent calls are batched
+// into pipelines by the pool.
+//
+//   client_bench [--host 127.0.0.1] [--port 1234] [--unixsocket path]
+//                [--threads 50] [--connections 4] [--seconds 5]
+//                [--keys 100000]
+//
+// Prints throughput and the latency of a call.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "client.hpp"
+
+struct Options {
+  ClientPool::Options pool;
+  int threads = 50;
+  int seconds = 5;
+  uint32_t keys = 100000;
+};
+
+static bool parse_args(int argc, char *argv[], Options &out) {
+  for (int i = 1; i < argc; i += 2) {
+    if (strncmp(argv[i], "--", 2) != 0 || i + 1 >= argc) {
+      fprintf(stderr, "bad argument: %s\n", argv[i]);
+      return false;
+    }
+    std::string name = argv[i] + 2;
+    const char *value = argv[i + 1];
+    if (name == "host") {
+      out.pool.host = value;
+    } else if (name == "port") {
+      out.pool.port = (uint16_t)atoi(value);
+    } else if (name == "unixsocket") {
+      out.pool.unixsocket = value;
+    } else if (name == "threads") {
+      out.threads = atoi(value);
+    } else if (name == "connections") {
+      out.pool.connections = (size_t)atoi(value);
+    } else if (name == "seconds") {
+      out.seconds = atoi(value);
+    } else if (name == "keys") {
+      out.keys = (uint32_t)atoi(value);
+    } else {
+      fprintf(stderr, "unknown option: --%s\n", name.c_str());
+      return false;
+    }
+  }
+  if (out.threads <= 0 || out.pool.connections == 0 || out.seconds <= 0 ||
+      out.keys == 0) {
+    fprintf(stderr, "bad option value\n");
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  Options opt;
+  if (!parse_args(argc, argv, opt)) {
+    return 1;
+  }
+
+  ClientPool pool(opt.pool);
+  std::atomic<bool> stop{false};
+  std::atomic<uint64_t> total{0};
+  std::atomic<uint64_t> errors{0};
+  std::mutex mu;
+  std::vector<uint64_t> lat_ns; // one per call, all threads
+  std::vector<std::thread> threads;
+  for (int t = 0; t < opt.threads; t++) {
+    threads.emplace_back([&, t]() {
+      std::vector<uint64_t> lats;
+      uint64_t key = (uint64_t)t * 7919;
+      while (!stop.load(std::memory_order_relaxed)) {
+        auto start = std::chrono::steady_clock::now();
+        Reply reply =
+            pool.call({"get", "key:" + std::to_string(key++ % opt.keys)});
+        auto end = std::chrono::steady_clock::now();
+        if (reply.is_err()) {
+          errors++;
+        }
+        lats.push_back(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+                .count());
+      }
+      total += lats.size();
+      std::lock_guard<std::mutex> lock(mu);
+      lat_ns.insert(lat_ns.end(), lats.begin(), lats.end());
+    });
+  }
+  std::this_thread::sleep_for(std::chrono::seconds(opt.seconds));
+  stop = true;
+  for (std::thread &t : threads) {
+    t.join();
+  }
+
+  std::sort(lat_ns.begin(), lat_ns.end());
+  auto pct = [&](double p) {
+    if (lat_ns.empty()) {
+      return 0.0;
+    }
+    size_t idx = std::min(lat_ns.size() - 1, (size_t)(lat_ns.size() * p));
+    return lat_ns[idx] / 1000.0;
+  };
+  printf("get via pool, %d threads, %zu connections\n", opt.threads,
+         opt.pool.connections);
+  printf("  %.0f ops/s, %llu errors\n", total.load() / (double)opt.seconds,
+         (unsigned long long)errors.load());
+  printf("  call latency us: p50 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+         pct(0.5), pct(0.99), pct(0.999), pct(1.0));
+  return 0;
+}
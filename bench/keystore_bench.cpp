@@ -0,0 +1,342 @@
+// In-process KeyStore benchmark: the cost of each operation without the
+// network, protocol or event loop in the way.
+//
+//   keystore_bench [--keys 1000000] [--value-size 32] [--profiles 100000]
+//                  [--fields 20]
+//
+// Prints the throughput and the mean latency of each phase, then the memory
+// taken by `profiles` records of `fields` fields each, stored as one string
+// key per field and as one hash per record, and by a list of `keys` short
+// elements next to a node-per-element std::list. Last, sets of integers:
+// their memory as intsets and as dicts, and the intersection of two sorted
+// arrays against a scalar merge (std::set_intersection). Then HyperLogLog:
+// adding `keys` elements, estimating, merging, and the error of the estimate.
+// Then BITCOUNT and BITOP over bitmaps of `keys` * 64 bits. Last, a Bloom
+// filter sized for 128 * `keys` elements: lookups one at a time and batched;
+// and the false positive rate of one filled to its capacity of `keys`.
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <list>
+#include <malloc.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bitmap.hpp"
+#include "bloom_type.hpp"
+#include "hash_type.hpp"
+#include "hyperloglog.hpp"
+#include "keystore.hpp"
+#include "list_type.hpp"
+#include "set_type.hpp"
+#include "utils.hpp"
+
+struct Options {
+  uint32_t keys = 1000000;
+  uint32_t value_size = 32;
+  uint32_t profiles = 100000;
+  uint32_t fields = 20;
+};
+
+static bool parse_args(int argc, char *argv[], Options &out) {
+  for (int i = 1; i < argc; i += 2) {
+    if (strncmp(argv[i], "--", 2) != 0 || i + 1 >= argc) {
+      fprintf(stderr, "bad argument: %s\n", argv[i]);
+      return false;
+    }
+    std::string name = argv[i] + 2;
+    const char *value = argv[i + 1];
+    if (name == "keys") {
+      out.keys = (uint32_t)atoi(value);
+    } else if (name == "value-size") {
+      out.value_size = (uint32_t)atoi(value);
+    } else if (name == "profiles") {
+      out.profiles = (uint32_t)atoi(value);
+    } else if (name == "fields") {
+      out.fields = (uint32_t)atoi(value);
+    } else {
+      fprintf(stderr, "unknown option: --%s\n", name.c_str());
+      return false;
+    }
+  }
+  if (out.keys == 0) {
+    fprintf(stderr, "bad option value\n");
+    return false;
+  }
+  return true;
+}
+
+static void report(const char *name, size_t n, double sec) {
+  printf("  %-8s %10.0f ops/s  %7.1f ns/op\n", name, n / sec, sec * 1e9 / n);
+}
+
+// `bytes` processed in `sec`
+static void bandwidth(const char *name, size_t bytes, double sec) {
+  printf("  %-8s %10.2f GB/s\n", name, bytes / sec / 1e9);
+}
+
+// bytes allocated from the heap right now
+static size_t heap_in_use() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+  return mallinfo2().uordblks;
+#else
+  return 0; // not measured
+#endif
+}
+
+// the heap taken by `fn`, per `unit`
+template <typename Fn>
+static void memory(const char *name, uint32_t n, const char *unit, Fn fn) {
+  size_t before = heap_in_use();
+  fn();
+  size_t after = heap_in_use();
+  printf("  %-8s %10.1f bytes/%s\n", name, (double)(after - before) / n,
+         unit);
+}
+
+template <typename Fn> static double timed(Fn fn) {
+  auto start = std::chrono::steady_clock::now();
+  fn();
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+// run `fn(i)` for every key
+template <typename Fn>
+static void phase(const char *name, uint32_t n, Fn fn) {
+  report(name, n, timed([&]() {
+           for (uint32_t i = 0; i < n; i++) {
+             fn(i);
+           }
+         }));
+}
+
+int main(int argc, char *argv[]) {
+  Options opt;
+  if (!parse_args(argc, argv, opt)) {
+    return 1;
+  }
+  // the key names are built up front so only the store is measured
+  std::vector<std::string> keys(opt.keys);
+  for (uint32_t i = 0; i < opt.keys; i++) {
+    keys[i] = "key:" + std::to_string(i);
+  }
+  std::string value(opt.value_size, 'v');
+  KeyStore store;
+  size_t found = 0;
+
+  printf("%u keys, %u byte values\n", opt.keys, opt.value_size);
+  phase("set", opt.keys, [&](uint32_t i) { store.set(keys[i], value); });
+  phase("get", opt.keys, [&](uint32_t i) {
+    found += store.get(keys[(i * 7919u) % opt.keys]) != nullptr;
+  });
+  phase("get-miss", opt.keys, [&](uint32_t i) {
+    found += store.get(keys[i] + "x") != nullptr;
+  });
+  // scan and tick count one op per key
+  std::vector<std::string> batch;
+  size_t nscanned = 0;
+  report("scan", opt.keys, timed([&]() {
+           uint64_t cursor = 0;
+           do {
+             batch.clear();
+             cursor = store.scan(cursor, 100, batch);
+             nscanned += batch.size();
+           } while (cursor != 0);
+         }));
+  phase("expire", opt.keys, [&](uint32_t i) { store.expire(keys[i], 0); });
+  // everything has expired by now
+  report("tick", opt.keys, timed([&]() {
+           while (store.tick(get_monotonic_msec(), 1000) > 0) {
+           }
+         }));
+  if (found != opt.keys || nscanned < opt.keys || store.size() != 0) {
+    fprintf(stderr, "unexpected result: found %zu, scanned %zu, %zu left\n",
+            found, nscanned, store.size());
+    return 1;
+  }
+
+  // short values, like the fields of a user profile
+  printf("%u profiles of %u fields\n", opt.profiles, opt.fields);
+  std::string field_value = "value-12";
+  memory("strings", opt.profiles, "profile", [&]() {
+    for (uint32_t i = 0; i < opt.profiles; i++) {
+      std::string prefix = "user:" + std::to_string(i) + ":field";
+      for (uint32_t f = 0; f < opt.fields; f++) {
+        store.set(prefix + std::to_string(f), field_value);
+      }
+    }
+  });
+  store.clear();
+  memory("hashes", opt.profiles, "profile", [&]() {
+    for (uint32_t i = 0; i < opt.profiles; i++) {
+      Entry *ent = store.add("user:" + std::to_string(i), ValueType::HASH);
+      for (uint32_t f = 0; f < opt.fields; f++) {
+        hash_set(ent, "field" + std::to_string(f), field_value, store.limits());
+      }
+    }
+  });
+  store.clear();
+
+  printf("a list of %u elements\n", opt.keys);
+  Quicklist *list = nullptr;
+  memory("list", opt.keys, "element", [&]() {
+    list = list_of(store.add("list", ValueType::LIST));
+    phase("rpush", opt.keys, [&](uint32_t i) {
+      list->push_back(field_value.data(), field_value.size());
+    });
+  });
+  size_t nread = 0;
+  auto count_elem = [](StrView elem, void *arg) { *(size_t *)arg += 1; };
+  report("lrange", opt.keys, timed([&]() {
+           for (uint32_t i = 0; i < opt.keys; i += 100) {
+             list->range(i, 100, count_elem, &nread);
+           }
+         }));
+  std::string elem;
+  phase("lpop", opt.keys, [&](uint32_t i) { list->pop_front(elem); });
+  std::list<std::string> reference;
+  memory("std::list", opt.keys, "element", [&]() {
+    for (uint32_t i = 0; i < opt.keys; i++) {
+      reference.push_back(field_value);
+    }
+  });
+  if (nread != opt.keys || list->size() != 0) {
+    fprintf(stderr, "unexpected result: read %zu, %zu left\n", nread,
+            list->size());
+    return 1;
+  }
+  store.clear();
+
+  const uint32_t nsets = 1000;
+  const uint32_t members = 500;
+  printf("%u sets of %u integers\n", nsets, members);
+  for (int dict = 0; dict < 2; dict++) {
+    // no intset at all with a limit of 0
+    store.limits().set_max_intset_entries = dict ? 0 : members;
+    memory(dict ? "dict" : "intset", nsets * members, "member", [&]() {
+      for (uint32_t i = 0; i < nsets; i++) {
+        Entry *ent = store.add("set:" + std::to_string(i), ValueType::SET);
+        for (uint32_t m = 0; m < members; m++) {
+          set_add(ent, std::to_string(m * 1000), store.limits());
+        }
+      }
+    });
+    store.clear();
+  }
+  // about a quarter of each array is in the other
+  std::vector<int32_t> a(opt.keys / 10);
+  std::vector<int32_t> b(opt.keys / 10);
+  for (size_t i = 0; i < a.size(); i++) {
+    a[i] = (int32_t)(rand() % (a.size() * 4));
+    b[i] = (int32_t)(rand() % (b.size() * 4));
+  }
+  std::sort(a.begin(), a.end());
+  std::sort(b.begin(), b.end());
+  a.erase(std::unique(a.begin(), a.end()), a.end());
+  b.erase(std::unique(b.begin(), b.end()), b.end());
+  std::vector<int32_t> common(a.size());
+  const uint32_t rounds = 100;
+  size_t nsimd = 0;
+  size_t nscalar = 0;
+  uint32_t nelems = (uint32_t)(a.size() + b.size()) * rounds;
+  printf("intersect %zu and %zu sorted integers\n", a.size(), b.size());
+  report("intersect", nelems, timed([&]() {
+           for (uint32_t r = 0; r < rounds; r++) {
+             nsimd += intersect_sorted(a.data(), a.size(), b.data(),
+                                       b.size(), common.data());
+           }
+         }));
+  report("scalar", nelems, timed([&]() {
+           for (uint32_t r = 0; r < rounds; r++) {
+             nscalar += std::set_intersection(a.begin(), a.end(), b.begin(),
+                                              b.end(), common.begin()) -
+                        common.begin();
+           }
+         }));
+  if (nsimd != nscalar) {
+    fprintf(stderr, "unexpected result: %zu != %zu in common\n", nsimd,
+            nscalar);
+    return 1;
+  }
+
+  printf("a HyperLogLog of %u elements\n", opt.keys);
+  std::string hll;
+  hll_init(hll);
+  phase("pfadd", opt.keys, [&](uint32_t i) {
+    std::string elem = "elem:" + std::to_string(i);
+    hll_add(hll, elem.data(), elem.size(), store.limits());
+  });
+  std::vector<uint8_t> regs(k_hll_registers);
+  std::vector<uint8_t> acc(k_hll_registers);
+  hll_registers(hll, regs.data());
+  uint64_t count = 0;
+  phase("estimate", rounds,
+        [&](uint32_t) { count = hll_estimate(regs.data()); });
+  phase("merge", rounds,
+        [&](uint32_t) { hll_merge(acc.data(), regs.data()); });
+  printf("  %-8s %10.2f %%\n", "error",
+         100.0 * ((double)count - opt.keys) / opt.keys);
+
+  std::string bits_a((size_t)opt.keys * 8, '\0');
+  std::string bits_b((size_t)opt.keys * 8, '\0');
+  for (size_t i = 0; i < bits_a.size(); i++) {
+    bits_a[i] = (char)rand();
+    bits_b[i] = (char)rand();
+  }
+  printf("bitmaps of %zu bytes\n", bits_a.size());
+  uint64_t nbits = 0;
+  bandwidth("bitcount", bits_a.size() * rounds, timed([&]() {
+              for (uint32_t r = 0; r < rounds; r++) {
+                nbits += bitmap_count(bits_a, 0, bits_a.size() * 8 - 1);
+              }
+            }));
+  std::vector<const std::string *> srcs = {&bits_a, &bits_b};
+  std::string dest;
+  bandwidth("bitop", bits_a.size() * rounds, timed([&]() {
+              for (uint32_t r = 0; r < rounds; r++) {
+                bitmap_op(BitOp::AND, srcs, dest);
+              }
+            }));
+  if (nbits == 0 || dest.size() != bits_a.size()) {
+    fprintf(stderr, "unexpected result: %llu bits set\n",
+            (unsigned long long)nbits);
+    return 1;
+  }
+
+  // much bigger than the caches, so each lookup is a miss
+  uint64_t capacity = (uint64_t)opt.keys * 128;
+  printf("a Bloom filter for %llu elements, 1%% error\n",
+         (unsigned long long)capacity);
+  std::unique_ptr<BloomFilter> bloom(BloomFilter::create(0.01, capacity, 2));
+  std::vector<uint64_t> hashes(opt.keys);
+  std::vector<uint64_t> absent(opt.keys);
+  for (uint32_t i = 0; i < opt.keys; i++) {
+    hashes[i] = bloom_hash("id:" + std::to_string(i));
+    absent[i] = bloom_hash("other:" + std::to_string(i));
+  }
+  std::vector<uint8_t> hits(opt.keys);
+  phase("bf.add", opt.keys,
+        [&](uint32_t i) { bloom->add(&hashes[i], 1, &hits[i]); });
+  phase("bf.exists", opt.keys,
+        [&](uint32_t i) { bloom->contains(&hashes[i], 1, &hits[i]); });
+  report("batched", opt.keys, timed([&]() {
+           bloom->contains(hashes.data(), opt.keys, hits.data());
+         }));
+  size_t missing = std::count(hits.begin(), hits.end(), 0);
+  std::unique_ptr<BloomFilter> full(BloomFilter::create(0.01, opt.keys, 2));
+  full->add(hashes.data(), opt.keys, hits.data());
+  full->contains(absent.data(), opt.keys, hits.data());
+  size_t false_pos = std::count(hits.begin(), hits.end(), 1);
+  printf("  %-8s %10.2f %%\n", "fpr", 100.0 * false_pos / opt.keys);
+  if (missing != 0) {
+    fprintf(stderr, "unexpected result: %zu added not hits\n", missing);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,431 @@
+#include "aof.hpp"
+#include "bloom_type.hpp"
+#include "global.hpp"
+#include "hash_type.hpp"
+#include "list_type.hpp"
+#include "set_type.hpp"
+#include "logger.hpp"
+#include "request.hpp"
+#include "utils.hpp"
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+int64_t AppendOnlyFile::load(const std::string &path) {
+  int fd = ::open(path.c_str(), O_RDWR);
+  if (fd < 0) {
+    if (errno == ENOENT) {
+      return 0; // nothing to replay yet
+    }
+    LOG(ERROR, "open {} failed: {}", path, strerror(errno));
+    return -1;
+  }
+
+  const size_t k_chunk = 64 * 1024;
+  std::vector<uint8_t> buf;
+  std::vector<uint8_t> sink; // replies are thrown away
+  off_t valid = 0;           // end of the last complete command
+  int64_t ncmd = 0;
+  while (true) {
+    size_t old = buf.size();
+    buf.resize(old + k_chunk);
+    ssize_t rv = read(fd, buf.data() + old, k_chunk);
+    if (rv < 0) {
+      if (errno == EINTR) {
+        buf.resize(old);
+        continue;
+      }
+      LOG(ERROR, "read {} failed: {}", path, strerror(errno));
+      ::close(fd);
+      return -1;
+    }
+    buf.resize(old + rv);
+    if (rv == 0) {
+      break;
+    }
+
+    size_t consumed = 0;
+    while (buf.size() - consumed >= 4) {
+      uint32_t len = 0;
+      memcpy(&len, buf.data() + consumed, 4);
+      if (buf.size() - consumed - 4 < len) {
+        break; // need read more
+      }
+      std::vector<std::string> cmd;
+      if (parse_request(buf.data() + consumed + 4, len, cmd) < 0) {
+        LOG(ERROR, "bad command in {} at offset {}", path, valid + consumed);
+        ::close(fd);
+        return -1;
+      }
+      sink.clear();
+      Response resp(sink);
+      do_request(std::move(cmd), resp);
+      consumed += 4 + len;
+      ncmd++;
+    }
+    buf.erase(buf.begin(), buf.begin() + consumed);
+    valid += consumed;
+  }
+
+  if (!buf.empty()) {
+    LOG(WARNING, "{} ends with a truncated command, dropping {} bytes", path,
+        buf.size());
+    if (ftruncate(fd, valid) < 0) {
+      LOG(ERROR, "ftruncate {} failed: {}", path, strerror(errno));
+      ::close(fd);
+      return -1;
+    }
+  }
+  ::close(fd);
+  return ncmd;
+}
+
+bool AppendOnlyFile::open(const Config &config) {
+  int fd = ::open(config.appendfilename.c_str(),
+                  O_WRONLY | O_APPEND | O_CREAT, 0644);
+  if (fd < 0) {
+    LOG(ERROR, "open {} failed: {}", config.appendfilename, strerror(errno));
+    return false;
+  }
+  struct stat st = {};
+  if (fstat(fd, &st) < 0) {
+    LOG(ERROR, "fstat {} failed: {}", config.appendfilename, strerror(errno));
+    ::close(fd);
+    return false;
+  }
+  fd_ = fd;
+  path_ = config.appendfilename;
+  policy_ = config.appendfsync;
+  base_size_ = size_ = st.st_size;
+  rewrite_percentage_ = config.auto_aof_rewrite_percentage;
+  rewrite_min_size_ = config.auto_aof_rewrite_min_size;
+  rewrite_buffer_limit_ = config.aof_rewrite_buffer_limit;
+  stop_ = false;
+  fsync_thread_ = std::thread(&AppendOnlyFile::fsync_loop, this);
+  return true;
+}
+
+void AppendOnlyFile::close() {
+  if (fd_ == -1) {
+    return;
+  }
+  if (rewriting()) {
+    abort_rewrite();
+  }
+  flush();
+  if (fsync_thread_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      stop_ = true;
+    }
+    cv_.notify_one();
+    fsync_thread_.join();
+  }
+  if (policy_ != FsyncPolicy::NO) {
+    fdatasync(fd_);
+  }
+  ::close(fd_);
+  fd_ = -1;
+}
+
+void AppendOnlyFile::append(const uint8_t *data, size_t len) {
+  if (fd_ == -1) {
+    return;
+  }
+  buf_.insert(buf_.end(), data, data + len);
+  if (rewriting()) {
+    rewrite_buf_.insert(rewrite_buf_.end(), data, data + len);
+    if (rewrite_buf_.size() > rewrite_buffer_limit_) {
+      LOG(WARNING, "aof rewrite buffer over {} bytes, giving up the rewrite",
+          rewrite_buffer_limit_);
+      abort_rewrite();
+    }
+  }
+}
+
+void AppendOnlyFile::flush() {
+  if (buf_.empty()) {
+    return;
+  }
+  size_t n = 0;
+  while (n < buf_.size()) {
+    ssize_t rv = write(fd_, buf_.data() + n, buf_.size() - n);
+    if (rv < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      // keep the rest and retry on the next iteration
+      LOG(ERROR, "write aof failed: {}", strerror(errno));
+      break;
+    }
+    n += rv;
+  }
+  buf_.erase(buf_.begin(), buf_.begin() + n);
+  written_ += n;
+  size_ += n;
+
+  if (policy_ == FsyncPolicy::ALWAYS && n > 0) {
+    if (fdatasync(fd_) < 0) {
+      LOG(ERROR, "fdatasync aof failed: {}", strerror(errno));
+    }
+  }
+}
+
+void AppendOnlyFile::fsync_loop() {
+  std::unique_lock<std::mutex> lock(mu_);
+  while (true) {
+    // no sync is in flight here, so the files a rewrite replaced can go
+    std::vector<int> retired;
+    retired.swap(retired_fds_);
+    if (!retired.empty()) {
+      lock.unlock();
+      for (int fd : retired) {
+        ::close(fd);
+      }
+      lock.lock();
+      continue;
+    }
+    if (stop_) {
+      break;
+    }
+    cv_.wait_for(lock, std::chrono::seconds(1));
+    uint64_t written = written_;
+    if (stop_ || policy_ != FsyncPolicy::EVERYSEC || written == synced_ ||
+        !retired_fds_.empty()) {
+      continue;
+    }
+    int fd = fd_;
+    lock.unlock();
+    if (fdatasync(fd) < 0) {
+      LOG(ERROR, "fdatasync aof failed: {}", strerror(errno));
+    }
+    lock.lock();
+    // a rewrite may have swapped the file meanwhile and synced the new one
+    if (fd == fd_) {
+      synced_ = written;
+    }
+  }
+}
+
+namespace {
+struct RewriteCtx {
+  int fd = -1;
+  std::vector<uint8_t> buf;
+  std::vector<std::string> cmd;
+  uint64_t now_mono = 0;
+  uint64_t now_real = 0;
+  bool ok = true;
+
+  void flush() {
+    if (!write_all(fd, (const char *)buf.data(), buf.size())) {
+      ok = false;
+    }
+    buf.clear();
+  }
+};
+} // namespace
+
+// fields per HSET, elements per RPUSH or members per SADD, so that no one
+// command gets too long
+static const size_t k_rewrite_batch = 64;
+
+static void flush_cmd(RewriteCtx &ctx, size_t header) {
+  if (ctx.cmd.size() > header) {
+    encode_request(ctx.cmd, ctx.buf);
+  }
+  ctx.cmd.resize(header);
+}
+
+// the commands that recreate the value of `ent`
+static void rewrite_value(RewriteCtx &ctx, Entry *ent) {
+  switch (ent->type) {
+  case ValueType::STRING:
+    ctx.cmd = {"set", ent->key, ent->value};
+    encode_request(ctx.cmd, ctx.buf);
+    break;
+  case ValueType::HASH: {
+    ctx.cmd = {"hset", ent->key};
+    auto callback = [](StrView field, StrView value, void *arg) {
+      RewriteCtx &ctx = *(RewriteCtx *)arg;
+      ctx.cmd.push_back(field.str());
+      ctx.cmd.push_back(value.str());
+      if (ctx.cmd.size() >= 2 + 2 * k_rewrite_batch) {
+        flush_cmd(ctx, 2);
+      }
+    };
+    hash_foreach(ent, callback, &ctx);
+    flush_cmd(ctx, 2);
+    break;
+  }
+  case ValueType::LIST: {
+    ctx.cmd = {"rpush", ent->key};
+    auto callback = [](StrView elem, void *arg) {
+      RewriteCtx &ctx = *(RewriteCtx *)arg;
+      ctx.cmd.push_back(elem.str());
+      if (ctx.cmd.size() >= 2 + k_rewrite_batch) {
+        flush_cmd(ctx, 2);
+      }
+    };
+    Quicklist *list = list_of(ent);
+    list->range(0, list->size(), callback, &ctx);
+    flush_cmd(ctx, 2);
+    break;
+  }
+  case ValueType::SET: {
+    ctx.cmd = {"sadd", ent->key};
+    auto callback = [](StrView member, void *arg) {
+      RewriteCtx &ctx = *(RewriteCtx *)arg;
+      ctx.cmd.push_back(member.str());
+      if (ctx.cmd.size() >= 2 + k_rewrite_batch) {
+        flush_cmd(ctx, 2);
+      }
+    };
+    set_foreach(ent, callback, &ctx);
+    flush_cmd(ctx, 2);
+    break;
+  }
+  case ValueType::BLOOM:
+    // the bits, since the elements are not kept
+    ctx.cmd = {"bf.load", ent->key, std::string()};
+    bloom_pack(ent, ctx.cmd[2]);
+    encode_request(ctx.cmd, ctx.buf);
+    break;
+  }
+}
+
+// Dump the keyspace as SET, HSET, RPUSH, SADD, BF.LOAD (+ PEXPIREAT)
+// commands. Runs in the forked child, so it must not log: another thread may
+// have held the logger lock at fork.
+static bool rewrite_keyspace(int fd) {
+  RewriteCtx ctx;
+  ctx.fd = fd;
+  ctx.now_mono = get_monotonic_msec();
+  ctx.now_real = get_realtime_msec();
+
+  auto callback = [](Entry *ent, void *arg) {
+    RewriteCtx &ctx = *(RewriteCtx *)arg;
+    rewrite_value(ctx, ent);
+    if (ent->has_ttl()) {
+      uint64_t expire_at = GlobalState::store().expire_at(ent);
+      uint64_t ttl = expire_at > ctx.now_mono ? expire_at - ctx.now_mono : 0;
+      ctx.cmd = {"pexpireat", ent->key, std::to_string(ctx.now_real + ttl)};
+      encode_request(ctx.cmd, ctx.buf);
+    }
+    if (ctx.buf.size() >= 64 * 1024) {
+      ctx.flush();
+    }
+    return ctx.ok;
+  };
+  GlobalState::store().foreach (callback, &ctx);
+  ctx.flush();
+  return ctx.ok && fdatasync(fd) == 0;
+}
+
+bool AppendOnlyFile::start_rewrite() {
+  if (fd_ == -1 || GlobalState::child_running()) {
+    return false;
+  }
+  // everything up to now goes to the old file; the rewrite buffer starts
+  // empty and only collects what the child will not see
+  flush();
+  std::string tmp = path_ + ".rewrite.tmp";
+  int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    LOG(ERROR, "open {} failed: {}", tmp, strerror(errno));
+    return false;
+  }
+
+  pid_t pid = fork();
+  if (pid < 0) {
+    LOG(ERROR, "fork failed: {}", strerror(errno));
+    ::close(fd);
+    unlink(tmp.c_str());
+    return false;
+  }
+  if (pid == 0) {
+    _exit(rewrite_keyspace(fd) ? 0 : 1);
+  }
+  ::close(fd);
+  LOG(INFO, "aof rewrite started by child {}", pid);
+  rewrite_child_ = pid;
+  rewrite_tmp_ = tmp;
+  rewrite_buf_.clear();
+  return true;
+}
+
+void AppendOnlyFile::cron() {
+  if (rewriting()) {
+    int status = 0;
+    pid_t pid = waitpid(rewrite_child_, &status, WNOHANG);
+    if (pid == rewrite_child_) {
+      rewrite_child_ = -1;
+      finish_rewrite(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    } else if (pid < 0) {
+      LOG(ERROR, "waitpid failed: {}", strerror(errno));
+      rewrite_child_ = -1;
+      finish_rewrite(false);
+    }
+    return;
+  }
+  if (fd_ != -1 && !GlobalState::child_running() && rewrite_percentage_ > 0 &&
+      size_ >= rewrite_min_size_ &&
+      size_ - base_size_ > base_size_ / 100 * rewrite_percentage_) {
+    LOG(INFO, "aof grew from {} to {} bytes, rewriting", base_size_, size_);
+    start_rewrite();
+  }
+}
+
+void AppendOnlyFile::abort_rewrite() {
+  kill(rewrite_child_, SIGKILL);
+  waitpid(rewrite_child_, NULL, 0);
+  rewrite_child_ = -1;
+  finish_rewrite(false);
+}
+
+void AppendOnlyFile::finish_rewrite(bool ok) {
+  int fd = -1;
+  if (ok) {
+    fd = ::open(rewrite_tmp_.c_str(), O_WRONLY | O_APPEND);
+    ok = fd >= 0;
+  }
+  // the commands that arrived during the rewrite go after the snapshot
+  if (ok) {
+    flush();
+    ok = write_all(fd, (const char *)rewrite_buf_.data(),
+                   rewrite_buf_.size()) &&
+         fdatasync(fd) == 0;
+  }
+  if (ok) {
+    ok = rename(rewrite_tmp_.c_str(), path_.c_str()) == 0;
+  }
+  if (!ok) {
+    LOG(ERROR, "aof rewrite failed");
+    if (fd >= 0) {
+      ::close(fd);
+    }
+    unlink(rewrite_tmp_.c_str());
+    rewrite_buf_.clear();
+    rewrite_buf_.shrink_to_fit();
+    return;
+  }
+
+  struct stat st = {};
+  fstat(fd, &st);
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    // closing the last reference to the old file frees all of its blocks,
+    // which can take a while; the background thread does it once no sync
+    // of it is in flight
+    retired_fds_.push_back(fd_);
+    fd_ = fd;
+    synced_ = written_;
+  }
+  cv_.notify_one();
+
+  LOG(INFO, "aof rewritten: {} -> {} bytes", size_, st.st_size);
+  base_size_ = size_ = st.st_size;
+  rewrite_buf_.clear();
+  rewrite_buf_.shrink_to_fit();
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+#include <thread>
+#include <vector>
+
+#include "config.hpp"
+
+// AppendOnlyFile logs every mutating command so the keyspace can be rebuilt
+// on restart. Commands are encoded with the request wire format and gathered
+// in a per-loop-iteration buffer; `flush()` writes the whole batch with one
+// `write()` (group commit) and then syncs it according to the fsync policy.
+//
+// To keep the file from growing without bound it is periodically rewritten:
+// a forked child dumps the live keyspace as a minimal list of commands into a
+// temp file while the parent keeps appending to the old file and also keeps
+// the new commands in a rewrite buffer. When the child is done the buffer is
+// appended to the temp file, which is then renamed over the old one.
+class AppendOnlyFile {
+public:
+  AppendOnlyFile() = default;
+  ~AppendOnlyFile() { close(); }
+  AppendOnlyFile(const AppendOnlyFile &) = delete;
+  AppendOnlyFile &operator=(const AppendOnlyFile &) = delete;
+
+  /**
+   * @brief replay the commands in `path` into the keyspace
+   *
+   * A truncated command at the tail (a crash in the middle of a write) is cut
+   * off the file; any other corruption fails the load.
+   *
+   * @return number of commands replayed, or -1 on error
+   */
+  int64_t load(const std::string &path);
+  bool open(const Config &config);
+  void close();
+  bool enabled() const { return fd_ != -1; }
+
+  // buffer one encoded command; nothing touches the file until `flush()`
+  void append(const uint8_t *data, size_t len);
+  // write out everything buffered in this loop iteration
+  void flush();
+
+  // fork a child that writes a compacted log of the live keyspace
+  bool start_rewrite();
+  bool rewriting() const { return rewrite_child_ != -1; }
+  // called once per loop iteration: finish a rewrite whose child has exited,
+  // or start one once the file has grown past the configured threshold
+  void cron();
+
+private:
+  int fd_ = -1;
+  std::string path_;
+  FsyncPolicy policy_ = FsyncPolicy::EVERYSEC;
+  std::vector<uint8_t> buf_;
+
+  // file size right after the last rewrite, and the current one
+  uint64_t base_size_ = 0;
+  uint64_t size_ = 0;
+  uint32_t rewrite_percentage_ = 0;
+  uint64_t rewrite_min_size_ = 0;
+  size_t rewrite_buffer_limit_ = 0;
+
+  // the commands that arrive while a rewrite child is running
+  pid_t rewrite_child_ = -1;
+  std::string rewrite_tmp_;
+  std::vector<uint8_t> rewrite_buf_;
+
+  // the background thread syncs whatever was written up to now (everysec),
+  // and closes the files replaced by a rewrite
+  std::thread fsync_thread_;
+  std::mutex mu_;
+  std::condition_variable cv_;
+  bool stop_ = false;
+  std::atomic<uint64_t> written_{0};
+  uint64_t synced_ = 0;
+  std::vector<int> retired_fds_;
+
+  void fsync_loop();
+  void abort_rewrite();
+  void finish_rewrite(bool ok);
+};
@@ -0,0 +1,222 @@
+#include "bitmap.hpp"
+#include <cstring>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+int bitmap_getbit(const std::string &value, uint64_t offset) {
+  uint64_t byte = offset >> 3;
+  if (byte >= value.size()) {
+    return 0;
+  }
+  return ((uint8_t)value[byte] >> (7 - (offset & 7))) & 1;
+}
+
+int bitmap_setbit(std::string &value, uint64_t offset, int bit) {
+  uint64_t byte = offset >> 3;
+  if (byte >= value.size()) {
+    value.resize(byte + 1, '\0');
+  }
+  uint8_t mask = (uint8_t)(0x80 >> (offset & 7));
+  uint8_t old = (uint8_t)value[byte];
+  value[byte] = (char)(bit ? old | mask : old & ~mask);
+  return (old & mask) != 0;
+}
+
+static uint64_t popcount_sw(const uint8_t *p, size_t n) {
+  uint64_t count = 0;
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    uint64_t w = 0;
+    memcpy(&w, p + i, 8);
+    count += __builtin_popcountll(w);
+  }
+  for (; i < n; i++) {
+    count += __builtin_popcount(p[i]);
+  }
+  return count;
+}
+
+#if defined(__x86_64__)
+// the same with the POPCNT instruction, four words at a time so no count
+// waits on the one before
+__attribute__((target("popcnt"))) static uint64_t
+popcount_hw(const uint8_t *p, size_t n) {
+  uint64_t c[4] = {0, 0, 0, 0};
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    uint64_t w[4];
+    memcpy(w, p + i, 32);
+    c[0] += __builtin_popcountll(w[0]);
+    c[1] += __builtin_popcountll(w[1]);
+    c[2] += __builtin_popcountll(w[2]);
+    c[3] += __builtin_popcountll(w[3]);
+  }
+  return c[0] + c[1] + c[2] + c[3] + popcount_sw(p + i, n - i);
+}
+
+// 64 bytes a step: the count of each nibble looked up with a byte shuffle,
+// then the byte counts summed into 64-bit lanes by SAD against zero
+__attribute__((target("avx2"))) static uint64_t
+popcount_avx2(const uint8_t *p, size_t n) {
+  const __m256i lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2,
+                                       3, 3, 4, 0, 1, 1, 2, 1, 2, 2, 3, 1, 2,
+                                       2, 3, 2, 3, 3, 4);
+  const __m256i low = _mm256_set1_epi8(0x0f);
+  __m256i sum = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 64 <= n; i += 64) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(p + i));
+    __m256i b = _mm256_loadu_si256((const __m256i *)(p + i + 32));
+    __m256i ca = _mm256_add_epi8(
+        _mm256_shuffle_epi8(lut, _mm256_and_si256(a, low)),
+        _mm256_shuffle_epi8(lut,
+                            _mm256_and_si256(_mm256_srli_epi16(a, 4), low)));
+    __m256i cb = _mm256_add_epi8(
+        _mm256_shuffle_epi8(lut, _mm256_and_si256(b, low)),
+        _mm256_shuffle_epi8(lut,
+                            _mm256_and_si256(_mm256_srli_epi16(b, 4), low)));
+    sum = _mm256_add_epi64(sum, _mm256_sad_epu8(_mm256_add_epi8(ca, cb),
+                                                _mm256_setzero_si256()));
+  }
+  uint64_t lanes[4];
+  _mm256_storeu_si256((__m256i *)lanes, sum);
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+         popcount_hw(p + i, n - i);
+}
+#endif
+
+static uint64_t popcount(const uint8_t *p, size_t n) {
+#if defined(__x86_64__)
+  static const bool has_avx2 = __builtin_cpu_supports("avx2");
+  static const bool has_popcnt = __builtin_cpu_supports("popcnt");
+  if (has_avx2) {
+    return popcount_avx2(p, n);
+  }
+  if (has_popcnt) {
+    return popcount_hw(p, n);
+  }
+#endif
+  return popcount_sw(p, n);
+}
+
+uint64_t bitmap_count(const std::string &value, uint64_t first,
+                      uint64_t last) {
+  const uint8_t *p = (const uint8_t *)value.data();
+  uint64_t fb = first >> 3;
+  uint64_t lb = last >> 3;
+  // the bits of the first and the last byte inside the range
+  uint8_t head = (uint8_t)(0xff >> (first & 7));
+  uint8_t tail = (uint8_t)(0xff << (7 - (last & 7)));
+  if (fb == lb) {
+    return __builtin_popcount(p[fb] & head & tail);
+  }
+  return __builtin_popcount(p[fb] & head) + popcount(p + fb + 1, lb - fb - 1) +
+         __builtin_popcount(p[lb] & tail);
+}
+
+int64_t bitmap_pos(const std::string &value, int bit, uint64_t first,
+                   uint64_t last) {
+  const uint8_t *p = (const uint8_t *)value.data();
+  // whole bytes and words like this have no bit to find
+  const uint8_t skip_byte = bit ? 0 : 0xff;
+  const uint64_t skip_word = bit ? 0 : ~(uint64_t)0;
+  uint64_t i = first;
+  while (i <= last) {
+    if ((i & 7) == 0) {
+      for (; i + 63 <= last; i += 64) {
+        uint64_t w = 0;
+        memcpy(&w, p + (i >> 3), 8);
+        if (w != skip_word) {
+          break;
+        }
+      }
+      for (; i + 7 <= last && p[i >> 3] == skip_byte; i += 8) {
+      }
+      if (i > last) {
+        break;
+      }
+    }
+    if ((int)((p[i >> 3] >> (7 - (i & 7))) & 1) == bit) {
+      return (int64_t)i;
+    }
+    i++;
+  }
+  return -1;
+}
+
+// `acc[i] = acc[i] op src[i]` for `n` bytes; `src` is unused for NOT
+static void combine_sw(BitOp op, uint8_t *acc, const uint8_t *src, size_t n) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    uint64_t a = 0;
+    uint64_t b = ~(uint64_t)0;
+    memcpy(&a, acc + i, 8);
+    if (op != BitOp::NOT) {
+      memcpy(&b, src + i, 8);
+    }
+    a = op == BitOp::AND ? a & b : op == BitOp::OR ? a | b : a ^ b;
+    memcpy(acc + i, &a, 8);
+  }
+  for (; i < n; i++) {
+    uint8_t b = op == BitOp::NOT ? 0xff : src[i];
+    acc[i] = op == BitOp::AND ? acc[i] & b
+             : op == BitOp::OR ? acc[i] | b
+                               : acc[i] ^ b;
+  }
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2"))) static void
+combine_avx2(BitOp op, uint8_t *acc, const uint8_t *src, size_t n) {
+  const __m256i ones = _mm256_set1_epi8(-1);
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(acc + i));
+    __m256i b = op == BitOp::NOT
+                    ? ones
+                    : _mm256_loadu_si256((const __m256i *)(src + i));
+    a = op == BitOp::AND  ? _mm256_and_si256(a, b)
+        : op == BitOp::OR ? _mm256_or_si256(a, b)
+                          : _mm256_xor_si256(a, b);
+    _mm256_storeu_si256((__m256i *)(acc + i), a);
+  }
+  combine_sw(op, acc + i, op == BitOp::NOT ? nullptr : src + i, n - i);
+}
+#endif
+
+static void combine(BitOp op, uint8_t *acc, const uint8_t *src, size_t n) {
+#if defined(__x86_64__)
+  static const bool has_avx2 = __builtin_cpu_supports("avx2");
+  if (has_avx2) {
+    return combine_avx2(op, acc, src, n);
+  }
+#endif
+  combine_sw(op, acc, src, n);
+}
+
+void bitmap_op(BitOp op, const std::vector<const std::string *> &srcs,
+               std::string &dest) {
+  size_t size = 0;
+  for (const std::string *src : srcs) {
+    size = src->size() > size ? src->size() : size;
+  }
+  if (srcs.empty()) {
+    return dest.clear();
+  }
+  dest.reserve(size);
+  dest.assign(*srcs[0]);
+  dest.resize(size, '\0');
+  uint8_t *acc = (uint8_t *)&dest[0];
+  if (op == BitOp::NOT) {
+    return combine(op, acc, nullptr, size);
+  }
+  for (size_t i = 1; i < srcs.size(); i++) {
+    const std::string &src = *srcs[i];
+    combine(op, acc, (const uint8_t *)src.data(), src.size());
+    if (op == BitOp::AND) {
+      // and the zeros it is padded with
+      memset(acc + src.size(), 0, size - src.size());
+    }
+  }
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Bitmaps are string values, addressed as Redis does: bit 0 is the highest
+// bit of the first byte. Reads past the end see zero bits, and SETBIT grows
+// the string with zero bytes. The popcount and BITOP kernels go 64 or 32
+// bytes at a time with AVX2, else a word at a time, picked at run time.
+
+enum class BitOp : uint8_t { AND, OR, XOR, NOT };
+
+// the bit at `offset`, 0 past the end
+int bitmap_getbit(const std::string &value, uint64_t offset);
+// set the bit at `offset` to `bit`, growing `value` to reach it; returns the
+// bit it was
+int bitmap_setbit(std::string &value, uint64_t offset, int bit);
+// the set bits in `[first, last]`, which must be inside `value`
+uint64_t bitmap_count(const std::string &value, uint64_t first,
+                      uint64_t last);
+// the first bit equal to `bit` in `[first, last]`, which must be inside
+// `value`; -1 if there is none
+int64_t bitmap_pos(const std::string &value, int bit, uint64_t first,
+                   uint64_t last);
+// `op` over `srcs` into `dest`, as long as the longest of them; a shorter one
+// reads as zero-padded. NOT takes one source.
+void bitmap_op(BitOp op, const std::vector<const std::string *> &srcs,
+               std::string &dest);
@@ -0,0 +1,144 @@
+#include "blocking.hpp"
+#include "connection.hpp"
+#include "global.hpp"
+#include "list_type.hpp"
+#include "request.hpp"
+#include <algorithm>
+#include <cstdlib>
+
+// Pop from `ent`, a list, for BLPOP/BRPOP: [key, element]. It goes to the
+// AOF and the replicas as LPOP/RPOP.
+static void pop_one(Entry *ent, bool front, Response &out) {
+  std::string key = ent->key;
+  Quicklist *list = list_of(ent);
+  std::string elem;
+  if (front) {
+    list->pop_front(elem);
+  } else {
+    list->pop_back(elem);
+  }
+  propagate({front ? "lpop" : "rpop", key});
+  out.out_arrary(2);
+  out.out_str(key);
+  out.out_str(elem);
+  if (list->size() == 0) {
+    GlobalState::store().del(key);
+  }
+}
+
+void Blocking::pop(Connection *conn, bool front,
+                   const std::vector<std::string> &cmd, Response &out) {
+  const std::string &arg = cmd.back();
+  char *endp = nullptr;
+  double timeout = strtod(arg.c_str(), &endp);
+  if (arg.empty() || endp != arg.c_str() + arg.size() || !(timeout < 1e12)) {
+    return out.out_err(ERR_BAD_ARG, "timeout is not a float or out of range");
+  }
+  if (timeout < 0) {
+    return out.out_err(ERR_BAD_ARG, "timeout is negative");
+  }
+  KeyStore &store = GlobalState::store();
+  for (size_t i = 1; i + 1 < cmd.size(); i++) {
+    Entry *ent = store.lookup(cmd[i]);
+    if (ent && ent->type != ValueType::LIST) {
+      return out.out_err(
+          ERR_WRONGTYPE,
+          "Operation against a key holding the wrong kind of value");
+    }
+    if (ent) {
+      return pop_one(ent, front, out);
+    }
+  }
+  // a timeout of 0 waits for good, anything else at least a millisecond
+  uint64_t deadline_ms = 0;
+  if (timeout > 0) {
+    deadline_ms = get_monotonic_msec() +
+                  std::max<uint64_t>((uint64_t)(timeout * 1000), 1);
+  }
+  block(conn, front, std::vector<std::string>(cmd.begin() + 1, cmd.end() - 1),
+        deadline_ms);
+}
+
+void Blocking::block(Connection *conn, bool front,
+                     std::vector<std::string> keys, uint64_t deadline_ms) {
+  std::unique_ptr<Wait> wait(new Wait);
+  wait->conn = conn;
+  wait->front = front;
+  wait->keys = std::move(keys);
+  wait->waiters.reset(new Waiter[wait->keys.size()]);
+  for (size_t i = 0; i < wait->keys.size(); i++) {
+    wait->waiters[i].wait = wait.get();
+    queues_[wait->keys[i]].insert_before(&wait->waiters[i].node);
+  }
+  if (deadline_ms != 0) {
+    deadlines_.insert(HeapItem{deadline_ms, &wait->heap_idx});
+  }
+  waits_[conn] = std::move(wait);
+  conn->block();
+}
+
+std::unique_ptr<Blocking::Wait> Blocking::release(Connection *conn) {
+  auto it = waits_.find(conn);
+  if (it == waits_.end()) {
+    return nullptr;
+  }
+  std::unique_ptr<Wait> wait = std::move(it->second);
+  waits_.erase(it);
+  for (size_t i = 0; i < wait->keys.size(); i++) {
+    wait->waiters[i].node.detach();
+    auto queue = queues_.find(wait->keys[i]);
+    if (queue != queues_.end() && queue->second.is_empty()) {
+      queues_.erase(queue);
+    }
+  }
+  if (wait->heap_idx != (size_t)-1) {
+    deadlines_.remove(wait->heap_idx);
+  }
+  return wait;
+}
+
+void Blocking::forget(Connection *conn) { release(conn); }
+
+namespace {
+struct ServeCtx {
+  Entry *ent;
+  bool front;
+};
+} // namespace
+
+void Blocking::wake(const std::string &key) {
+  KeyStore &store = GlobalState::store();
+  // one element per client, oldest first, until either runs out; a served
+  // client leaves every queue, so the queue is looked up again each time
+  while (true) {
+    auto queue = queues_.find(key);
+    if (queue == queues_.end()) {
+      return;
+    }
+    Entry *ent = store.lookup(key);
+    if (!ent || ent->type != ValueType::LIST) {
+      return;
+    }
+    Waiter *first = container_of(queue->second.next, Waiter, node);
+    std::unique_ptr<Wait> wait = release(first->wait->conn);
+    ServeCtx ctx = {ent, wait->front};
+    auto reply = [](Response &out, void *arg) {
+      ServeCtx &ctx = *(ServeCtx *)arg;
+      pop_one(ctx.ent, ctx.front, out);
+    };
+    wait->conn->unblock(reply, &ctx);
+  }
+}
+
+int64_t Blocking::next_deadline_ms() {
+  return deadlines_.is_empty() ? -1 : (int64_t)deadlines_.top().val;
+}
+
+void Blocking::expire(uint64_t now_ms) {
+  while (!deadlines_.is_empty() && deadlines_.top().val <= now_ms) {
+    Wait *wait = container_of(deadlines_.top().ref, Wait, heap_idx);
+    Connection *conn = wait->conn;
+    release(conn);
+    conn->unblock([](Response &out, void *) { out.out_nil(); }, nullptr);
+  }
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "heap.hpp"
+#include "utils.hpp"
+
+class Connection;
+class Response;
+
+// BLPOP and BRPOP. A client that finds every one of its lists empty is
+// parked: it gets a place at the back of the wait queue of each key, and on
+// the deadline heap if it has a timeout. Nothing polls for it. A push to one
+// of those keys hands elements to the queue in arrival order, and the event
+// loop sleeps no longer than the nearest deadline. Meanwhile the connection
+// runs none of the requests it sends and is off the idle timeout.
+class Blocking {
+public:
+  // `blpop|brpop key... timeout`, with `front` for BLPOP: [key, element]
+  // from the first list with one, else `conn` blocks and no reply is written
+  void pop(Connection *conn, bool front, const std::vector<std::string> &cmd,
+           Response &out);
+  // the list at `key` has new elements: serve the clients waiting on it
+  void wake(const std::string &key);
+  // `conn` is going away
+  void forget(Connection *conn);
+
+  // the nearest deadline, -1 if there is none
+  int64_t next_deadline_ms();
+  // time out the waits whose deadline has passed
+  void expire(uint64_t now_ms);
+
+private:
+  struct Wait;
+  // a place in the queue of one key
+  struct Waiter {
+    DList node;
+    Wait *wait = nullptr;
+  };
+  struct Wait {
+    Connection *conn = nullptr;
+    bool front = true;
+    std::vector<std::string> keys;
+    // as many as keys, linked in the queue of each
+    std::unique_ptr<Waiter[]> waiters;
+    size_t heap_idx = (size_t)-1; // not on the heap without a timeout
+  };
+
+  // the waiters on each key, oldest first
+  std::unordered_map<std::string, DList> queues_;
+  Heap deadlines_;
+  std::unordered_map<Connection *, std::unique_ptr<Wait>> waits_;
+
+  void block(Connection *conn, bool front, std::vector<std::string> keys,
+             uint64_t deadline_ms);
+  // take `conn` off every queue and the heap; the caller replies
+  std::unique_ptr<Wait> release(Connection *conn);
+};
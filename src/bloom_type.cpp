@@ -0,0 +1,322 @@
+#include "bloom_type.hpp"
+#include "utils.hpp"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+static const size_t k_block_bits = 512;
+static const size_t k_block_words = k_block_bits / 64;
+static const size_t k_block_bytes = k_block_bits / 8;
+// bits set per element, at most
+static const uint32_t k_max_hashes = 32;
+// lookups in flight at once, about as many cache misses as a core overlaps
+static const size_t k_batch = 16;
+// the error rate of a new layer against the one before
+static const double k_tightening = 0.5;
+
+// how pack() writes the filter, then each layer before its blocks
+struct FilterHeader {
+  uint32_t expansion;
+  uint32_t nlayers;
+};
+static_assert(sizeof(FilterHeader) == 8, "FilterHeader must be packed");
+
+struct LayerHeader {
+  double error_rate;
+  uint64_t capacity;
+  uint64_t count;
+  uint64_t nblocks;
+  uint32_t k;
+  uint32_t reserved;
+};
+static_assert(sizeof(LayerHeader) == 40, "LayerHeader must be packed");
+
+struct BloomFilter::Layer {
+  LayerHeader h;
+  // calloc'd, so a big layer's pages are only faulted in once they are
+  // written; `blocks` is its first cache line boundary, nullptr if calloc
+  // failed
+  void *mem = nullptr;
+  uint64_t *blocks = nullptr;
+
+  explicit Layer(const LayerHeader &header) : h(header) {
+    mem = calloc(h.nblocks + 1, k_block_bytes);
+    if (mem) {
+      uintptr_t at =
+          ((uintptr_t)mem + k_block_bytes - 1) & ~(k_block_bytes - 1);
+      blocks = (uint64_t *)at;
+    }
+  }
+  ~Layer() { free(mem); }
+  Layer(const Layer &) = delete;
+  Layer &operator=(const Layer &) = delete;
+
+  // the block of a hash: its high bits scaled to `nblocks` (Lemire's
+  // multiply-shift, no division)
+  uint64_t *block(uint64_t hash) const {
+    uint64_t i = (uint64_t)(((unsigned __int128)hash * h.nblocks) >> 64);
+    return blocks + i * k_block_words;
+  }
+};
+
+// The false positive rate of a blocked filter with `bits` bits per element
+// and `k` set by each. Unlike in a classic filter the load is uneven: the
+// number of elements in a block is Poisson distributed. Each of the other
+// elements in a block puts k / 8 bits in a word on average.
+static double blocked_fpr(double bits, uint32_t k) {
+  double lambda = k_block_bits / bits;
+  double last = lambda + 12 * std::sqrt(lambda) + 20;
+  double fpr = 0;
+  for (uint32_t i = 1; i <= last; i++) {
+    double p = std::exp(i * std::log(lambda) - lambda - std::lgamma(i + 1.0));
+    double fill = 1 - std::pow(1 - 1.0 / 64, (double)k * i / k_block_words);
+    fpr += p * std::pow(fill, k);
+  }
+  return fpr;
+}
+
+// A layer for `capacity` elements at `error_rate`: the fewest bits per
+// element, and the k for them, that keep it under that rate.
+static LayerHeader size_layer(double error_rate, uint64_t capacity) {
+  const double ln2 = std::log(2.0);
+  // a classic filter needs this many; a blocked one a few percent more
+  double bits = -std::log(error_rate) / (ln2 * ln2);
+  uint32_t k = 0;
+  for (;; bits *= 1.02) {
+    uint32_t best = (uint32_t)std::lround(bits * ln2);
+    uint32_t hi = best + 1 < k_max_hashes ? best + 1 : k_max_hashes;
+    uint32_t lo = best > 2 ? best - 1 : 1;
+    lo = lo < hi ? lo : hi;
+    for (k = lo; k <= hi && blocked_fpr(bits, k) > error_rate; k++) {
+    }
+    if (k <= hi) {
+      break;
+    }
+  }
+  LayerHeader h = {};
+  h.error_rate = error_rate;
+  h.capacity = capacity;
+  h.nblocks = (uint64_t)std::ceil(capacity * bits / k_block_bits);
+  h.nblocks = h.nblocks > 0 ? h.nblocks : 1;
+  h.k = k;
+  return h;
+}
+
+// murmur3's 64-bit finalizer
+static uint64_t fmix64(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+// Call `fn(word, bit)` for the `k` bits of an element in its block: one in
+// each word in turn from a hashed one, so no two share a word while k <= 8,
+// and all in registers. The word and the bits are slices of remixes of the
+// hash (splitmix64), independent of the bits that chose the block.
+template <typename Fn> static void probes(uint64_t hash, uint32_t k, Fn fn) {
+  uint64_t state = hash + 0x9e3779b97f4a7c15ULL;
+  uint64_t bits = fmix64(state);
+  uint32_t word = bits & (k_block_words - 1);
+  bits >>= 3;
+  uint32_t left = 10; // 6-bit slices left in `bits`
+  for (uint32_t i = 0; i < k; i++, left--) {
+    if (left == 0) {
+      state += 0x9e3779b97f4a7c15ULL;
+      bits = fmix64(state);
+      left = 10;
+    }
+    fn((word + i) & (k_block_words - 1), (uint64_t)1 << (bits & 63));
+    bits >>= 6;
+  }
+}
+
+// no early exit: whether it is taken is what a lookup is about, so it would
+// be mispredicted as often as not
+static bool block_test(const uint64_t *block, uint64_t hash, uint32_t k) {
+  uint64_t missing = 0;
+  probes(hash, k,
+         [&](uint32_t w, uint64_t bit) { missing |= bit & ~block[w]; });
+  return missing == 0;
+}
+
+static void block_set(uint64_t *block, uint64_t hash, uint32_t k) {
+  probes(hash, k, [&](uint32_t w, uint64_t bit) { block[w] |= bit; });
+}
+
+BloomFilter::BloomFilter() : bytes_(sizeof(FilterHeader)) {}
+
+BloomFilter::~BloomFilter() = default;
+
+BloomFilter *BloomFilter::create(double error_rate, uint64_t capacity,
+                                 uint32_t expansion) {
+  std::unique_ptr<BloomFilter> bf(new BloomFilter);
+  bf->expansion_ = expansion;
+  if (!bf->push_layer(size_layer(error_rate, capacity))) {
+    return nullptr;
+  }
+  return bf.release();
+}
+
+bool BloomFilter::push_layer(const LayerHeader &h) {
+  uint64_t left = k_bloom_max_bytes - bytes_;
+  if (left < sizeof(LayerHeader) ||
+      h.nblocks > (left - sizeof(LayerHeader)) / k_block_bytes) {
+    return false;
+  }
+  std::unique_ptr<Layer> layer(new Layer(h));
+  if (!layer->blocks) {
+    return false;
+  }
+  layers_.push_back(std::move(layer));
+  bytes_ += sizeof(LayerHeader) + h.nblocks * k_block_bytes;
+  return true;
+}
+
+bool BloomFilter::grow() {
+  const LayerHeader &last = layers_.back()->h;
+  uint64_t capacity = last.capacity * expansion_;
+  if (capacity / expansion_ != last.capacity) {
+    capacity = last.capacity; // it would overflow
+  }
+  double error_rate = last.error_rate * k_tightening;
+  if (error_rate < k_bloom_min_error_rate) {
+    error_rate = k_bloom_min_error_rate;
+  }
+  LayerHeader h = size_layer(error_rate, capacity);
+  // the last layer gets whatever is left of the budget, at the same bits per
+  // element
+  uint64_t left = k_bloom_max_bytes - bytes_;
+  uint64_t max_blocks = left > sizeof(LayerHeader)
+                            ? (left - sizeof(LayerHeader)) / k_block_bytes
+                            : 0;
+  if (h.nblocks > max_blocks) {
+    h.capacity = (uint64_t)((double)h.capacity * max_blocks / h.nblocks);
+    h.nblocks = max_blocks;
+  }
+  return h.capacity > 0 && push_layer(h);
+}
+
+bool BloomFilter::find(uint64_t hash) const {
+  // newest first: the biggest, with most of the elements
+  for (size_t l = layers_.size(); l-- > 0;) {
+    const Layer &layer = *layers_[l];
+    if (block_test(layer.block(hash), hash, layer.h.k)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void BloomFilter::contains(const uint64_t *hashes, size_t n,
+                           uint8_t *out) const {
+  for (size_t base = 0; base < n; base += k_batch) {
+    size_t end = base + k_batch < n ? base + k_batch : n;
+    // inline on purpose: GCC finds a function that only prefetches pure and
+    // drops the call
+    for (size_t i = base; i < end; i++) {
+      for (const auto &layer : layers_) {
+        __builtin_prefetch(layer->block(hashes[i]), 0);
+      }
+    }
+    for (size_t i = base; i < end; i++) {
+      out[i] = find(hashes[i]);
+    }
+  }
+}
+
+bool BloomFilter::add(const uint64_t *hashes, size_t n, uint8_t *out) {
+  for (size_t base = 0; base < n; base += k_batch) {
+    size_t end = base + k_batch < n ? base + k_batch : n;
+    for (size_t i = base; i < end; i++) {
+      for (size_t l = 0; l + 1 < layers_.size(); l++) {
+        __builtin_prefetch(layers_[l]->block(hashes[i]), 0);
+      }
+      // the last layer is the one written to
+      __builtin_prefetch(layers_.back()->block(hashes[i]), 1);
+    }
+    // one at a time, so an element twice in a batch is only added once
+    for (size_t i = base; i < end; i++) {
+      out[i] = !find(hashes[i]);
+      if (!out[i]) {
+        continue;
+      }
+      if (layers_.back()->h.count >= layers_.back()->h.capacity &&
+          !grow()) {
+        memset(out + i, 0, n - i);
+        return false;
+      }
+      Layer &layer = *layers_.back();
+      block_set(layer.block(hashes[i]), hashes[i], layer.h.k);
+      layer.h.count++;
+    }
+  }
+  return true;
+}
+
+void BloomFilter::pack(std::string &out) const {
+  FilterHeader fh = {expansion_, (uint32_t)layers_.size()};
+  size_t size = sizeof(fh);
+  for (const auto &layer : layers_) {
+    size += sizeof(LayerHeader) + layer->h.nblocks * k_block_bytes;
+  }
+  out.clear();
+  out.reserve(size);
+  out.append((const char *)&fh, sizeof(fh));
+  for (const auto &layer : layers_) {
+    out.append((const char *)&layer->h, sizeof(LayerHeader));
+    out.append((const char *)layer->blocks, layer->h.nblocks * k_block_bytes);
+  }
+}
+
+BloomFilter *BloomFilter::unpack(const std::string &packed) {
+  const char *p = packed.data();
+  const char *end = p + packed.size();
+  FilterHeader fh;
+  if ((size_t)(end - p) < sizeof(fh)) {
+    return nullptr;
+  }
+  memcpy(&fh, p, sizeof(fh));
+  p += sizeof(fh);
+  if (fh.expansion == 0 || fh.nlayers == 0) {
+    return nullptr;
+  }
+  std::unique_ptr<BloomFilter> bf(new BloomFilter);
+  bf->expansion_ = fh.expansion;
+  for (uint32_t l = 0; l < fh.nlayers; l++) {
+    LayerHeader h;
+    if ((size_t)(end - p) < sizeof(h)) {
+      return nullptr;
+    }
+    memcpy(&h, p, sizeof(h));
+    p += sizeof(h);
+    if (!(h.error_rate > 0 && h.error_rate < 1) || h.capacity == 0 ||
+        h.k == 0 || h.k > k_max_hashes || h.nblocks == 0 ||
+        h.nblocks > (size_t)(end - p) / k_block_bytes) {
+      return nullptr;
+    }
+    if (!bf->push_layer(h)) {
+      return nullptr;
+    }
+    memcpy(bf->layers_.back()->blocks, p, h.nblocks * k_block_bytes);
+    p += h.nblocks * k_block_bytes;
+  }
+  return p == end ? bf.release() : nullptr;
+}
+
+uint64_t bloom_hash(const std::string &elem) {
+  return murmurhash64a(elem.data(), elem.size(), 0xb10f11e5ULL);
+}
+
+BloomFilter *bloom_of(Entry *ent) { return (BloomFilter *)ent->obj.get(); }
+
+void bloom_pack(Entry *ent, std::string &out) { bloom_of(ent)->pack(out); }
+
+bool bloom_restore(Entry *ent) {
+  BloomFilter *bf = BloomFilter::unpack(ent->value);
+  std::string().swap(ent->value);
+  ent->obj.reset(bf);
+  return bf != nullptr;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "keystore.hpp"
+
+struct LayerHeader;
+
+// Bloom filter values, scalable as in RedisBloom: a stack of layers, each
+// one `expansion` times the size of the one before with half its error
+// rate, so the total error stays under twice the first. A layer is a
+// blocked Bloom filter: an element sets and tests its k bits in one 512-bit
+// block, a single cache line, chosen by its hash. Lookups are batched so
+// the cache misses of a batch overlap instead of waiting on each other.
+
+// the lowest error rate of a layer; later layers tighten no further
+static const double k_bloom_min_error_rate = 1e-12;
+// the most a filter takes packed, all layers together; well within the
+// 32-bit lengths of a snapshot record and of an AOF command
+static const uint64_t k_bloom_max_bytes = (uint64_t)1 << 30;
+
+class BloomFilter : public Object {
+public:
+  // nullptr if it would be over k_bloom_max_bytes or is out of memory
+  static BloomFilter *create(double error_rate, uint64_t capacity,
+                             uint32_t expansion);
+  ~BloomFilter() override;
+
+  // `out[i]` is 1 if the element of `hashes[i]` may have been added
+  void contains(const uint64_t *hashes, size_t n, uint8_t *out) const;
+  // add the elements; `out[i]` is 1 if its element was not there yet. False
+  // if the filter is full: a new layer would be over k_bloom_max_bytes or
+  // is out of memory. The elements before that one were added.
+  bool add(const uint64_t *hashes, size_t n, uint8_t *out);
+
+  void pack(std::string &out) const;
+  // nullptr if `packed` is not what pack() writes
+  static BloomFilter *unpack(const std::string &packed);
+
+private:
+  struct Layer;
+  uint32_t expansion_ = 2;
+  std::vector<std::unique_ptr<Layer>> layers_;
+  uint64_t bytes_; // what pack() writes
+
+  BloomFilter();
+  // false if `h` does not fit in k_bloom_max_bytes or is out of memory
+  bool push_layer(const LayerHeader &h);
+  bool find(uint64_t hash) const;
+  bool grow();
+};
+
+// the hash of an element: every probe of every layer comes from it
+uint64_t bloom_hash(const std::string &elem);
+BloomFilter *bloom_of(Entry *ent);
+void bloom_pack(Entry *ent, std::string &out);
+// `ent->value` was packed by bloom_pack() and read back: check it and
+// unpack it
+bool bloom_restore(Entry *ent);
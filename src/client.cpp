@@ -0,0 +1,286 @@
+#include "client.hpp"
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+Reply Reply::error(uint32_t code, const std::string &msg) {
+  std::vector<uint8_t> *buf = new std::vector<uint8_t>(msg.begin(), msg.end());
+  Reply reply;
+  reply.buf_.reset(buf);
+  reply.view_.type = ResponseType::ERR;
+  reply.view_.code = code;
+  reply.view_.str.data = (const char *)buf->data();
+  reply.view_.str.size = buf->size();
+  return reply;
+}
+
+bool Client::connect_to(int fd, const struct sockaddr *addr,
+                        size_t addrlen) {
+  close();
+  if (fd < 0) {
+    return false;
+  }
+  if (::connect(fd, addr, addrlen) < 0) {
+    ::close(fd);
+    return false;
+  }
+  fd_ = fd;
+  return true;
+}
+
+bool Client::connect_tcp(const std::string &host, uint16_t port) {
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) {
+    return false;
+  }
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (!connect_to(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+    return false;
+  }
+  // batches are written whole, so there is nothing for Nagle to merge
+  int on = 1;
+  setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  return true;
+}
+
+bool Client::connect_unix(const std::string &path) {
+  struct sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    return false;
+  }
+  memcpy(addr.sun_path, path.data(), path.size());
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  return connect_to(fd, (struct sockaddr *)&addr, sizeof(addr));
+}
+
+void Client::close() {
+  if (fd_ != -1) {
+    ::close(fd_);
+    fd_ = -1;
+  }
+  out_.clear();
+  in_flight_ = 0;
+  in_.reset();
+  in_begin_ = in_end_ = 0;
+}
+
+void Client::append(const std::vector<std::string> &cmd) {
+  encode_request(cmd, out_);
+  in_flight_++;
+}
+
+bool Client::flush() {
+  size_t sent = 0;
+  while (sent < out_.size()) {
+    ssize_t rv = ::send(fd_, out_.data() + sent, out_.size() - sent,
+                        MSG_NOSIGNAL);
+    if (rv < 0 && errno == EINTR) {
+      continue;
+    }
+    if (rv <= 0) {
+      close();
+      return false;
+    }
+    sent += rv;
+  }
+  out_.clear();
+  return true;
+}
+
+void Client::reserve_input(size_t need) {
+  size_t have = in_end_ - in_begin_;
+  if (in_ && in_.use_count() == 1 && in_->size() >= need) {
+    // nobody else looks at this chunk: slide what is left to the front
+    if (in_->size() - in_begin_ < need) {
+      memmove(in_->data(), in_->data() + in_begin_, have);
+      in_begin_ = 0;
+      in_end_ = have;
+    }
+    return;
+  }
+  if (in_ && in_->size() - in_begin_ >= need) {
+    return; // the bytes after `in_end_` are still ours to fill
+  }
+  // replies still point into the old chunk; only the partial frame moves
+  size_t size = need > k_chunk_size ? need : k_chunk_size;
+  auto chunk = std::make_shared<std::vector<uint8_t>>(size);
+  if (have > 0) {
+    memcpy(chunk->data(), in_->data() + in_begin_, have);
+  }
+  in_ = std::move(chunk);
+  in_begin_ = 0;
+  in_end_ = have;
+}
+
+// read until `need` bytes from `in_begin_` are there
+bool Client::fill(size_t need) {
+  if (in_end_ - in_begin_ >= need) {
+    return true;
+  }
+  reserve_input(need);
+  while (in_end_ - in_begin_ < need) {
+    ssize_t rv = ::read(fd_, in_->data() + in_end_, in_->size() - in_end_);
+    if (rv < 0 && errno == EINTR) {
+      continue;
+    }
+    if (rv <= 0) {
+      close();
+      return false;
+    }
+    in_end_ += rv;
+  }
+  return true;
+}
+
+bool Client::read_reply(Reply &out) {
+  if (in_flight_ == 0 || (!out_.empty() && !flush())) {
+    return false;
+  }
+  uint32_t len = 0;
+  if (!fill(4)) {
+    return false;
+  }
+  memcpy(&len, in_->data() + in_begin_, 4);
+  if (len > k_max_reply || !fill(4 + len)) {
+    close();
+    return false;
+  }
+  const uint8_t *body = in_->data() + in_begin_ + 4;
+  if (!decode_reply(body, len, out.view_)) {
+    close(); // out of sync with the server from here on
+    return false;
+  }
+  out.buf_ = in_;
+  in_begin_ += 4 + len;
+  in_flight_--;
+  return true;
+}
+
+bool Client::call(const std::vector<std::string> &cmd, Reply &out) {
+  append(cmd);
+  return read_reply(out);
+}
+
+bool Client::call_many(const std::vector<std::vector<std::string>> &cmds,
+                       std::vector<Reply> &out) {
+  for (const std::vector<std::string> &cmd : cmds) {
+    append(cmd);
+  }
+  if (!flush()) {
+    return false;
+  }
+  out.resize(cmds.size());
+  for (Reply &reply : out) {
+    if (!read_reply(reply)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+ClientPool::ClientPool(const Options &opt) : opt_(opt) {
+  for (size_t i = 0; i < std::max<size_t>(opt_.connections, 1); i++) {
+    slots_.emplace_back(new Slot());
+  }
+  for (auto &slot : slots_) {
+    Slot *s = slot.get();
+    s->thread = std::thread([this, s]() { run(*s); });
+  }
+}
+
+ClientPool::~ClientPool() {
+  for (auto &slot : slots_) {
+    std::lock_guard<std::mutex> lock(slot->mu);
+    slot->stop = true;
+    slot->cv.notify_one();
+  }
+  for (auto &slot : slots_) {
+    slot->thread.join();
+  }
+}
+
+void ClientPool::call_async(std::vector<std::string> cmd, Callback cb) {
+  Slot &slot = *slots_[next_slot_++ % slots_.size()];
+  std::lock_guard<std::mutex> lock(slot.mu);
+  slot.queue.push_back(Request{std::move(cmd), std::move(cb)});
+  slot.cv.notify_one();
+}
+
+std::future<Reply> ClientPool::call_future(std::vector<std::string> cmd) {
+  auto promise = std::make_shared<std::promise<Reply>>();
+  std::future<Reply> future = promise->get_future();
+  call_async(std::move(cmd),
+             [promise](const Reply &reply) { promise->set_value(reply); });
+  return future;
+}
+
+bool ClientPool::connect(Client &client) {
+  if (client.connected()) {
+    return true;
+  }
+  if (!opt_.unixsocket.empty()) {
+    return client.connect_unix(opt_.unixsocket);
+  }
+  return client.connect_tcp(opt_.host, opt_.port);
+}
+
+void ClientPool::run(Slot &slot) {
+  std::vector<Request> batch;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(slot.mu);
+      slot.cv.wait(lock, [&] { return slot.stop || !slot.queue.empty(); });
+      if (slot.queue.empty()) {
+        return; // stopped, and nothing left to send
+      }
+      // The whole batch is written before any reply is read, so it has to
+      // fit in the socket buffers: the server stops reading when its output
+      // backs up.
+      size_t n = 0;
+      size_t bytes = 0;
+      while (n < slot.queue.size() && n < opt_.max_batch &&
+             (n == 0 || bytes < opt_.max_batch_bytes)) {
+        bytes += 8;
+        for (const std::string &s : slot.queue[n].cmd) {
+          bytes += 4 + s.size();
+        }
+        n++;
+      }
+      batch.assign(std::make_move_iterator(slot.queue.begin()),
+                   std::make_move_iterator(slot.queue.begin() + n));
+      slot.queue.erase(slot.queue.begin(), slot.queue.begin() + n);
+    }
+
+    Client &client = slot.client;
+    bool ok = connect(client);
+    if (ok) {
+      for (const Request &req : batch) {
+        client.append(req.cmd);
+      }
+      ok = client.flush();
+    }
+    size_t done = 0;
+    while (ok && done < batch.size()) {
+      Reply reply;
+      ok = client.read_reply(reply);
+      if (ok) {
+        batch[done++].cb(reply);
+      }
+    }
+    if (!ok) {
+      client.close();
+      Reply err = Reply::error(ERR_IO, "connection failed");
+      for (; done < batch.size(); done++) {
+        batch[done].cb(err);
+      }
+    }
+    batch.clear();
+  }
+}
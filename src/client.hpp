@@ -0,0 +1,158 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <vector>
+
+#include "protocol.hpp"
+
+// Client library. Requests and replies go through the same codec as the
+// server's (protocol.hpp).
+
+enum ClientErrorType {
+  // the reply never came: connecting, sending or reading failed
+  ERR_IO = 1000,
+};
+
+// A response. It keeps the buffer it was read into alive, so its view (and
+// the views of its array elements) need no copy.
+class Reply {
+public:
+  Reply() = default;
+  // a reply standing in for one that could not be read
+  static Reply error(uint32_t code, const std::string &msg);
+
+  const ReplyView &view() const { return view_; }
+  ResponseType type() const { return view_.type; }
+  bool is_nil() const { return view_.type == ResponseType::NIL; }
+  bool is_err() const { return view_.is_err(); }
+  // STR, or the message of an ERR
+  StrView str() const { return view_.str; }
+  int64_t integer() const { return view_.integer; }
+  std::vector<ReplyView> elements() const { return view_.elements(); }
+
+private:
+  friend class Client;
+  std::shared_ptr<const std::vector<uint8_t>> buf_;
+  ReplyView view_;
+};
+
+/**
+ * @brief one blocking connection, for one thread at a time
+ *
+ * Requests can be pipelined: `append()` any number of them, then
+ * `read_reply()` once for each, in order.
+ */
+class Client {
+public:
+  Client() = default;
+  ~Client() { close(); }
+  Client(const Client &) = delete;
+  Client &operator=(const Client &) = delete;
+
+  bool connect_tcp(const std::string &host, uint16_t port);
+  bool connect_unix(const std::string &path);
+  bool connected() const { return fd_ != -1; }
+  // drop the connection and every request still waiting for a reply
+  void close();
+
+  // queue a request, sent by the next `flush()` or `read_reply()`
+  void append(const std::vector<std::string> &cmd);
+  bool flush();
+  // the reply to the oldest request that has not had one yet
+  bool read_reply(Reply &out);
+  // requests appended whose replies have not been read
+  size_t in_flight() const { return in_flight_; }
+
+  // one request, one round trip
+  bool call(const std::vector<std::string> &cmd, Reply &out);
+  // all of `cmds` in one write, then all of their replies; keep it to what
+  // the socket buffers hold, see ClientPool::run()
+  bool call_many(const std::vector<std::vector<std::string>> &cmds,
+                 std::vector<Reply> &out);
+
+private:
+  static const size_t k_chunk_size = 64 * 1024;
+  static const size_t k_max_reply = 64 * 1024 * 1024;
+
+  int fd_ = -1;
+  std::vector<uint8_t> out_;
+  size_t in_flight_ = 0;
+  // Replies are decoded where they were read, and the bytes a `Reply`
+  // points at are never written again: once a chunk is shared, what does not
+  // fit after its end goes to a fresh one.
+  std::shared_ptr<std::vector<uint8_t>> in_;
+  size_t in_begin_ = 0;
+  size_t in_end_ = 0;
+
+  bool connect_to(int fd, const struct sockaddr *addr, size_t addrlen);
+  // make room for `need` contiguous bytes from `in_begin_`
+  void reserve_input(size_t need);
+  bool fill(size_t need);
+};
+
+/**
+ * @brief connections shared by any number of threads
+ *
+ * Each connection has an I/O thread. Requests are spread over the
+ * connections, and whatever queues up on one while it waits for replies is
+ * sent in its next write: concurrent callers get pipelined without asking.
+ * A connection that fails is reopened for the next batch; the requests it
+ * had in flight get an ERR_IO reply.
+ */
+class ClientPool {
+public:
+  struct Options {
+    std::string host = "127.0.0.1";
+    uint16_t port = 1234;
+    std::string unixsocket; // used instead of host:port if set
+    size_t connections = 4;
+    size_t max_batch = 1024; // requests per write
+    size_t max_batch_bytes = 64 * 1024;
+  };
+  using Callback = std::function<void(const Reply &)>;
+
+  explicit ClientPool(const Options &opt);
+  // waits for the queued requests to finish
+  ~ClientPool();
+  ClientPool(const ClientPool &) = delete;
+  ClientPool &operator=(const ClientPool &) = delete;
+
+  // `cb` runs on an I/O thread and should not block
+  void call_async(std::vector<std::string> cmd, Callback cb);
+  std::future<Reply> call_future(std::vector<std::string> cmd);
+  Reply call(std::vector<std::string> cmd) {
+    return call_future(std::move(cmd)).get();
+  }
+
+private:
+  struct Request {
+    std::vector<std::string> cmd;
+    Callback cb;
+  };
+  struct Slot {
+    std::mutex mu;
+    std::condition_variable cv;
+    std::deque<Request> queue;
+    bool stop = false;
+    Client client;
+    std::thread thread;
+  };
+
+  Options opt_;
+  std::vector<std::unique_ptr<Slot>> slots_;
+  std::atomic<size_t> next_slot_{0};
+
+  void run(Slot &slot);
+  bool connect(Client &client);
+};
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "protocol.hpp"
+
+// Command descriptors, and the perfect hash that finds them by name.
+
+enum CommandFlags : uint32_t {
+  CMD_WRITE = 1,    // changes the keyspace, so it is propagated
+  CMD_READONLY = 2, // only reads the keyspace
+  CMD_ADMIN = 4,    // about the server, not the data
+};
+
+using CommandHandler = void (*)(std::vector<std::string> &&cmd,
+                                Response &out);
+
+struct Command {
+  const char *name; // lower case
+  // nullptr for the commands the connection handles itself
+  CommandHandler handler;
+  // like Redis: N for exactly N arguments counting the name, -N for at least N
+  int arity;
+  uint32_t flags;
+  // The keys are cmd[first_key], cmd[first_key + key_step], ... up to
+  // cmd[last_key]; a negative last_key counts from the end. first_key 0 means
+  // there are none.
+  int first_key;
+  int last_key;
+  int key_step;
+
+  bool check_arity(size_t argc) const {
+    return arity >= 0 ? argc == (size_t)arity : argc >= (size_t)-arity;
+  }
+};
+
+constexpr char ascii_lower(char c) {
+  return c >= 'A' && c <= 'Z' ? char(c - 'A' + 'a') : c;
+}
+
+// FNV-1a of the lower-cased name, salted with `seed`
+constexpr uint32_t command_hash(const char *name, size_t len, uint32_t seed) {
+  uint32_t h = 2166136261u ^ seed;
+  for (size_t i = 0; i < len; i++) {
+    h = (h ^ (uint8_t)ascii_lower(name[i])) * 16777619u;
+  }
+  return h ^ (h >> 16);
+}
+
+constexpr size_t const_strlen(const char *s) {
+  size_t n = 0;
+  while (s[n]) {
+    n++;
+  }
+  return n;
+}
+
+// a power of two with 8 slots or more per name
+constexpr size_t slots_for(size_t n) {
+  size_t slots = 1;
+  while (slots < 8 * n) {
+    slots *= 2;
+  }
+  return slots;
+}
+
+/**
+ * @brief a collision-free slot for each of `N` names, found at compile time
+ *
+ * The seed is the first one that sends every name to its own slot, with 8
+ * slots per name so that one turns up after a few tries. A lookup is then one
+ * hash and one comparison however many commands there are.
+ */
+template <size_t N> struct CommandIndex {
+  static_assert(N < 255, "slot indices are one byte");
+  static constexpr size_t k_slots = slots_for(N);
+  static constexpr uint8_t k_empty = 0xff;
+
+  uint32_t seed = 0;
+  uint8_t slots[k_slots] = {};
+  // the length of each name, checked before its bytes
+  uint8_t lens[N] = {};
+};
+
+template <size_t N>
+constexpr CommandIndex<N> build_command_index(const Command (&table)[N]) {
+  CommandIndex<N> index;
+  for (uint32_t seed = 1;; seed++) {
+    for (size_t i = 0; i < index.k_slots; i++) {
+      index.slots[i] = index.k_empty;
+    }
+    bool ok = true;
+    for (size_t i = 0; i < N && ok; i++) {
+      const char *name = table[i].name;
+      uint32_t h = command_hash(name, const_strlen(name), seed);
+      uint8_t &slot = index.slots[h & (index.k_slots - 1)];
+      ok = slot == index.k_empty;
+      slot = (uint8_t)i;
+    }
+    if (ok) {
+      for (size_t i = 0; i < N; i++) {
+        index.lens[i] = (uint8_t)const_strlen(table[i].name);
+      }
+      index.seed = seed;
+      return index;
+    }
+  }
+}
+
+// the command named `name` in any case, or nullptr
+const Command *lookup_command(const std::string &name);
+// the positions of the keys in `cmd`, whose arity has been checked
+void command_keys(const Command &c, const std::vector<std::string> &cmd,
+                  std::vector<size_t> &out);
@@ -0,0 +1,153 @@
+#include "config.hpp"
+#include "logger.hpp"
+#include <cstdlib>
+#include <cstring>
+
+static bool parse_bool(const std::string &s, bool &out) {
+  if (s == "yes") {
+    out = true;
+  } else if (s == "no") {
+    out = false;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+static bool parse_u16(const std::string &s, uint16_t &out) {
+  char *endp = NULL;
+  long v = strtol(s.c_str(), &endp, 10);
+  if (endp != s.c_str() + s.size() || v <= 0 || v > UINT16_MAX) {
+    return false;
+  }
+  out = (uint16_t)v;
+  return true;
+}
+
+static bool parse_u64(const std::string &s, uint64_t &out) {
+  char *endp = NULL;
+  if (s.empty() || s[0] == '-') {
+    return false;
+  }
+  out = strtoull(s.c_str(), &endp, 10);
+  return endp == s.c_str() + s.size();
+}
+
+static bool parse_u32(const std::string &s, uint32_t &out) {
+  uint64_t v = 0;
+  if (!parse_u64(s, v) || v > UINT32_MAX) {
+    return false;
+  }
+  out = (uint32_t)v;
+  return true;
+}
+
+// `host:port`
+static bool parse_host_port(const std::string &s, std::string &host,
+                            uint16_t &port) {
+  size_t colon = s.rfind(':');
+  if (colon == std::string::npos || colon == 0) {
+    return false;
+  }
+  host = s.substr(0, colon);
+  return parse_u16(s.substr(colon + 1), port);
+}
+
+static bool parse_octal(const std::string &s, uint32_t &out) {
+  char *endp = NULL;
+  long v = strtol(s.c_str(), &endp, 8);
+  if (s.empty() || endp != s.c_str() + s.size() || v < 0 || v > 0777) {
+    return false;
+  }
+  out = (uint32_t)v;
+  return true;
+}
+
+static bool parse_fsync_policy(const std::string &s, FsyncPolicy &out) {
+  if (s == "always") {
+    out = FsyncPolicy::ALWAYS;
+  } else if (s == "everysec") {
+    out = FsyncPolicy::EVERYSEC;
+  } else if (s == "no") {
+    out = FsyncPolicy::NO;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool parse_args(int argc, char *argv[], Config &out) {
+  for (int i = 1; i < argc; i += 2) {
+    if (strncmp(argv[i], "--", 2) != 0 || i + 1 >= argc) {
+      LOG(ERROR, "bad argument: {}", argv[i]);
+      return false;
+    }
+    std::string name = argv[i] + 2;
+    std::string value = argv[i + 1];
+    bool ok = false;
+    if (name == "port") {
+      ok = parse_u16(value, out.port);
+    } else if (name == "tcp-backlog") {
+      ok = parse_u32(value, out.tcp_backlog) && out.tcp_backlog > 0 &&
+           out.tcp_backlog <= INT32_MAX;
+    } else if (name == "tcp-nodelay") {
+      ok = parse_bool(value, out.tcp_nodelay);
+    } else if (name == "tcp-sndbuf") {
+      ok = parse_u32(value, out.tcp_sndbuf) && out.tcp_sndbuf <= INT32_MAX;
+    } else if (name == "tcp-rcvbuf") {
+      ok = parse_u32(value, out.tcp_rcvbuf) && out.tcp_rcvbuf <= INT32_MAX;
+    } else if (name == "unixsocket") {
+      out.unixsocket = value;
+      ok = !value.empty();
+    } else if (name == "unixsocketperm") {
+      ok = parse_octal(value, out.unixsocketperm);
+    } else if (name == "shm-ring-size") {
+      ok = parse_u64(value, out.shm_ring_size) && out.shm_ring_size >= 4096 &&
+           (out.shm_ring_size & (out.shm_ring_size - 1)) == 0;
+    } else if (name == "client-output-soft-limit") {
+      ok = parse_u64(value, out.client_output_soft_limit);
+    } else if (name == "client-output-hard-limit") {
+      ok = parse_u64(value, out.client_output_hard_limit);
+    } else if (name == "replica-output-hard-limit") {
+      ok = parse_u64(value, out.replica_output_hard_limit);
+    } else if (name == "appendonly") {
+      ok = parse_bool(value, out.appendonly);
+    } else if (name == "appendfilename") {
+      out.appendfilename = value;
+      ok = !value.empty();
+    } else if (name == "appendfsync") {
+      ok = parse_fsync_policy(value, out.appendfsync);
+    } else if (name == "auto-aof-rewrite-percentage") {
+      ok = parse_u32(value, out.auto_aof_rewrite_percentage);
+    } else if (name == "auto-aof-rewrite-min-size") {
+      ok = parse_u64(value, out.auto_aof_rewrite_min_size);
+    } else if (name == "aof-rewrite-buffer-limit") {
+      ok = parse_u64(value, out.aof_rewrite_buffer_limit);
+    } else if (name == "hash-max-listpack-entries") {
+      ok = parse_u64(value, out.hash_max_listpack_entries);
+    } else if (name == "hash-max-listpack-value") {
+      ok = parse_u64(value, out.hash_max_listpack_value);
+    } else if (name == "list-max-listpack-size") {
+      ok = parse_u64(value, out.list_max_listpack_size);
+    } else if (name == "set-max-intset-entries") {
+      ok = parse_u64(value, out.set_max_intset_entries);
+    } else if (name == "hll-sparse-max-bytes") {
+      ok = parse_u64(value, out.hll_sparse_max_bytes);
+    } else if (name == "dbfilename") {
+      out.dbfilename = value;
+      ok = !value.empty();
+    } else if (name == "replicaof") {
+      ok = parse_host_port(value, out.replicaof_host, out.replicaof_port);
+    } else if (name == "repl-backlog-size") {
+      ok = parse_u64(value, out.repl_backlog_size) && out.repl_backlog_size > 0;
+    } else {
+      LOG(ERROR, "unknown option: --{}", name);
+      return false;
+    }
+    if (!ok) {
+      LOG(ERROR, "bad value for --{}: {}", name, value);
+      return false;
+    }
+  }
+  return true;
+}
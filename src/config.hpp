@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+enum class FsyncPolicy {
+  ALWAYS = 0,   // fsync after every write, before replies go out
+  EVERYSEC = 1, // fsync once per second on a background thread
+  NO = 2,       // leave flushing to the OS
+};
+
+struct Config {
+  uint16_t port = 1234;
+  // listen() backlog, still capped by net.core.somaxconn
+  uint32_t tcp_backlog = 511;
+  bool tcp_nodelay = true;
+  // SO_SNDBUF/SO_RCVBUF of accepted sockets, 0 keeps the kernel default
+  uint32_t tcp_sndbuf = 0;
+  uint32_t tcp_rcvbuf = 0;
+  // also listen on this AF_UNIX path, with these permissions (0 leaves
+  // them to the umask)
+  std::string unixsocket;
+  uint32_t unixsocketperm = 0;
+  // each direction of a shared-memory client (`shmattach`), a power of 2
+  uint64_t shm_ring_size = 1024 * 1024;
+
+  // pending output of a client: past the soft limit its remaining requests
+  // wait until the output drains, past the hard limit it is disconnected.
+  // 0 disables a limit.
+  uint64_t client_output_soft_limit = 1024 * 1024;
+  uint64_t client_output_hard_limit = 64 * 1024 * 1024;
+  // replicas send nothing to pause, they only have the hard limit
+  uint64_t replica_output_hard_limit = 256 * 1024 * 1024;
+
+  // append-only file
+  bool appendonly = false;
+  std::string appendfilename = "appendonly.aof";
+  FsyncPolicy appendfsync = FsyncPolicy::EVERYSEC;
+  // rewrite once the file has grown by this percentage since the last
+  // rewrite (0 disables it), but not before it reaches the min size
+  uint32_t auto_aof_rewrite_percentage = 100;
+  uint64_t auto_aof_rewrite_min_size = 64 * 1024 * 1024;
+  // writes buffered while a rewrite runs; the rewrite is abandoned past this
+  uint64_t aof_rewrite_buffer_limit = 64 * 1024 * 1024;
+
+  // a hash is packed until it has more fields than this, or a field or a
+  // value longer than that (see hash_type.hpp)
+  uint64_t hash_max_listpack_entries = 128;
+  uint64_t hash_max_listpack_value = 64;
+  // bytes of elements packed in each node of a list (see list_type.hpp)
+  uint64_t list_max_listpack_size = 8192;
+  // a set of integers is an intset up to this many (see set_type.hpp)
+  uint64_t set_max_intset_entries = 512;
+  // a HyperLogLog is sparse up to this many bytes (see hyperloglog.hpp)
+  uint64_t hll_sparse_max_bytes = 3000;
+
+  // binary snapshot written by SAVE/BGSAVE, loaded when the AOF is off
+  std::string dbfilename = "dump.srdb";
+
+  // replication
+  std::string replicaof_host; // empty: we are a primary
+  uint16_t replicaof_port = 0;
+  uint64_t repl_backlog_size = 1024 * 1024;
+};
+
+/**
+ * @brief parse `--name value` pairs from the command line into `out`
+ *
+ * @return false if an option is unknown or its value is malformed
+ */
+bool parse_args(int argc, char *argv[], Config &out);
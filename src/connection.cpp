@@ -1,82 +1,621 @@
 #include "connection.hpp"
+#include "global.hpp"
 #include "request.hpp"
+#include "resp.hpp"
+#include "shm.hpp"
 #include "utils.hpp"
+#include <algorithm>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+
+namespace {
+// every read() lands here first
+thread_local uint8_t t_read_buf[64 * 1024];
+
+// buffers of connections with nothing pending, so that an idle connection
+// holds no buffer memory
+struct BufferPool {
+  static const size_t k_max_buffers = 256;
+  // anything bigger was grown for one large request or reply, free it
+  static const size_t k_max_capacity = 16 * 1024;
+  std::vector<std::vector<uint8_t>> free;
+};
+thread_local BufferPool t_pool;
+} // namespace
+
+static void buffer_attach(std::vector<uint8_t> &buf) {
+  if (buf.capacity() == 0 && !t_pool.free.empty()) {
+    buf.swap(t_pool.free.back());
+    t_pool.free.pop_back();
+  }
+}
+
+static void buffer_release(std::vector<uint8_t> &buf) {
+  assert(buf.empty());
+  if (buf.capacity() > 0 && buf.capacity() <= BufferPool::k_max_capacity &&
+      t_pool.free.size() < BufferPool::k_max_buffers) {
+    t_pool.free.push_back(std::move(buf));
+  }
+  std::vector<uint8_t>().swap(buf);
+}
+
+Connection::~Connection() {
+  if (is_replica_) {
+    GlobalState::replication().detach(this);
+  }
+  if (blocked_) {
+    GlobalState::blocking().forget(this);
+  }
+  if (subscribed_) {
+    GlobalState::pubsub().forget(this);
+  }
+  if (file_fd_ != -1) {
+    close(file_fd_);
+  }
+  if (fd_ != -1) {
+    close(fd_);
+  }
+  timeout_node.detach();
+  pending_node.detach();
+  shm_node.detach();
+}
 
 void Connection::handle_read() {
-  ssize_t rv = read(fd_, rbuf_, sizeof(rbuf_));
+  ssize_t rv = read(fd_, t_read_buf, sizeof(t_read_buf));
   // handle error
   if (rv < 0) {
     // EAGAIN means "there is no data available right now, try again later".
     if (errno != EAGAIN) {
-      LOG(ERROR) << "read failed: " << strerror(errno) << "\n";
+      LOG_RATELIMITED(ERROR, 10, "read failed: {}", strerror(errno));
       state_ = ConnectionState::STATE_END;
     }
     return;
   } else if (rv == 0) { // handle EOF
     if (incoming_.size() == 0) {
-      LOG(INFO) << "client closed"
-                << "\n";
+      LOG_RATELIMITED(INFO, 100, "client closed");
     } else {
-      LOG(INFO) << "unexpected EOF"
-                << "\n";
+      LOG_RATELIMITED(INFO, 100, "unexpected EOF");
     }
     state_ = ConnectionState::STATE_END;
     return;
+  } else if (shm_) {
+    // after shmattach the socket only signals that the client is gone
+    LOG_RATELIMITED(ERROR, 10, "request on the socket of a shm client");
+    state_ = ConnectionState::STATE_END;
+    return;
   } else {
-    incoming_.insert(incoming_.end(), rbuf_, rbuf_ + rv);
-    while (try_one_request()) {
+    consume_input(t_read_buf, rv);
+  }
+}
+
+void Connection::consume_input(const uint8_t *data, size_t len) {
+  const uint8_t *begin = data;
+  const uint8_t *end = data + len;
+  if (!incoming_.empty()) {
+    incoming_.insert(incoming_.end(), begin, end);
+    begin = incoming_.data();
+    end = begin + incoming_.size();
+  }
+  process_input(begin, end);
+}
+
+// whether a whole request starts at `cur`
+bool Connection::has_request(const uint8_t *cur, const uint8_t *end) const {
+  if (proto_ != Protocol::NATIVE) {
+    return parse_resp_request(cur, end, k_max_bulk_len, nullptr) != 0;
+  }
+  uint32_t len = 0;
+  if (end - cur < 4) {
+    return false;
+  }
+  memcpy(&len, cur, 4);
+  return (size_t)(end - cur - 4) >= len;
+}
+
+void Connection::process_input(const uint8_t *begin, const uint8_t *end) {
+  const uint8_t *cur = begin;
+  if (closing_) {
+    return; // whatever follows a protocol error is dropped
+  }
+  uint64_t soft_limit = GlobalState::config().client_output_soft_limit;
+  int budget = GlobalState::k_max_cmds_per_tick;
+  while (!blocked_) {
+    if (soft_limit > 0 && output_size() >= soft_limit) {
+      // leave the rest unread until the client takes its replies
+      paused_ = true;
+      npaused_++;
+      break;
     }
-    if (outgoing_.size() > 0) {
-      state_ = ConnectionState::STATE_RES;
-      return handle_write();
+    if (budget == 0) {
+      if (has_request(cur, end) && pending_node.is_empty()) {
+        GlobalState::pending_dlist_header()->insert_before(&pending_node);
+      }
+      break;
+    }
+    if (!try_one_request(cur, end)) {
+      break;
     }
+    budget--;
+  }
+  // keep what is left for later
+  if (!incoming_.empty()) {
+    incoming_.erase(incoming_.begin(), incoming_.begin() + (cur - begin));
+  } else if (cur < end) {
+    buffer_attach(incoming_);
+    incoming_.assign(cur, end);
+  }
+  if (incoming_.empty()) {
+    buffer_release(incoming_);
+  }
+  // the reply is written by the event loop once the AOF is flushed
+  if (outgoing_.size() > 0 && state_ != ConnectionState::STATE_END) {
+    state_ = ConnectionState::STATE_RES;
   }
 }
 
-void Connection::handle_write() {
-  ssize_t rv = write(fd_, outgoing_.data(), outgoing_.size());
-  if (rv < 0) {
-    if (errno != EAGAIN) {
-      LOG(ERROR) << "write failed: " << strerror(errno) << "\n";
-      state_ = ConnectionState::STATE_END;
-    }
-    return;
+void Connection::resume_input() {
+  if (!paused_ && !blocked_ && !incoming_.empty() &&
+      state_ != ConnectionState::STATE_END) {
+    process_input(incoming_.data(), incoming_.data() + incoming_.size());
   }
-  outgoing_.erase(outgoing_.begin(), outgoing_.begin() + rv);
+}
+
+void Connection::block() {
+  blocked_ = true;
+  timeout_node.detach();
+}
 
-  if (outgoing_.size() == 0) {
-    state_ = ConnectionState::STATE_REQ;
+void Connection::set_subscribed(bool subscribed) {
+  if (subscribed == subscribed_) {
+    return;
+  }
+  subscribed_ = subscribed;
+  if (subscribed) {
+    timeout_node.detach();
+  } else {
+    update_timer(GlobalState::timeout_dlist_header());
   }
 }
 
-bool Connection::try_one_request() {
-  if (incoming_.size() < 4) {
-    return false; // need read more
+void Connection::unblock(void (*fn)(Response &out, void *arg), void *arg) {
+  blocked_ = false;
+  update_timer(GlobalState::timeout_dlist_header());
+  reply(fn, arg);
+  // the loop runs them on its next iteration, after this reply
+  const uint8_t *begin = incoming_.data();
+  if (has_request(begin, begin + incoming_.size()) &&
+      pending_node.is_empty()) {
+    GlobalState::pending_dlist_header()->insert_before(&pending_node);
   }
-  uint32_t len = 0;
-  memcpy(&len, incoming_.data(), 4);
-  if (len > k_max_msg) {
-    LOG(ERROR) << "message too long: " << len << "\n";
+}
+
+bool Connection::check_output_limit() {
+  const Config &config = GlobalState::config();
+  uint64_t hard_limit = is_replica_ ? config.replica_output_hard_limit
+                                    : config.client_output_hard_limit;
+  if (hard_limit > 0 && output_size() > hard_limit) {
+    LOG_RATELIMITED(WARNING, 10,
+                    "fd {} has {} bytes of output, over the hard limit, "
+                    "closing it",
+                    fd_, output_size());
     state_ = ConnectionState::STATE_END;
     return false;
   }
-  if (incoming_.size() < len + 4) {
-    return false;
+  return true;
+}
+
+void Connection::handle_write() {
+  if (shm_ ? !write_shm() : !write_socket()) {
+    return; // more to send
   }
-  incoming_.erase(incoming_.begin(), incoming_.begin() + 4);
-  std::vector<std::string> cmd;
-  if (parse_request(incoming_.data(), len, cmd) < 0) {
+  if (closing_) {
     state_ = ConnectionState::STATE_END;
-    return false;
+    return;
+  }
+  state_ = ConnectionState::STATE_REQ;
+  if (paused_) {
+    // run what was left unread; the replies go out on the next iteration,
+    // after the AOF flush
+    paused_ = false;
+    if (!incoming_.empty()) {
+      process_input(incoming_.data(), incoming_.data() + incoming_.size());
+    }
+  }
+}
+
+bool Connection::write_socket() {
+  if (outgoing_.size() > 0 || !spliced_.empty()) {
+    ssize_t rv = spliced_.empty()
+                     ? write(fd_, outgoing_.data(), outgoing_.size())
+                     : write_spliced();
+    if (rv < 0) {
+      if (errno != EAGAIN) {
+        LOG_RATELIMITED(ERROR, 10, "write failed: {}", strerror(errno));
+        state_ = ConnectionState::STATE_END;
+      }
+      return false;
+    }
+    consume_output(rv);
+    if (outgoing_.size() > 0 || !spliced_.empty()) {
+      return false;
+    }
+    buffer_release(outgoing_);
   }
-  Response resp(outgoing_);
-  do_request(std::move(cmd), resp);
-  resp.build();
 
-  incoming_.erase(incoming_.begin(), incoming_.begin() + len);
+  if (file_fd_ != -1) {
+    if (file_left_ > 0) {
+      ssize_t rv = sendfile(fd_, file_fd_, &file_off_, file_left_);
+      if (rv <= 0) {
+        if (rv == 0 || errno != EAGAIN) {
+          LOG(ERROR, "sendfile failed: {}", strerror(errno));
+          state_ = ConnectionState::STATE_END;
+        }
+        return false;
+      }
+      file_left_ -= rv;
+      if (file_left_ > 0) {
+        return false;
+      }
+    }
+    close(file_fd_);
+    file_fd_ = -1;
+    outgoing_.swap(held_);
+    buffer_release(held_);
+    if (outgoing_.size() > 0) {
+      return false;
+    }
+  }
   return true;
 }
 
+ssize_t Connection::write_spliced() {
+  struct iovec iov[k_max_iov];
+  int n = 0;
+  size_t pos = 0; // in `outgoing_`
+  size_t off = splice_off_;
+  size_t i = 0;
+  for (; i < spliced_.size() && n + 2 <= k_max_iov; i++) {
+    const Splice &s = spliced_[i];
+    if (s.at > pos) {
+      iov[n++] = {outgoing_.data() + pos, s.at - pos};
+      pos = s.at;
+    }
+    iov[n++] = {(void *)(s.buf->data() + off), s.buf->size() - off};
+    off = 0;
+  }
+  if (i == spliced_.size() && pos < outgoing_.size() && n < k_max_iov) {
+    iov[n++] = {outgoing_.data() + pos, outgoing_.size() - pos};
+  }
+  return writev(fd_, iov, n);
+}
+
+void Connection::consume_output(size_t n) {
+  size_t owned = 0; // bytes of `outgoing_` among the `n`
+  while (n > 0) {
+    if (!spliced_.empty() && spliced_.front().at == owned) {
+      const SharedBuffer &buf = spliced_.front().buf;
+      size_t take = std::min(n, buf->size() - splice_off_);
+      splice_off_ += take;
+      spliced_bytes_ -= take;
+      n -= take;
+      if (splice_off_ == buf->size()) {
+        spliced_.pop_front();
+        splice_off_ = 0;
+      }
+      continue;
+    }
+    size_t limit = spliced_.empty() ? outgoing_.size() : spliced_.front().at;
+    assert(limit > owned);
+    size_t take = std::min(n, limit - owned);
+    owned += take;
+    n -= take;
+  }
+  outgoing_.erase(outgoing_.begin(), outgoing_.begin() + owned);
+  for (Splice &s : spliced_) {
+    s.at -= owned;
+  }
+}
+
+bool Connection::write_shm() {
+  ShmRing &ring = shm_->replies();
+  while (!outgoing_.empty()) {
+    size_t n = ring.write(outgoing_.data(), outgoing_.size());
+    if (n > 0) {
+      ring.notify_consumer(shm_->client_efd());
+      outgoing_.erase(outgoing_.begin(), outgoing_.begin() + n);
+    } else if (ring.arm_producer()) {
+      return false; // the client wakes us once it has made room
+    }
+  }
+  buffer_release(outgoing_);
+  return true;
+}
+
+void Connection::append_output(const uint8_t *data, size_t len) {
+  std::vector<uint8_t> &out = file_fd_ != -1 ? held_ : outgoing_;
+  buffer_attach(out);
+  out.insert(out.end(), data, data + len);
+  if (state_ != ConnectionState::STATE_END && check_output_limit()) {
+    state_ = ConnectionState::STATE_RES;
+  }
+}
+
+void Connection::append_shared(const SharedBuffer &buf) {
+  if (shm_ || file_fd_ != -1) {
+    // the shm ring and a file being streamed take copies
+    return append_output(buf->data(), buf->size());
+  }
+  spliced_.push_back(Splice{outgoing_.size(), buf});
+  spliced_bytes_ += buf->size();
+  if (state_ != ConnectionState::STATE_END && check_output_limit()) {
+    state_ = ConnectionState::STATE_RES;
+  }
+}
+
+void Connection::reply(void (*fn)(Response &out, void *arg), void *arg) {
+  buffer_attach(outgoing_);
+  Response resp(outgoing_, proto_);
+  fn(resp, arg);
+  resp.build();
+  if (state_ != ConnectionState::STATE_END && check_output_limit()) {
+    state_ = ConnectionState::STATE_RES;
+  }
+}
+
+void Connection::send_file(int file_fd, uint64_t len) {
+  assert(file_fd_ == -1);
+  file_fd_ = file_fd;
+  file_off_ = 0;
+  file_left_ = len;
+  if (state_ != ConnectionState::STATE_END) {
+    state_ = ConnectionState::STATE_RES;
+  }
+}
+
+bool Connection::try_one_request(const uint8_t *&cur, const uint8_t *end) {
+  if (!proto_detected_) {
+    int resp = detect_resp(cur, end - cur);
+    if (resp < 0) {
+      return false; // need read more
+    }
+    proto_ = resp ? Protocol::RESP2 : Protocol::NATIVE;
+    proto_detected_ = true;
+  }
+  std::vector<std::string> cmd;
+  size_t used = 0;
+  if (proto_ == Protocol::NATIVE) {
+    if (end - cur < 4) {
+      return false; // need read more
+    }
+    uint32_t len = 0;
+    memcpy(&len, cur, 4);
+    if (len > k_max_msg) {
+      LOG_RATELIMITED(ERROR, 10, "message too long: {}", len);
+      state_ = ConnectionState::STATE_END;
+      return false;
+    }
+    if ((size_t)(end - cur - 4) < len) {
+      return false;
+    }
+    if (parse_request(cur + 4, len, cmd) < 0) {
+      state_ = ConnectionState::STATE_END;
+      return false;
+    }
+    used = 4 + len;
+  } else {
+    ssize_t rv = parse_resp_request(cur, end, k_max_bulk_len, &cmd);
+    if (rv == 0) {
+      return false;
+    }
+    if (rv < 0) {
+      // like Redis: say why, then hang up
+      LOG_RATELIMITED(ERROR, 10, "bad RESP request");
+      buffer_attach(outgoing_);
+      Response resp(outgoing_, proto_);
+      resp.out_err(ERR_BAD_ARG, "Protocol error");
+      resp.build();
+      closing_ = true;
+      return false;
+    }
+    used = rv;
+    if (cmd.empty()) {
+      cur += used; // a blank line or an empty array
+      return true;
+    }
+  }
+
+  const Command *command = cmd.empty() ? nullptr : lookup_command(cmd[0]);
+  // the commands without a handler are this connection's business
+  const char *own = command && !command->handler &&
+                            command->check_arity(cmd.size())
+                        ? command->name
+                        : "";
+  if (is_replica_) {
+    GlobalState::replication().replica_request(this, cmd);
+  } else if (proto_ == Protocol::NATIVE && strcmp(own, "psync") == 0) {
+    GlobalState::replication().psync(this, cmd);
+  } else if (proto_ == Protocol::NATIVE && strcmp(own, "shmattach") == 0) {
+    attach_shm(cur + used == end);
+  } else if (PubSub::is_command(own)) {
+    GlobalState::pubsub().command(this, own, cmd);
+  } else {
+    buffer_attach(outgoing_);
+    size_t mark = outgoing_.size();
+    Response resp(outgoing_, proto_);
+    if (proto_ != Protocol::NATIVE && strcmp(own, "hello") == 0) {
+      hello(cmd, resp);
+    } else if (command && (command->flags & CMD_WRITE) &&
+               GlobalState::replication().is_replica()) {
+      resp.out_err(ERR_READONLY, "can't write against a read only replica");
+    } else if (subscribed_ && proto_ != Protocol::RESP3 &&
+               !(command && strcmp(command->name, "ping") == 0)) {
+      // its replies could not be told apart from the messages
+      resp.out_err(ERR_BAD_ARG, "only (P)SUBSCRIBE / (P)UNSUBSCRIBE / PING "
+                                "are allowed in this context");
+    } else if (strcmp(own, "blpop") == 0 || strcmp(own, "brpop") == 0) {
+      GlobalState::blocking().pop(this, own[1] == 'l', cmd, resp);
+    } else {
+      run_command(command, std::move(cmd), resp);
+    }
+    if (blocked_) {
+      // the reply is written when the wait ends
+      outgoing_.resize(mark);
+      if (outgoing_.empty()) {
+        buffer_release(outgoing_);
+      }
+    } else {
+      resp.build();
+    }
+  }
+  ncmds_++;
+
+  cur += used;
+  return check_output_limit();
+}
+
+// `hello [2|3]` picks the RESP version of the replies
+void Connection::hello(const std::vector<std::string> &cmd, Response &out) {
+  if (cmd.size() > 1) {
+    if (cmd[1] == "2") {
+      proto_ = Protocol::RESP2;
+    } else if (cmd[1] == "3") {
+      proto_ = Protocol::RESP3;
+    } else {
+      return out.out_err(ERR_BAD_ARG, "unsupported protocol version");
+    }
+    // the reply is already in the new version
+    out.set_protocol(proto_);
+  }
+  out.out_map(2);
+  out.out_str("server");
+  out.out_str("simple-redis");
+  out.out_str("proto");
+  out.out_int(proto_ == Protocol::RESP3 ? 3 : 2);
+}
+
+void Connection::attach_shm(bool alone) {
+  struct sockaddr_storage ss = {};
+  socklen_t socklen = sizeof(ss);
+  const char *err = NULL;
+  if (shm_ || is_replica_ ||
+      getsockname(fd_, (struct sockaddr *)&ss, &socklen) < 0 ||
+      ss.ss_family != AF_UNIX) {
+    err = "shmattach needs a unix socket connection";
+  } else if (!alone || output_size() > 0 || file_fd_ != -1) {
+    err = "shmattach must be the only request in flight";
+  }
+  std::unique_ptr<ShmRegion> region;
+  if (err == NULL) {
+    region = ShmRegion::create(GlobalState::config().shm_ring_size);
+    if (!region) {
+      LOG(ERROR, "creating the shm region failed: {}", strerror(errno));
+      err = "can't create the shared memory";
+    }
+  }
+  if (err != NULL) {
+    buffer_attach(outgoing_);
+    Response resp(outgoing_);
+    resp.out_err(ERR_BAD_ARG, err);
+    resp.build();
+    return;
+  }
+
+  // the reply carries the descriptors, so it skips `outgoing_`
+  std::vector<uint8_t> reply;
+  Response resp(reply);
+  resp.out_int(GlobalState::config().shm_ring_size);
+  resp.build();
+  if (!shm_send_fds(fd_, *region, reply.data(), reply.size())) {
+    LOG_RATELIMITED(ERROR, 10, "sending the shm region failed: {}",
+                    strerror(errno));
+    state_ = ConnectionState::STATE_END;
+    return;
+  }
+  shm_ = std::move(region);
+  GlobalState::shm_dlist_header()->insert_before(&shm_node);
+}
+
+int Connection::shm_wait_fd() const { return shm_->server_efd(); }
+
+void Connection::handle_shm() {
+  ShmRegion::drain_efd(shm_->server_efd());
+  if (paused_ || blocked_ || !pending_node.is_empty() ||
+      state_ == ConnectionState::STATE_END) {
+    return; // requests already waiting, leave the rest in the ring
+  }
+  ShmRing &ring = shm_->requests();
+  size_t n = ring.read(t_read_buf, sizeof(t_read_buf));
+  if (n == 0) {
+    return;
+  }
+  ring.notify_producer(shm_->client_efd());
+  update_timer(GlobalState::timeout_dlist_header());
+  consume_input(t_read_buf, n);
+}
+
+bool Connection::shm_arm() {
+  bool idle = true;
+  if (!paused_ && !blocked_ && pending_node.is_empty()) {
+    idle = shm_->requests().arm_consumer();
+  }
+  if (idle && !outgoing_.empty()) {
+    idle = shm_->replies().arm_producer();
+  }
+  return idle;
+}
+
+void Connection::shm_disarm() {
+  shm_->requests().disarm_consumer();
+  shm_->replies().disarm_producer();
+}
+
+void Connection::describe(std::string &out) const {
+  struct sockaddr_storage ss = {};
+  socklen_t socklen = sizeof(ss);
+  char addr[INET_ADDRSTRLEN + 8] = "?";
+  if (getpeername(fd_, (struct sockaddr *)&ss, &socklen) == 0) {
+    if (ss.ss_family == AF_INET) {
+      struct sockaddr_in *in = (struct sockaddr_in *)&ss;
+      char ip[INET_ADDRSTRLEN] = "";
+      inet_ntop(AF_INET, &in->sin_addr, ip, sizeof(ip));
+      snprintf(addr, sizeof(addr), "%s:%u", ip, (unsigned)ntohs(in->sin_port));
+    } else if (ss.ss_family == AF_UNIX) {
+      snprintf(addr, sizeof(addr), "unix");
+    }
+  }
+  uint64_t now_ms = get_monotonic_msec();
+  // N: normal client, S: replica, P: reading paused by the output limit,
+  // b: blocked in BLPOP/BRPOP, s: subscribed, M: shared-memory transport
+  std::string flags = is_replica_ ? "S" : "N";
+  if (paused_) {
+    flags += "P";
+  }
+  if (subscribed_) {
+    flags += "s";
+  }
+  if (blocked_) {
+    flags += "b";
+  }
+  if (shm_) {
+    flags += "M";
+  }
+  const char *proto = !proto_detected_               ? "?"
+                      : proto_ == Protocol::NATIVE ? "native"
+                      : proto_ == Protocol::RESP2  ? "resp2"
+                                                   : "resp3";
+  char buf[256];
+  snprintf(buf, sizeof(buf),
+           "fd=%d addr=%s age=%llu idle=%llu flags=%s proto=%s qbuf=%zu "
+           "obuf=%zu file=%llu paused=%u cmds=%llu\n",
+           fd_, addr,
+           (unsigned long long)(now_ms - created_ms_) / 1000,
+           (unsigned long long)(uint32_t(now_ms) - last_active_ms_) / 1000,
+           flags.c_str(), proto, incoming_.size(), output_size(),
+           (unsigned long long)file_left_, npaused_,
+           (unsigned long long)ncmds_);
+  out += buf;
+}
+
 void Connection::conn_put(std::vector<Connection *> &fd2conn,
                           Connection *conn) {
   if (fd2conn.size() <= conn->fd_) {
@@ -88,5 +627,7 @@ void Connection::conn_put(std::vector<Connection *> &fd2conn,
 void Connection::update_timer(DList *timeout_node_header) {
   last_active_ms_ = get_monotonic_msec();
   timeout_node.detach();
-  timeout_node_header->insert_before(&timeout_node);
+  if (!blocked_ && !subscribed_) {
+    timeout_node_header->insert_before(&timeout_node);
+  }
 }
\ No newline at end of file
@@ -1,6 +1,5 @@
 #pragma once
 
-#include <_types/_uint32_t.h>
 #include <arpa/inet.h>
 #include <cassert>
 #include <cstdint>
@@ -11,12 +10,18 @@
 #include <unistd.h>
 
 #include <cstring>
+#include <deque>
 #include <memory>
+#include <string>
 #include <vector>
 
-#include "aixlog.hpp"
+#include "protocol.hpp"
+#include "shm.hpp"
 #include "utils.hpp"
 
+// a reply queued on many connections at once, like a pub/sub message
+using SharedBuffer = std::shared_ptr<const std::vector<uint8_t>>;
+
 enum class ConnectionState {
   STATE_REQ = 0,
   STATE_RES = 1,
@@ -26,39 +31,135 @@ enum class ConnectionState {
 class Connection {
 public:
   Connection(int fd, DList *timeout_node_header)
-      : fd_(fd), last_active_ms_(get_monotonic_msec()) {
+      : fd_(fd), last_active_ms_(get_monotonic_msec()),
+        created_ms_(get_monotonic_msec()) {
     timeout_node_header->insert_before(&timeout_node);
   }
-  ~Connection() {
-    if (fd_ != -1) {
-      close(fd_);
-    }
-    timeout_node.detach();
-  }
+  ~Connection();
   // getters
   int fd() const { return fd_; }
   ConnectionState state() const { return state_; }
 
   void handle_read();
   void handle_write();
-  bool try_one_request();
+  // queue raw bytes after whatever is already pending
+  void append_output(const uint8_t *data, size_t len);
+  // queue `buf` without copying it; it is written straight from the buffer
+  // the other connections share
+  void append_shared(const SharedBuffer &buf);
+  // queue the one reply that `fn` writes
+  void reply(void (*fn)(Response &out, void *arg), void *arg);
+  Protocol protocol() const { return proto_; }
+  // queue `len` bytes of `file_fd` (taking ownership of it); anything
+  // appended later is held back until the file has been sent
+  void send_file(int file_fd, uint64_t len);
+  // the loop closes the connection before its next poll
+  void shutdown() { state_ = ConnectionState::STATE_END; }
+  // a replica that attached with PSYNC: what it sends is not replied to
+  void set_replica() { is_replica_ = true; }
+  // handle the request at `cur` if it is complete, advancing `cur` past it
+  bool try_one_request(const uint8_t *&cur, const uint8_t *end);
+  bool has_request(const uint8_t *cur, const uint8_t *end) const;
+  // one `client list` line
+  void describe(std::string &out) const;
   void update_timer(DList *timeout_node_header);
+  // run requests left over when the connection used up its budget
+  void resume_input();
+  // BLPOP/BRPOP found nothing to pop: run no more requests, and leave the
+  // idle timeout to the wait's own (see blocking.hpp)
+  void block();
+  // the wait is over: queue the reply that `fn` writes, then carry on with
+  // the requests sent meanwhile
+  void unblock(void (*fn)(Response &out, void *arg), void *arg);
+  // subscribed to a channel or a pattern (see pubsub.hpp): a subscriber may
+  // hear nothing for long, so it is exempt from the idle timeout meanwhile
+  void set_subscribed(bool subscribed);
+
+  // shared-memory transport, see shm.hpp
+  bool has_shm() const { return shm_ != nullptr; }
+  int shm_wait_fd() const;
+  // take whatever the client put in the request ring
+  void handle_shm();
+  // before the loop sleeps: ask to be woken through `shm_wait_fd()`, or
+  // return false if there is work right away
+  bool shm_arm();
+  void shm_disarm();
   static void conn_put(std::vector<Connection *> &fd2conn, Connection *conn);
   uint32_t get_last_activate_ms() { return last_active_ms_; }
   static Connection *container_of_timeout_node(DList *node) {
     return container_of(node, Connection, timeout_node);
   }
+  static Connection *container_of_pending_node(DList *node) {
+    return container_of(node, Connection, pending_node);
+  }
+  static Connection *container_of_shm_node(DList *node) {
+    return container_of(node, Connection, shm_node);
+  }
 
 private:
   DList timeout_node;
+  DList pending_node; // linked while on the pending list
+  DList shm_node;     // linked while on the shm transport
   int fd_ = -1;
-  uint8_t rbuf_[4096];
-  uint8_t wbuf_[4096];
   uint32_t last_active_ms_;
   ConnectionState state_ = ConnectionState::STATE_REQ;
 
-  // buffered input and output
+  bool is_replica_ = false;
+  // reading is paused until the output drains below the soft limit
+  bool paused_ = false;
+  uint32_t npaused_ = 0;
+  // in BLPOP/BRPOP, waiting for an element
+  bool blocked_ = false;
+  // only pub/sub commands are allowed, except in RESP3
+  bool subscribed_ = false;
+  uint64_t created_ms_;
+  uint64_t ncmds_ = 0;
+  // the framing, told apart by the first bytes the client sends
+  Protocol proto_ = Protocol::NATIVE;
+  bool proto_detected_ = false;
+  // close once the replies so far (ending in an error) are sent
+  bool closing_ = false;
+
+  // buffered input and output. Requests are parsed straight out of a shared
+  // read buffer, so `incoming_` only holds an incomplete one. Both take a
+  // buffer from a pool when they get data and give it back once drained.
   std::vector<uint8_t> incoming_;
   std::vector<uint8_t> outgoing_;
-  const size_t k_max_msg = 1024;
+  static const size_t k_max_msg = 1024;
+  // one argument of a RESP request, as Redis's proto-max-bulk-len
+  static const size_t k_max_bulk_len = 512 * 1024 * 1024;
+
+  // shared buffers, each sent just before `outgoing_[at]`, in order
+  struct Splice {
+    size_t at;
+    SharedBuffer buf;
+  };
+  std::deque<Splice> spliced_;
+  size_t splice_off_ = 0;    // how much of the first one is sent
+  size_t spliced_bytes_ = 0; // how much of them all is left
+  static const int k_max_iov = 64;
+
+  // a file being streamed after `outgoing_`, and what comes after it
+  int file_fd_ = -1;
+  off_t file_off_ = 0;
+  uint64_t file_left_ = 0;
+  std::vector<uint8_t> held_;
+
+  std::unique_ptr<ShmRegion> shm_;
+
+  size_t output_size() const {
+    return outgoing_.size() + held_.size() + spliced_bytes_;
+  }
+  void consume_input(const uint8_t *data, size_t len);
+  void process_input(const uint8_t *begin, const uint8_t *end);
+  // both return true once everything queued has been handed over
+  bool write_socket();
+  // writev() of `outgoing_` with the shared buffers in place
+  ssize_t write_spliced();
+  // drop the first `n` bytes of output sent, shared buffers included
+  void consume_output(size_t n);
+  bool write_shm();
+  void attach_shm(bool alone);
+  void hello(const std::vector<std::string> &cmd, Response &out);
+  bool check_output_limit();
 };
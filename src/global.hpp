@@ -1,22 +1,45 @@
 #pragma once
 
+#include "aof.hpp"
+#include "blocking.hpp"
+#include "config.hpp"
 #include "connection.hpp"
-#include "hashtable.hpp"
-#include "heap.hpp"
+#include "keystore.hpp"
+#include "pubsub.hpp"
+#include "replication.hpp"
+#include "snapshot.hpp"
 #include "utils.hpp"
-#include <_types/_uint32_t.h>
-#include <sys/_types/_size_t.h>
+#include <cstdint>
+#include <cstddef>
 
 class GlobalState {
 public:
   static const uint64_t k_idle_timeout_ms = 5 * 1000;
-  static const size_t k_max_works = 2000;
-  static HashMap &db() { return instance().db_; }
+  // connections accepted per loop iteration
+  static const int k_max_accepts = 1000;
+  // commands one connection runs per loop iteration; the rest wait on the
+  // pending list so a deep pipeline cannot hold up everyone else
+  static const int k_max_cmds_per_tick = 128;
+  static KeyStore &store() { return instance().store_; }
   static std::vector<std::unique_ptr<Connection>> &fd2conn() {
     return instance().fd2conn_;
   }
   static DList *timeout_dlist_header() { return &instance().idle_list_; }
-  static Heap &ttl_heap() { return instance().ttl_heap_; }
+  // connections with complete requests left over, in round-robin order
+  static DList *pending_dlist_header() { return &instance().pending_list_; }
+  // connections on the shared-memory transport
+  static DList *shm_dlist_header() { return &instance().shm_list_; }
+  static Config &config() { return instance().config_; }
+  static AppendOnlyFile &aof() { return instance().aof_; }
+  static Snapshot &snapshot() { return instance().snapshot_; }
+  static Replication &replication() { return instance().replication_; }
+  // clients in BLPOP/BRPOP
+  static Blocking &blocking() { return instance().blocking_; }
+  static PubSub &pubsub() { return instance().pubsub_; }
+  // AOF rewrites and background saves share one child slot
+  static bool child_running() {
+    return aof().rewriting() || snapshot().saving();
+  }
 
 public:
   GlobalState(const GlobalState &) = delete;
@@ -25,13 +48,20 @@ public:
   GlobalState &operator=(GlobalState &&) = delete;
 
 private:
-  HashMap db_;
+  KeyStore store_;
   std::vector<std::unique_ptr<Connection>> fd2conn_;
   DList idle_list_;
-  Heap ttl_heap_;
+  DList pending_list_;
+  DList shm_list_;
+  Config config_;
+  AppendOnlyFile aof_;
+  Snapshot snapshot_;
+  Replication replication_;
+  Blocking blocking_;
+  PubSub pubsub_;
 
 private:
-  GlobalState() : db_(HashMap(1024)) {
+  GlobalState() {
     idle_list_.prev = &idle_list_;
     idle_list_.next = &idle_list_;
   }
@@ -41,22 +71,3 @@ private:
     return gs;
   }
 };
-
-class Entry {
-public:
-  struct HashNode node; // Hashtable node
-  size_t heap_idx = -1; // ttl heap index
-
-  std::string key;
-  std::string value;
-
-  void set_ttl(uint32_t ttl_ms) {
-    if (ttl_ms < 0 && heap_idx != (size_t)-1) {
-      GlobalState::ttl_heap().remove(this->heap_idx);
-      this->heap_idx = -1;
-    } else if (ttl_ms >= 0) {
-      uint64_t expire_at = ttl_ms + get_monotonic_msec();
-      GlobalState::ttl_heap().insert(HeapItem{expire_at, &this->heap_idx});
-    }
-  }
-};
\ No newline at end of file
@@ -0,0 +1,208 @@
+#include "hash_type.hpp"
+#include "listpack.hpp"
+#include "utils.hpp"
+#include <vector>
+
+static bool field_eq(HashNode *a, HashNode *b) {
+  return container_of(a, HashField, node)->field ==
+         container_of(b, HashField, node)->field;
+}
+
+HashDict::~HashDict() {
+  std::vector<HashField *> fields;
+  fields.reserve(size());
+  foreach (
+      [](HashField *f, void *arg) {
+        ((std::vector<HashField *> *)arg)->push_back(f);
+        return true;
+      },
+      &fields);
+  for (HashField *f : fields) {
+    delete f;
+  }
+}
+
+HashField *HashDict::find(const std::string &field) {
+  HashField key;
+  key.field = field;
+  key.node.hcode = hash(field);
+  HashNode *node = map_.lookup(&key.node, field_eq);
+  return node ? container_of(node, HashField, node) : nullptr;
+}
+
+bool HashDict::set(const std::string &field, std::string value) {
+  if (HashField *f = find(field)) {
+    f->value = std::move(value);
+    return false;
+  }
+  HashField *f = new HashField;
+  f->field = field;
+  f->value = std::move(value);
+  f->node.hcode = hash(field);
+  map_.insert(&f->node);
+  return true;
+}
+
+bool HashDict::del(const std::string &field) {
+  HashField key;
+  key.field = field;
+  key.node.hcode = hash(field);
+  HashNode *node = map_.remove(&key.node, field_eq);
+  if (!node) {
+    return false;
+  }
+  delete container_of(node, HashField, node);
+  return true;
+}
+
+namespace {
+struct ForeachCtx {
+  bool (*fn)(HashField *f, void *arg);
+  void *arg;
+};
+} // namespace
+
+void HashDict::foreach (bool (*fn)(HashField *f, void *arg), void *arg) {
+  ForeachCtx ctx = {fn, arg};
+  auto callback = [](HashNode *node, void *arg) {
+    ForeachCtx &ctx = *(ForeachCtx *)arg;
+    return ctx.fn(container_of(node, HashField, node), ctx.arg);
+  };
+  map_.foreach (callback, &ctx);
+}
+
+static HashDict *dict_of(Entry *ent) { return (HashDict *)ent->obj.get(); }
+
+// move a packed hash to a HashDict
+static void unpack(Entry *ent) {
+  HashDict *dict = new HashDict;
+  const std::string &lp = ent->value;
+  for (size_t pos = 0; pos < lp.size();) {
+    StrView field = lp_get(lp, pos, &pos);
+    StrView value = lp_get(lp, pos, &pos);
+    dict->set(field.str(), value.str());
+  }
+  ent->obj.reset(dict);
+  std::string().swap(ent->value);
+}
+
+bool hash_get(Entry *ent, const std::string &field, std::string &out) {
+  if (ent->obj) {
+    HashField *f = dict_of(ent)->find(field);
+    if (f) {
+      out = f->value;
+    }
+    return f != nullptr;
+  }
+  const std::string &lp = ent->value;
+  size_t pos = lp_find(lp, field.data(), field.size(), 2);
+  if (pos == lp.size()) {
+    return false;
+  }
+  out = lp_get(lp, lp_next(lp, pos)).str();
+  return true;
+}
+
+bool hash_set(Entry *ent, const std::string &field, const std::string &value,
+              const EncodingLimits &limits) {
+  if (!ent->obj) {
+    std::string &lp = ent->value;
+    size_t pos = lp_find(lp, field.data(), field.size(), 2);
+    bool fits = field.size() <= limits.hash_max_listpack_value &&
+                value.size() <= limits.hash_max_listpack_value;
+    if (pos != lp.size() && fits) {
+      lp_replace(lp, lp_next(lp, pos), value.data(), value.size());
+      return false;
+    }
+    if (pos == lp.size() && fits &&
+        lp_count(lp) / 2 < limits.hash_max_listpack_entries) {
+      lp_append(lp, field.data(), field.size());
+      lp_append(lp, value.data(), value.size());
+      return true;
+    }
+    unpack(ent);
+  }
+  return dict_of(ent)->set(field, value);
+}
+
+bool hash_del(Entry *ent, const std::string &field) {
+  if (ent->obj) {
+    return dict_of(ent)->del(field);
+  }
+  std::string &lp = ent->value;
+  size_t pos = lp_find(lp, field.data(), field.size(), 2);
+  if (pos == lp.size()) {
+    return false;
+  }
+  lp_erase(lp, pos, 2);
+  return true;
+}
+
+size_t hash_len(Entry *ent) {
+  if (ent->obj) {
+    return dict_of(ent)->size();
+  }
+  return lp_count(ent->value) / 2;
+}
+
+namespace {
+struct HashForeachCtx {
+  void (*fn)(StrView field, StrView value, void *arg);
+  void *arg;
+};
+} // namespace
+
+void hash_foreach(Entry *ent,
+                  void (*fn)(StrView field, StrView value, void *arg),
+                  void *arg) {
+  if (ent->obj) {
+    HashForeachCtx ctx = {fn, arg};
+    auto callback = [](HashField *f, void *arg) {
+      HashForeachCtx &ctx = *(HashForeachCtx *)arg;
+      ctx.fn(StrView{f->field.data(), f->field.size()},
+             StrView{f->value.data(), f->value.size()}, ctx.arg);
+      return true;
+    };
+    dict_of(ent)->foreach (callback, &ctx);
+    return;
+  }
+  const std::string &lp = ent->value;
+  for (size_t pos = 0; pos < lp.size();) {
+    StrView field = lp_get(lp, pos, &pos);
+    StrView value = lp_get(lp, pos, &pos);
+    fn(field, value, arg);
+  }
+}
+
+void hash_pack(Entry *ent, std::string &out) {
+  if (!ent->obj) {
+    out = ent->value;
+    return;
+  }
+  out.clear();
+  auto callback = [](StrView field, StrView value, void *arg) {
+    std::string &out = *(std::string *)arg;
+    lp_append(out, field.data, field.size);
+    lp_append(out, value.data, value.size);
+  };
+  hash_foreach(ent, callback, &out);
+}
+
+bool hash_restore(Entry *ent, const EncodingLimits &limits) {
+  const std::string &lp = ent->value;
+  if (!lp_valid(lp)) {
+    return false;
+  }
+  size_t n = 0;
+  bool fits = true;
+  for (size_t pos = 0; pos < lp.size(); n++) {
+    fits = fits && lp_get(lp, pos, &pos).size <= limits.hash_max_listpack_value;
+  }
+  if (n % 2 != 0) {
+    return false;
+  }
+  if (!fits || n / 2 > limits.hash_max_listpack_entries) {
+    unpack(ent);
+  }
+  return true;
+}
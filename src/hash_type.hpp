@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include "keystore.hpp"
+#include "strview.hpp"
+
+// Hash values. A small hash is packed in `Entry::value` as a listpack of
+// field, value, field, value...: one allocation, scanned linearly. Once it
+// passes the EncodingLimits it moves to a HashDict in `Entry::obj`, and
+// stays there.
+
+struct HashField {
+  HashNode node;
+  std::string field;
+  std::string value;
+};
+
+class HashDict : public Object {
+public:
+  ~HashDict() override;
+
+  HashField *find(const std::string &field);
+  // returns true if `field` is new
+  bool set(const std::string &field, std::string value);
+  bool del(const std::string &field);
+  size_t size() { return map_.size(); }
+  void foreach (bool (*fn)(HashField *f, void *arg), void *arg);
+
+private:
+  HashMap map_;
+};
+
+// the value of `field` of the hash in `ent`; false if there is none
+bool hash_get(Entry *ent, const std::string &field, std::string &out);
+// returns true if `field` is new
+bool hash_set(Entry *ent, const std::string &field, const std::string &value,
+              const EncodingLimits &limits);
+bool hash_del(Entry *ent, const std::string &field);
+size_t hash_len(Entry *ent);
+void hash_foreach(Entry *ent,
+                  void (*fn)(StrView field, StrView value, void *arg),
+                  void *arg);
+// the packed encoding of the hash, whichever encoding it is in
+void hash_pack(Entry *ent, std::string &out);
+// `ent->value` was packed by hash_pack() and read back: check it, and move
+// it to a HashDict if it is over the limits
+bool hash_restore(Entry *ent, const EncodingLimits &limits);
@@ -1,9 +1,10 @@
 #pragma once
 
+#include <cassert>
 #include <cstddef>
 #include <cstdint>
 #include <stdexcept>
-#include <sys/_types/_size_t.h>
+#include <utility>
 
 struct HashNode {
   HashNode *next = nullptr;
@@ -34,14 +35,41 @@ public:
       delete[] tab_;
     }
   }
+  HashTable(const HashTable &) = delete;
+  HashTable &operator=(const HashTable &) = delete;
+  HashTable(HashTable &&other) noexcept
+      : tab_(other.tab_), mask_(other.mask_), size_(other.size_) {
+    other.tab_ = nullptr;
+    other.mask_ = 0;
+    other.size_ = 0;
+  }
+  HashTable &operator=(HashTable &&other) noexcept {
+    if (this != &other) {
+      delete[] tab_;
+      tab_ = other.tab_;
+      mask_ = other.mask_;
+      size_ = other.size_;
+      other.tab_ = nullptr;
+      other.mask_ = 0;
+      other.size_ = 0;
+    }
+    return *this;
+  }
 
   void insert(HashNode *node) {
+    link(node);
+    size_++;
+  }
+
+  // Put `node` into its bucket without counting it. The parallel snapshot
+  // loader fills disjoint bucket ranges from several threads this way and
+  // sets the size once they are all done.
+  void link(HashNode *node) {
     size_t pos = node->hcode & mask_;
-    HashNode *next = tab_[pos];
-    node->next = next;
+    node->next = tab_[pos];
     tab_[pos] = node;
-    size_++;
   }
+  void set_size(size_t n) { size_ = n; }
 
   HashNode **lookup(HashNode *key, bool (*eq)(HashNode *, HashNode *)) {
     if (empty()) {
@@ -94,6 +122,15 @@ private:
 public:
   HashMap() : newer_(16) {}
   HashMap(size_t n) : newer_(n) {}
+
+  // Replace the table of an empty map with a prebuilt one, e.g. one presized
+  // and filled by the snapshot loader, so no rehash happens while loading.
+  void install(HashTable &&table) {
+    assert(size() == 0);
+    older_ = HashTable();
+    newer_ = std::move(table);
+    migrate_pos_ = 0;
+  }
   HashNode *lookup(HashNode *key, bool (*eq)(HashNode *, HashNode *)) {
     migrate();
     HashNode **from = newer_.lookup(key, eq);
@@ -115,7 +152,7 @@ public:
 
   void insert(HashNode *node) {
     newer_.insert(node);
-    if (!older_.empty()) {
+    if (older_.empty()) {
       size_t shreshold = newer_.mask_size() * k_max_load_factor;
       if (newer_.size() > shreshold) {
         rehash();
@@ -124,9 +161,16 @@ public:
     migrate();
   }
 
+  // forget every node; the caller owns (and frees) them
+  void clear() {
+    newer_ = HashTable(16);
+    older_ = HashTable();
+    migrate_pos_ = 0;
+  }
+
   void rehash() {
-    older_ = newer_;
-    newer_ = HashTable(newer_.mask_size() * 2);
+    older_ = std::move(newer_);
+    newer_ = HashTable(older_.mask_size() * 2);
     migrate_pos_ = 0;
   }
 
@@ -151,5 +195,53 @@ public:
     newer_.foreach (fn, arg) && older_.foreach (fn, arg);
   }
 
+  // One step of a full pass: call `fn` on the nodes in the buckets at
+  // `cursor` and return the cursor of the next step, 0 once the pass is
+  // over. The cursor counts with its bits reversed, so a node that stays in
+  // the map for the whole pass is visited at least once even if the table
+  // grows in between (it may be visited twice).
+  size_t scan(size_t cursor, void (*fn)(HashNode *node, void *arg),
+              void *arg) {
+    if (older_.empty()) {
+      size_t mask = newer_.mask_size() - 1;
+      visit_bucket(newer_, cursor & mask, fn, arg);
+      return next_cursor(cursor, mask);
+    }
+    // older_ is the smaller table: its bucket, then every bucket of newer_
+    // that it splits into
+    size_t small = older_.mask_size() - 1;
+    size_t big = newer_.mask_size() - 1;
+    visit_bucket(older_, cursor & small, fn, arg);
+    do {
+      visit_bucket(newer_, cursor & big, fn, arg);
+      cursor = next_cursor(cursor, big);
+    } while (cursor & (small ^ big));
+    return cursor;
+  }
+
   size_t size() { return newer_.size() + older_.size(); }
+
+private:
+  static void visit_bucket(HashTable &table, size_t pos,
+                           void (*fn)(HashNode *node, void *arg), void *arg) {
+    for (HashNode *node = *table.head(pos); node != nullptr;
+         node = node->next) {
+      fn(node, arg);
+    }
+  }
+  static size_t reverse_bits(size_t v) {
+    size_t r = 0;
+    for (size_t i = 0; i < sizeof(v) * 8; i++) {
+      r = (r << 1) | (v & 1);
+      v >>= 1;
+    }
+    return r;
+  }
+  // increment the bits of `cursor` under `mask`, from the top one down
+  static size_t next_cursor(size_t cursor, size_t mask) {
+    cursor |= ~mask;
+    cursor = reverse_bits(cursor);
+    cursor++;
+    return reverse_bits(cursor);
+  }
 };
\ No newline at end of file
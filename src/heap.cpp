@@ -1,5 +1,5 @@
 #include "heap.hpp"
-#include <sys/_types/_size_t.h>
+#include <cstddef>
 
 static inline size_t parent(size_t i) { return (i + 1) / 2 - 1; }
 static size_t left(size_t i) { return i * 2 + 1; }
@@ -2,7 +2,6 @@
 
 #include <cstddef>
 #include <cstdint>
-#include <sys/_types/_size_t.h>
 #include <vector>
 
 struct HeapItem {
@@ -17,6 +16,7 @@ public:
   void insert(HeapItem t);
   bool is_empty() { return heap.empty(); }
   HeapItem &top() { return heap[0]; }
+  HeapItem &at(size_t pos) { return heap[pos]; }
 
 private:
   std::vector<HeapItem> heap;
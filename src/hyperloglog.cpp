@@ -0,0 +1,285 @@
+#include "hyperloglog.hpp"
+#include "utils.hpp"
+#include <cmath>
+#include <cstring>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static const char k_magic[4] = {'H', 'Y', 'L', 'L'};
+static const uint8_t k_dense = 0;
+static const uint8_t k_sparse = 1;
+// magic, encoding, 3 reserved, the cached count
+static const size_t k_header_size = 16;
+static const size_t k_encoding_off = 4;
+static const size_t k_count_off = 8;
+// set in the cached count when it is out of date
+static const uint64_t k_count_stale = (uint64_t)1 << 63;
+static const size_t k_dense_size = k_header_size + k_hll_registers * 6 / 8;
+static const size_t k_sparse_entry = 3;
+
+static uint8_t encoding(const std::string &value) {
+  return (uint8_t)value[k_encoding_off];
+}
+
+static void invalidate(std::string &value) {
+  uint64_t count = k_count_stale;
+  memcpy(&value[k_count_off], &count, 8);
+}
+
+bool hll_valid(const std::string &value) {
+  if (value.size() < k_header_size ||
+      memcmp(value.data(), k_magic, sizeof(k_magic)) != 0) {
+    return false;
+  }
+  if (encoding(value) == k_dense) {
+    return value.size() == k_dense_size;
+  }
+  return encoding(value) == k_sparse &&
+         (value.size() - k_header_size) % k_sparse_entry == 0;
+}
+
+void hll_init(std::string &value) {
+  value.assign(k_header_size, '\0');
+  memcpy(&value[0], k_magic, sizeof(k_magic));
+  value[k_encoding_off] = (char)k_sparse;
+}
+
+// Register `i` of a dense counter: bits 6i to 6i+5, low bits first. The
+// last register ends on a byte boundary, so `p[byte + 1]` is only touched
+// when some of the register is there.
+static uint8_t dense_get(const uint8_t *p, size_t i) {
+  size_t byte = i * 6 / 8;
+  unsigned shift = i * 6 % 8;
+  unsigned v = p[byte] >> shift;
+  if (shift > 2) {
+    v |= (unsigned)p[byte + 1] << (8 - shift);
+  }
+  return v & 63;
+}
+
+static void dense_set(uint8_t *p, size_t i, uint8_t v) {
+  size_t byte = i * 6 / 8;
+  unsigned shift = i * 6 % 8;
+  p[byte] = (uint8_t)((p[byte] & ~(63u << shift)) | (unsigned)v << shift);
+  if (shift > 2) {
+    p[byte + 1] = (uint8_t)((p[byte + 1] & ~(63u >> (8 - shift))) |
+                            (unsigned)v >> (8 - shift));
+  }
+}
+
+// a sparse entry: the register index and its value
+static void sparse_get(const char *p, size_t &index, uint8_t &v) {
+  uint32_t e = (uint8_t)p[0] | (uint32_t)(uint8_t)p[1] << 8 |
+               (uint32_t)(uint8_t)p[2] << 16;
+  index = (e >> 6) & (k_hll_registers - 1);
+  v = e & 63;
+}
+
+static void sparse_put(char *p, size_t index, uint8_t v) {
+  uint32_t e = (uint32_t)index << 6 | v;
+  p[0] = (char)e;
+  p[1] = (char)(e >> 8);
+  p[2] = (char)(e >> 16);
+}
+
+void hll_registers(const std::string &value, uint8_t *regs) {
+  if (encoding(value) == k_sparse) {
+    memset(regs, 0, k_hll_registers);
+    for (size_t off = k_header_size; off < value.size();
+         off += k_sparse_entry) {
+      size_t index = 0;
+      uint8_t v = 0;
+      sparse_get(&value[off], index, v);
+      regs[index] = v;
+    }
+    return;
+  }
+  // four registers in every three bytes
+  const uint8_t *p = (const uint8_t *)value.data() + k_header_size;
+  for (size_t i = 0; i < k_hll_registers; i += 4, p += 3) {
+    uint32_t w = p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16;
+    regs[i] = w & 63;
+    regs[i + 1] = (w >> 6) & 63;
+    regs[i + 2] = (w >> 12) & 63;
+    regs[i + 3] = (w >> 18) & 63;
+  }
+}
+
+void hll_store(std::string &value, const uint8_t *regs) {
+  hll_init(value);
+  value[k_encoding_off] = (char)k_dense;
+  value.resize(k_dense_size);
+  uint8_t *p = (uint8_t *)&value[k_header_size];
+  for (size_t i = 0; i < k_hll_registers; i += 4, p += 3) {
+    uint32_t w = regs[i] | (uint32_t)regs[i + 1] << 6 |
+                 (uint32_t)regs[i + 2] << 12 | (uint32_t)regs[i + 3] << 18;
+    p[0] = (uint8_t)w;
+    p[1] = (uint8_t)(w >> 8);
+    p[2] = (uint8_t)(w >> 16);
+  }
+  invalidate(value);
+}
+
+// Set the register at `index` to `rank` if that is higher; false if not.
+// Returns false too, with nothing changed, if the entry does not fit.
+static bool sparse_set(std::string &value, size_t index, uint8_t rank,
+                       size_t max_bytes, bool &fits) {
+  size_t lo = 0;
+  size_t hi = (value.size() - k_header_size) / k_sparse_entry;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    size_t i = 0;
+    uint8_t v = 0;
+    sparse_get(&value[k_header_size + mid * k_sparse_entry], i, v);
+    if (i == index) {
+      if (v >= rank) {
+        return false;
+      }
+      sparse_put(&value[k_header_size + mid * k_sparse_entry], index, rank);
+      return true;
+    }
+    if (i < index) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (value.size() + k_sparse_entry > k_header_size + max_bytes) {
+    fits = false;
+    return false;
+  }
+  size_t off = k_header_size + lo * k_sparse_entry;
+  value.insert(off, k_sparse_entry, '\0');
+  sparse_put(&value[off], index, rank);
+  return true;
+}
+
+bool hll_add(std::string &value, const char *data, size_t len,
+             const EncodingLimits &limits) {
+  uint64_t h = murmurhash64a(data, len, 0xadc83b19ULL);
+  size_t index = h & (k_hll_registers - 1);
+  // the position of the lowest set bit of the other 50; the sentinel bit
+  // caps it at 51
+  uint64_t rest = (h >> k_hll_p) | ((uint64_t)1 << (64 - k_hll_p));
+  uint8_t rank = (uint8_t)(__builtin_ctzll(rest) + 1);
+  bool changed = false;
+  if (encoding(value) == k_sparse) {
+    bool fits = true;
+    changed = sparse_set(value, index, rank, limits.hll_sparse_max_bytes,
+                         fits);
+    if (fits) {
+      if (changed) {
+        invalidate(value);
+      }
+      return changed;
+    }
+    uint8_t regs[k_hll_registers];
+    hll_registers(value, regs);
+    hll_store(value, regs);
+  }
+  uint8_t *p = (uint8_t *)&value[k_header_size];
+  if (dense_get(p, index) < rank) {
+    dense_set(p, index, rank);
+    invalidate(value);
+    changed = true;
+  }
+  return changed;
+}
+
+void hll_merge(uint8_t *acc, const uint8_t *regs) {
+  size_t i = 0;
+#if defined(__SSE2__)
+  for (; i < k_hll_registers; i += 16) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(acc + i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(regs + i));
+    _mm_storeu_si128((__m128i *)(acc + i), _mm_max_epu8(a, b));
+  }
+#endif
+  for (; i < k_hll_registers; i++) {
+    acc[i] = acc[i] > regs[i] ? acc[i] : regs[i];
+  }
+}
+
+// Ertl's correction for the empty registers, a fraction `x` of them
+static double hll_sigma(double x) {
+  if (x == 1.) {
+    return INFINITY;
+  }
+  double y = 1;
+  double z = x;
+  double prev = 0;
+  do {
+    x *= x;
+    prev = z;
+    z += x * y;
+    y += y;
+  } while (prev != z);
+  return z;
+}
+
+// The sum of 2^-r over the registers, and how many are 0. With SSE2 each
+// 2^-r is a float built from its exponent bits, (127 - r) << 23.
+static double harmonic_sum(const uint8_t *regs, size_t &zeros) {
+  size_t i = 0;
+  double sum = 0;
+  zeros = 0;
+#if defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i bias = _mm_set1_epi32(127);
+  __m128 acc[4] = {_mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps(),
+                   _mm_setzero_ps()};
+  for (; i < k_hll_registers; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(regs + i));
+    zeros += __builtin_popcount(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)));
+    __m128i halves[2] = {_mm_unpacklo_epi8(v, zero),
+                         _mm_unpackhi_epi8(v, zero)};
+    for (int h = 0; h < 2; h++) {
+      __m128i quads[2] = {_mm_unpacklo_epi16(halves[h], zero),
+                          _mm_unpackhi_epi16(halves[h], zero)};
+      for (int q = 0; q < 2; q++) {
+        __m128i bits = _mm_slli_epi32(_mm_sub_epi32(bias, quads[q]), 23);
+        acc[h * 2 + q] = _mm_add_ps(acc[h * 2 + q], _mm_castsi128_ps(bits));
+      }
+    }
+  }
+  float lanes[4];
+  for (int a = 0; a < 4; a++) {
+    _mm_storeu_ps(lanes, acc[a]);
+    sum += (double)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  }
+#endif
+  for (; i < k_hll_registers; i++) {
+    zeros += regs[i] == 0;
+    sum += std::ldexp(1.0, -regs[i]);
+  }
+  return sum;
+}
+
+// Ertl's estimator ("New cardinality estimation algorithms for
+// HyperLogLog sketches", 2017): the raw harmonic mean with the empty
+// registers weighed by sigma(), unbiased from 0 up without the bias tables
+// or the switch to linear counting of the original. (It also corrects for
+// registers at the maximum, 51, which a 64-bit hash all but never reaches.)
+uint64_t hll_estimate(const uint8_t *regs) {
+  const double m = k_hll_registers;
+  size_t zeros = 0;
+  double sum = harmonic_sum(regs, zeros);
+  double z = sum - zeros + m * hll_sigma(zeros / m);
+  const double alpha_inf = 0.5 / std::log(2.0);
+  return (uint64_t)std::llround(alpha_inf * m * m / z);
+}
+
+uint64_t hll_count(std::string &value) {
+  uint64_t count = 0;
+  memcpy(&count, &value[k_count_off], 8);
+  if ((count & k_count_stale) == 0) {
+    return count;
+  }
+  uint8_t regs[k_hll_registers];
+  hll_registers(value, regs);
+  count = hll_estimate(regs);
+  memcpy(&value[k_count_off], &count, 8);
+  return count;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "keystore.hpp"
+
+// HyperLogLog counters, kept in string values as Redis does, so they are
+// saved, rewritten and replicated like any other string. A value is a
+// 16-byte header ("HYLL", the encoding, the cached count) and then either
+//
+//   sparse: the non-zero registers in index order, 3 bytes each
+//           (index << 6 | value), while there are few of them;
+//   dense:  all 2^14 registers packed in 6 bits each, 12288 bytes.
+//
+// A sparse counter turns dense for good once it would take more than
+// `EncodingLimits::hll_sparse_max_bytes`. With 2^14 registers the standard
+// error is 1.04 / sqrt(2^14), about 0.81%.
+
+static const int k_hll_p = 14;
+static const size_t k_hll_registers = (size_t)1 << k_hll_p;
+
+// whether `value` holds a counter, checked well enough that using it is
+// memory safe whatever the bytes are
+bool hll_valid(const std::string &value);
+// a new counter, counting nothing
+void hll_init(std::string &value);
+// returns true if a register changed, i.e. the count may have
+bool hll_add(std::string &value, const char *data, size_t len,
+             const EncodingLimits &limits);
+// the estimate, cached in the header until the counter changes
+uint64_t hll_count(std::string &value);
+
+// the registers of a counter, one byte each
+void hll_registers(const std::string &value, uint8_t *regs);
+// a dense counter of `regs`
+void hll_store(std::string &value, const uint8_t *regs);
+// `acc[i] = max(acc[i], regs[i])` over all the registers
+void hll_merge(uint8_t *acc, const uint8_t *regs);
+// the cardinality estimate of a set of registers
+uint64_t hll_estimate(const uint8_t *regs);
@@ -0,0 +1,262 @@
+#include "keystore.hpp"
+#include "bloom_type.hpp"
+#include "hash_type.hpp"
+#include "list_type.hpp"
+#include "set_type.hpp"
+#include "utils.hpp"
+#include <cstdint>
+
+uint64_t hash(const std::string &value) {
+  uint32_t h = 0x811c9dc5;
+  for (char c : value) {
+    h = (h + c) * 0x01000193;
+  }
+  return h;
+}
+
+static bool entry_eq(HashNode *a, HashNode *b) {
+  struct Entry *ea = container_of(a, struct Entry, node);
+  struct Entry *eb = container_of(b, struct Entry, node);
+  return ea->key == eb->key;
+}
+
+Entry *KeyStore::find(const std::string &key) {
+  // a dummy `Entry` just for the lookup
+  Entry entry;
+  entry.key = key;
+  entry.node.hcode = hash(entry.key);
+  HashNode *node = db_.lookup(&entry.node, entry_eq);
+  return node ? container_of(node, Entry, node) : nullptr;
+}
+
+Entry *KeyStore::lookup(const std::string &key) {
+  Entry *ent = find(key);
+  // a replica leaves expiring keys to the DEL from its primary, so a key can
+  // still be here after its deadline
+  if (!ent || expired(ent, get_monotonic_msec())) {
+    return nullptr;
+  }
+  return ent;
+}
+
+const std::string *KeyStore::get(const std::string &key) {
+  Entry *ent = lookup(key);
+  if (!ent || ent->type != ValueType::STRING) {
+    return nullptr;
+  }
+  return &ent->value;
+}
+
+Entry *KeyStore::add(std::string key, ValueType type) {
+  del(key); // it may still be here, expired
+  Entry *ent = new Entry;
+  ent->key = std::move(key);
+  ent->node.hcode = hash(ent->key);
+  ent->type = type;
+  if (type == ValueType::LIST) {
+    list_init(ent, limits_);
+  }
+  db_.insert(&ent->node);
+  return ent;
+}
+
+void KeyStore::set(std::string key, std::string value) {
+  Entry entry;
+  entry.key = std::move(key);
+  entry.node.hcode = hash(entry.key);
+  HashNode *node = db_.lookup(&entry.node, entry_eq);
+  if (node != nullptr) {
+    Entry *ent = container_of(node, Entry, node);
+    // past its deadline it is as good as gone: don't inherit its TTL
+    if (expired(ent, get_monotonic_msec())) {
+      set_ttl(ent, -1);
+    }
+    ent->type = ValueType::STRING;
+    ent->obj.reset();
+    ent->value = std::move(value);
+    return;
+  }
+  Entry *ent = new Entry;
+  ent->node.hcode = entry.node.hcode;
+  ent->key = std::move(entry.key);
+  ent->value = std::move(value);
+  db_.insert(&ent->node);
+}
+
+bool KeyStore::del(const std::string &key) {
+  Entry entry;
+  entry.key = key;
+  entry.node.hcode = hash(entry.key);
+  HashNode *node = db_.remove(&entry.node, entry_eq);
+  if (!node) {
+    return false;
+  }
+  Entry *ent = container_of(node, Entry, node);
+  // gone all the same, but it was not there for lookup() either
+  bool live = !expired(ent, get_monotonic_msec());
+  set_ttl(ent, -1);
+  delete ent;
+  return live;
+}
+
+bool KeyStore::expire(const std::string &key, int64_t ttl_ms) {
+  Entry *ent = lookup(key);
+  if (!ent) {
+    return false;
+  }
+  set_ttl(ent, ttl_ms);
+  return true;
+}
+
+int64_t KeyStore::pttl(const std::string &key) {
+  Entry *ent = lookup(key);
+  if (!ent) {
+    return -2;
+  }
+  if (!ent->has_ttl()) {
+    return -1;
+  }
+  uint64_t now_ms = get_monotonic_msec();
+  uint64_t deadline = expire_at(ent);
+  return deadline > now_ms ? (int64_t)(deadline - now_ms) : 0;
+}
+
+void KeyStore::set_ttl(Entry *ent, int64_t ttl_ms) {
+  if (ttl_ms < 0) {
+    if (ent->has_ttl()) {
+      ttl_heap_.remove(ent->heap_idx);
+      ent->heap_idx = -1;
+    }
+    return;
+  }
+  uint64_t deadline = ttl_ms + get_monotonic_msec();
+  if (!ent->has_ttl()) {
+    ttl_heap_.insert(HeapItem{deadline, &ent->heap_idx});
+  } else {
+    ttl_heap_.upsert(ent->heap_idx, HeapItem{deadline, &ent->heap_idx});
+  }
+}
+
+const std::string &KeyStore::packed(Entry *ent, std::string &scratch) {
+  if (!ent->obj) {
+    return ent->value;
+  }
+  switch (ent->type) {
+  case ValueType::HASH:
+    hash_pack(ent, scratch);
+    break;
+  case ValueType::LIST:
+    list_pack(ent, scratch);
+    break;
+  case ValueType::SET:
+    set_pack(ent, scratch);
+    break;
+  case ValueType::BLOOM:
+    bloom_pack(ent, scratch);
+    break;
+  default:
+    assert(false);
+  }
+  return scratch;
+}
+
+bool KeyStore::restore(Entry *ent, ValueType type, std::string value) {
+  ent->type = type;
+  ent->value = std::move(value);
+  ent->obj.reset();
+  switch (type) {
+  case ValueType::STRING:
+    return true;
+  case ValueType::HASH:
+    return hash_restore(ent, limits_);
+  case ValueType::LIST:
+    return list_restore(ent, limits_);
+  case ValueType::SET:
+    return set_restore(ent, limits_);
+  case ValueType::BLOOM:
+    return bloom_restore(ent);
+  }
+  return false;
+}
+
+namespace {
+struct ScanCtx {
+  KeyStore *store;
+  uint64_t now_ms;
+  std::vector<std::string> *keys;
+};
+} // namespace
+
+uint64_t KeyStore::scan(uint64_t cursor, size_t count,
+                        std::vector<std::string> &keys) {
+  ScanCtx ctx = {this, get_monotonic_msec(), &keys};
+  auto callback = [](HashNode *node, void *arg) {
+    ScanCtx &ctx = *(ScanCtx *)arg;
+    Entry *ent = container_of(node, Entry, node);
+    if (!ctx.store->expired(ent, ctx.now_ms)) {
+      ctx.keys->push_back(ent->key);
+    }
+  };
+  // whole buckets at a time, so it can overshoot `count` a little
+  size_t target = keys.size() + count;
+  do {
+    cursor = db_.scan(cursor, callback, &ctx);
+  } while (cursor != 0 && keys.size() < target);
+  return cursor;
+}
+
+size_t KeyStore::tick(uint64_t now_ms, size_t max_work,
+                      void (*on_expire)(const std::string &key, void *arg),
+                      void *arg) {
+  size_t n = 0;
+  while (n < max_work && !ttl_heap_.is_empty() &&
+         ttl_heap_.top().val <= now_ms) {
+    Entry *ent = container_of(ttl_heap_.top().ref, Entry, heap_idx);
+    HashNode *node = db_.remove(
+        &ent->node, [](HashNode *a, HashNode *b) { return a == b; });
+    assert(node == &ent->node);
+    (void)node;
+    ttl_heap_.remove(ent->heap_idx);
+    if (on_expire) {
+      on_expire(ent->key, arg);
+    }
+    delete ent;
+    n++;
+  }
+  return n;
+}
+
+int64_t KeyStore::next_expire_ms() {
+  return ttl_heap_.is_empty() ? -1 : (int64_t)ttl_heap_.top().val;
+}
+
+void KeyStore::clear() {
+  std::vector<Entry *> entries;
+  entries.reserve(db_.size());
+  auto callback = [](Entry *ent, void *arg) {
+    ((std::vector<Entry *> *)arg)->push_back(ent);
+    return true;
+  };
+  foreach (callback, &entries);
+  db_.clear();
+  ttl_heap_ = Heap();
+  for (Entry *ent : entries) {
+    delete ent;
+  }
+}
+
+namespace {
+struct ForeachCtx {
+  bool (*fn)(Entry *ent, void *arg);
+  void *arg;
+};
+} // namespace
+
+void KeyStore::foreach (bool (*fn)(Entry *ent, void *arg), void *arg) {
+  ForeachCtx ctx = {fn, arg};
+  auto callback = [](HashNode *node, void *arg) {
+    ForeachCtx &ctx = *(ForeachCtx *)arg;
+    return ctx.fn(container_of(node, Entry, node), ctx.arg);
+  };
+  db_.foreach (callback, &ctx);
+}
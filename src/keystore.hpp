@@ -0,0 +1,142 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "hashtable.hpp"
+#include "heap.hpp"
+
+// the hash code of a key in the keyspace
+uint64_t hash(const std::string &value);
+
+enum class ValueType : uint8_t {
+  STRING = 0,
+  HASH = 1,  // see hash_type.hpp
+  LIST = 2,  // see list_type.hpp
+  SET = 3,   // see set_type.hpp
+  BLOOM = 4, // see bloom_type.hpp
+};
+
+// the large encoding of a container value
+class Object {
+public:
+  virtual ~Object() = default;
+};
+
+// when a small container stops being packed
+struct EncodingLimits {
+  size_t hash_max_listpack_entries = 128; // fields
+  size_t hash_max_listpack_value = 64;    // bytes of a field or a value
+  size_t list_max_listpack_size = 8192;   // bytes of a list node
+  size_t set_max_intset_entries = 512;    // integer members
+  size_t hll_sparse_max_bytes = 3000;     // bytes of sparse HLL registers
+};
+
+class Entry {
+public:
+  struct HashNode node; // Hashtable node
+  size_t heap_idx = -1; // ttl heap index
+
+  std::string key;
+  ValueType type = ValueType::STRING;
+  // a STRING's bytes, or the packed encoding of a small container
+  std::string value;
+  // a container too big to pack, nullptr otherwise
+  std::unique_ptr<Object> obj;
+
+  bool has_ttl() const { return heap_idx != (size_t)-1; }
+};
+
+/**
+ * @brief The keyspace: the keys, their values and their TTLs
+ *
+ * This is what the server is built on, and it can be linked into another
+ * process on its own (the `simpleredis` library) to skip the network. It is
+ * not thread-safe, and nothing expires unless `tick()` is called.
+ */
+class KeyStore {
+public:
+  // how many keys one `tick()` expires at most, by default
+  static const size_t k_max_expire_work = 2000;
+
+  KeyStore() : db_(1024) {}
+  ~KeyStore() { clear(); }
+  KeyStore(const KeyStore &) = delete;
+  KeyStore &operator=(const KeyStore &) = delete;
+
+  // the value of `key`, or nullptr if there is none or it is not a string;
+  // good until the next change to the store
+  const std::string *get(const std::string &key);
+  // create or overwrite `key` with a string; an existing TTL is kept
+  void set(std::string key, std::string value);
+  // the entry of `key` if it has not expired, whatever its type
+  Entry *lookup(const std::string &key);
+  // an empty value of `type` at `key`, which lookup() did not find
+  Entry *add(std::string key, ValueType type);
+  // A key past its deadline that tick() has not deleted yet is no key to
+  // these, as to lookup().
+  // returns false if there was no such key; an expired one is deleted too
+  bool del(const std::string &key);
+  // expire `key` `ttl_ms` from now, or never if `ttl_ms` is negative;
+  // returns false if there is no such key
+  bool expire(const std::string &key, int64_t ttl_ms);
+  // milliseconds until `key` expires, -1 if it never does, -2 if there is
+  // no such key
+  int64_t pttl(const std::string &key);
+
+  /**
+   * @brief one step of a pass over every key
+   *
+   * Appends about `count` keys to `keys` and returns the cursor to pass
+   * next, 0 once the pass is over. Start at 0. A key that exists for the
+   * whole pass is returned at least once.
+   */
+  uint64_t scan(uint64_t cursor, size_t count, std::vector<std::string> &keys);
+
+  /**
+   * @brief expire up to `max_work` keys whose deadline has passed
+   *
+   * `on_expire` is called with each key just before it is deleted.
+   * @return the number of keys expired
+   */
+  size_t tick(uint64_t now_ms, size_t max_work = k_max_expire_work,
+              void (*on_expire)(const std::string &key, void *arg) = nullptr,
+              void *arg = nullptr);
+  // the monotonic time of the next expiry, or -1 if nothing expires
+  int64_t next_expire_ms();
+
+  size_t size() { return db_.size(); }
+  // delete every key
+  void clear();
+
+  // The entries themselves, for persistence and replication.
+  Entry *find(const std::string &key);
+  void foreach (bool (*fn)(Entry *ent, void *arg), void *arg);
+  // the monotonic deadline of `ent`, which must have a TTL
+  uint64_t expire_at(const Entry *ent) {
+    return ttl_heap_.at(ent->heap_idx).val;
+  }
+  // whether `ent` is past its deadline (but not yet deleted)
+  bool expired(const Entry *ent, uint64_t now_ms) {
+    return ent->has_ttl() && expire_at(ent) <= now_ms;
+  }
+  // a negative `ttl_ms` removes the TTL
+  void set_ttl(Entry *ent, int64_t ttl_ms);
+  // The value of `ent` as one string: a STRING's bytes, or the packed
+  // encoding of a container. `scratch` holds it if it has to be built.
+  const std::string &packed(Entry *ent, std::string &scratch);
+  // Give `ent` the value packed() returned; false if it is malformed.
+  bool restore(Entry *ent, ValueType type, std::string value);
+  EncodingLimits &limits() { return limits_; }
+  // Replace the table of an empty store with a prebuilt one, see
+  // `HashMap::install()`; the store now owns the entries in it.
+  void install(HashTable &&table) { db_.install(std::move(table)); }
+
+private:
+  HashMap db_;
+  Heap ttl_heap_;
+  EncodingLimits limits_;
+};
@@ -0,0 +1,144 @@
+#include "list_type.hpp"
+#include "listpack.hpp"
+
+Quicklist::~Quicklist() {
+  while (head_.next != &head_) {
+    drop(node_of(head_.next));
+  }
+}
+
+bool Quicklist::has_room(DList *link, size_t len) const {
+  if (link == &head_) {
+    return false;
+  }
+  const QuicklistNode *node = node_of(link);
+  return node->lp.size() + lp_elem_size(len) <= max_node_bytes_;
+}
+
+QuicklistNode *Quicklist::insert_node(DList *next) {
+  // the neighbour that filled up keeps its size, not its spare capacity
+  DList *full = next == &head_ ? head_.prev : next;
+  if (full != &head_) {
+    node_of(full)->lp.shrink_to_fit();
+  }
+  QuicklistNode *node = new QuicklistNode;
+  next->insert_before(&node->link);
+  nnodes_++;
+  return node;
+}
+
+void Quicklist::drop(QuicklistNode *node) {
+  node->link.detach();
+  nnodes_--;
+  delete node;
+}
+
+void Quicklist::push_front(const char *data, size_t len) {
+  DList *first = head_.next;
+  QuicklistNode *node =
+      has_room(first, len) ? node_of(first) : insert_node(first);
+  lp_insert(node->lp, 0, data, len);
+  node->count++;
+  count_++;
+}
+
+void Quicklist::push_back(const char *data, size_t len) {
+  DList *last = head_.prev;
+  QuicklistNode *node =
+      has_room(last, len) ? node_of(last) : insert_node(&head_);
+  lp_append(node->lp, data, len);
+  node->count++;
+  count_++;
+}
+
+bool Quicklist::pop_front(std::string &out) {
+  if (count_ == 0) {
+    return false;
+  }
+  QuicklistNode *node = node_of(head_.next);
+  out = lp_get(node->lp, 0).str();
+  lp_erase(node->lp, 0);
+  count_--;
+  if (--node->count == 0) {
+    drop(node);
+  }
+  return true;
+}
+
+bool Quicklist::pop_back(std::string &out) {
+  if (count_ == 0) {
+    return false;
+  }
+  QuicklistNode *node = node_of(head_.prev);
+  size_t pos = lp_prev(node->lp, node->lp.size());
+  out = lp_get(node->lp, pos).str();
+  node->lp.resize(pos);
+  count_--;
+  if (--node->count == 0) {
+    drop(node);
+  }
+  return true;
+}
+
+void Quicklist::range(size_t index, size_t n,
+                      void (*fn)(StrView elem, void *arg), void *arg) {
+  if (index >= count_ || n == 0) {
+    return;
+  }
+  // find the node from whichever end is closer
+  DList *link = nullptr;
+  if (index < count_ / 2) {
+    link = head_.next;
+    while (index >= node_of(link)->count) {
+      index -= node_of(link)->count;
+      link = link->next;
+    }
+  } else {
+    size_t from_end = count_ - index; // at least 1
+    link = head_.prev;
+    while (from_end > node_of(link)->count) {
+      from_end -= node_of(link)->count;
+      link = link->prev;
+    }
+    index = node_of(link)->count - from_end;
+  }
+  for (; link != &head_ && n > 0; link = link->next, index = 0) {
+    const std::string &lp = node_of(link)->lp;
+    size_t pos = 0;
+    for (size_t i = 0; i < index; i++) {
+      pos = lp_next(lp, pos);
+    }
+    while (pos < lp.size() && n > 0) {
+      fn(lp_get(lp, pos, &pos), arg);
+      n--;
+    }
+  }
+}
+
+void list_init(Entry *ent, const EncodingLimits &limits) {
+  ent->obj.reset(new Quicklist(limits.list_max_listpack_size));
+}
+
+void list_pack(Entry *ent, std::string &out) {
+  out.clear();
+  Quicklist *list = list_of(ent);
+  auto callback = [](StrView elem, void *arg) {
+    lp_append(*(std::string *)arg, elem.data, elem.size);
+  };
+  list->range(0, list->size(), callback, &out);
+}
+
+bool list_restore(Entry *ent, const EncodingLimits &limits) {
+  std::string lp;
+  lp.swap(ent->value);
+  if (!lp_valid(lp)) {
+    return false;
+  }
+  list_init(ent, limits);
+  Quicklist *list = list_of(ent);
+  for (size_t pos = 0; pos < lp.size();) {
+    StrView elem = lp_get(lp, pos, &pos);
+    list->push_back(elem.data, elem.size);
+  }
+  return true;
+}
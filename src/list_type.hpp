@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include "keystore.hpp"
+#include "strview.hpp"
+#include "utils.hpp"
+
+// List values: a quicklist, a doubly linked list of listpacks. Each node
+// packs elements back to back up to `EncodingLimits::list_max_listpack_size`
+// bytes, so both ends are O(1), a range is read sequentially, and an element
+// costs its length plus two bytes rather than a node of its own.
+
+struct QuicklistNode {
+  DList link;
+  std::string lp; // the elements, see listpack.hpp
+  size_t count = 0;
+};
+
+class Quicklist : public Object {
+public:
+  explicit Quicklist(size_t max_node_bytes)
+      : max_node_bytes_(max_node_bytes) {}
+  ~Quicklist() override;
+  Quicklist(const Quicklist &) = delete;
+  Quicklist &operator=(const Quicklist &) = delete;
+
+  void push_front(const char *data, size_t len);
+  void push_back(const char *data, size_t len);
+  // false if the list is empty
+  bool pop_front(std::string &out);
+  bool pop_back(std::string &out);
+  // `fn` on up to `n` elements from `index`, in order
+  void range(size_t index, size_t n, void (*fn)(StrView elem, void *arg),
+             void *arg);
+  size_t size() const { return count_; }
+  size_t nodes() const { return nnodes_; }
+
+private:
+  DList head_;
+  size_t count_ = 0;
+  size_t nnodes_ = 0;
+  size_t max_node_bytes_;
+
+  static QuicklistNode *node_of(DList *link) {
+    return container_of(link, QuicklistNode, link);
+  }
+  // whether `link` is a node with room for an element of `len` bytes; an
+  // element too big for any node gets one of its own
+  bool has_room(DList *link, size_t len) const;
+  // a new empty node before `next`
+  QuicklistNode *insert_node(DList *next);
+  void drop(QuicklistNode *node);
+};
+
+// the list in `ent`, which is always a Quicklist
+inline Quicklist *list_of(Entry *ent) { return (Quicklist *)ent->obj.get(); }
+// an empty list for an entry just added
+void list_init(Entry *ent, const EncodingLimits &limits);
+// every element as one listpack, for the snapshot
+void list_pack(Entry *ent, std::string &out);
+// rebuild the Quicklist of `ent` from what list_pack() wrote to
+// `ent->value`; false if it is malformed
+bool list_restore(Entry *ent, const EncodingLimits &limits);
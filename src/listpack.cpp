@@ -0,0 +1,168 @@
+#include "listpack.hpp"
+#include <cassert>
+
+static size_t varint_size(uint64_t v) {
+  size_t n = 1;
+  while (v >= 128) {
+    v >>= 7;
+    n++;
+  }
+  return n;
+}
+
+// the header and the data of an element of `len` bytes
+static size_t entry_size(size_t len) { return varint_size(len) + len; }
+
+size_t lp_elem_size(size_t len) {
+  size_t n = entry_size(len);
+  return n + varint_size(n);
+}
+
+// read a varint at `pos`, moving `pos` past it; false if it runs off the end
+static bool read_varint(const std::string &lp, size_t &pos, uint64_t &out) {
+  out = 0;
+  for (unsigned shift = 0; pos < lp.size() && shift < 64; shift += 7) {
+    uint8_t b = lp[pos++];
+    out |= (uint64_t)(b & 127) << shift;
+    if (!(b & 128)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// the backwards size ending at `pos`; the byte just before `pos` holds the
+// lowest 7 bits, with the top bit set if more bytes precede it
+static size_t read_backlen(const std::string &lp, size_t &pos) {
+  uint64_t v = 0;
+  unsigned shift = 0;
+  uint8_t b = 0;
+  do {
+    b = lp[--pos];
+    v |= (uint64_t)(b & 127) << shift;
+    shift += 7;
+  } while (b & 128);
+  return v;
+}
+
+// encode an element into `buf`, which has room for lp_elem_size(len)
+static size_t encode(char *buf, const char *data, size_t len) {
+  char *p = buf;
+  uint64_t v = len;
+  while (v >= 128) {
+    *p++ = (char)((v & 127) | 128);
+    v >>= 7;
+  }
+  *p++ = (char)v;
+  memcpy(p, data, len);
+  p += len;
+  size_t n = p - buf;
+  size_t nback = varint_size(n);
+  for (size_t i = nback; i > 0; i--) {
+    // the last byte is the lowest group, flagged if more follow backwards
+    p[i - 1] = (char)((n & 127) | (i > 1 ? 128 : 0));
+    n >>= 7;
+  }
+  return p + nback - buf;
+}
+
+StrView lp_get(const std::string &lp, size_t pos, size_t *next) {
+  uint64_t len = 0;
+  bool ok = read_varint(lp, pos, len);
+  assert(ok);
+  (void)ok;
+  StrView out = {lp.data() + pos, (size_t)len};
+  if (next) {
+    size_t n = entry_size(len);
+    *next = pos + len + varint_size(n);
+  }
+  return out;
+}
+
+size_t lp_next(const std::string &lp, size_t pos) {
+  size_t next = 0;
+  lp_get(lp, pos, &next);
+  return next;
+}
+
+size_t lp_prev(const std::string &lp, size_t pos) {
+  assert(pos > 0);
+  size_t n = read_backlen(lp, pos);
+  return pos - n;
+}
+
+void lp_append(std::string &lp, const char *data, size_t len) {
+  lp_insert(lp, lp.size(), data, len);
+}
+
+void lp_insert(std::string &lp, size_t pos, const char *data, size_t len) {
+  size_t n = lp_elem_size(len);
+  lp.insert(pos, n, '\0');
+  encode(&lp[pos], data, len);
+}
+
+void lp_replace(std::string &lp, size_t pos, const char *data, size_t len) {
+  size_t old = lp_next(lp, pos) - pos;
+  size_t n = lp_elem_size(len);
+  if (n != old) {
+    lp.replace(pos, old, n, '\0');
+  }
+  encode(&lp[pos], data, len);
+}
+
+void lp_erase(std::string &lp, size_t pos, size_t n) {
+  size_t end = pos;
+  for (size_t i = 0; i < n && end < lp.size(); i++) {
+    end = lp_next(lp, end);
+  }
+  lp.erase(pos, end - pos);
+}
+
+size_t lp_find(const std::string &lp, const char *data, size_t len,
+               size_t step) {
+  size_t pos = 0;
+  while (pos < lp.size()) {
+    size_t next = 0;
+    StrView elem = lp_get(lp, pos, &next);
+    if (elem.size == len && memcmp(elem.data, data, len) == 0) {
+      return pos;
+    }
+    pos = next;
+    for (size_t i = 1; i < step && pos < lp.size(); i++) {
+      pos = lp_next(lp, pos);
+    }
+  }
+  return lp.size();
+}
+
+size_t lp_count(const std::string &lp) {
+  size_t n = 0;
+  for (size_t pos = 0; pos < lp.size(); pos = lp_next(lp, pos)) {
+    n++;
+  }
+  return n;
+}
+
+bool lp_valid(const std::string &lp) {
+  size_t pos = 0;
+  while (pos < lp.size()) {
+    size_t start = pos;
+    uint64_t len = 0;
+    if (!read_varint(lp, pos, len) || lp.size() - pos < len) {
+      return false;
+    }
+    pos += len;
+    size_t n = pos - start;
+    size_t nback = varint_size(n);
+    // the backwards read must stop at the first byte of the size
+    if (lp.size() - pos < nback || ((uint8_t)lp[pos] & 128)) {
+      return false;
+    }
+    pos += nback;
+    size_t end = pos;
+    if (read_backlen(lp, end) != n || end != start + n) {
+      return false;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "strview.hpp"
+
+// A listpack: strings packed back to back in one buffer, for the small
+// encodings of the container types. Each element is
+//
+//   <len as a varint> <len bytes> <the size of the first two, backwards>
+//
+// The trailing size lets the list be walked from the end too. Positions are
+// byte offsets of elements; `lp.size()` is the position past the last one.
+// There is no header, so counting the elements is a walk.
+
+// the element at `pos` (not the end), and the position after it
+StrView lp_get(const std::string &lp, size_t pos, size_t *next = nullptr);
+// the position after the element at `pos`
+size_t lp_next(const std::string &lp, size_t pos);
+// the position of the element before `pos`, which is not 0
+size_t lp_prev(const std::string &lp, size_t pos);
+
+void lp_append(std::string &lp, const char *data, size_t len);
+// insert an element before the one at `pos`
+void lp_insert(std::string &lp, size_t pos, const char *data, size_t len);
+void lp_replace(std::string &lp, size_t pos, const char *data, size_t len);
+// remove `n` elements from `pos`
+void lp_erase(std::string &lp, size_t pos, size_t n = 1);
+
+/**
+ * @brief the first of every `step`-th element that equals `s`
+ *
+ * Looks at elements 0, `step`, 2 * `step`, ... so that in a listpack of
+ * field/value pairs only the fields are compared.
+ * @return its position, or `lp.size()` if there is none
+ */
+size_t lp_find(const std::string &lp, const char *data, size_t len,
+               size_t step = 1);
+size_t lp_count(const std::string &lp);
+// whether `lp` is well-formed, for listpacks read from disk
+bool lp_valid(const std::string &lp);
+// the bytes one element of `len` bytes takes
+size_t lp_elem_size(size_t len);
@@ -0,0 +1,253 @@
+#include "logger.hpp"
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <unistd.h>
+
+uint64_t log_now_ns() {
+  struct timespec tv = {0, 0};
+  clock_gettime(CLOCK_REALTIME, &tv);
+  return uint64_t(tv.tv_sec) * 1000000000 + tv.tv_nsec;
+}
+
+void LogRecord::add_str(const char *s, size_t len) {
+  if (nargs >= k_max_args) {
+    return;
+  }
+  if (len > k_text_size - text_len) {
+    len = k_text_size - text_len; // truncated
+  }
+  LogArg &arg = args[nargs++];
+  arg.type = LogArg::STR;
+  arg.s.off = text_len;
+  arg.s.len = (uint16_t)len;
+  memcpy(text + text_len, s, len);
+  text_len += len;
+}
+
+bool LogRateLimiter::allow(uint32_t &suppressed) {
+  struct timespec tv = {0, 0};
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &tv);
+  uint64_t now = tv.tv_sec;
+  uint64_t window = window_.load(std::memory_order_relaxed);
+  if (window != now &&
+      window_.compare_exchange_strong(window, now, std::memory_order_relaxed)) {
+    count_.store(0, std::memory_order_relaxed);
+  }
+  if (count_.fetch_add(1, std::memory_order_relaxed) < per_sec_) {
+    suppressed = suppressed_.exchange(0, std::memory_order_relaxed);
+    return true;
+  }
+  suppressed_.fetch_add(1, std::memory_order_relaxed);
+  return false;
+}
+
+Logger &Logger::instance() {
+  // never destroyed: static destructors still log while shutting down. A
+  // static buffer rather than `new`, which in C++14 ignores the alignas(64)
+  // that keeps the producers' and the consumer's positions apart.
+  static std::aligned_storage<sizeof(Logger), alignof(Logger)>::type storage;
+  static Logger *logger = [] {
+    Logger *l = new (&storage) Logger();
+    atexit([] { Logger::instance().flush(); });
+    return l;
+  }();
+  return *logger;
+}
+
+Logger::Logger() : ring_(new LogRecord[k_capacity]) {
+  for (size_t i = 0; i < k_capacity; i++) {
+    ring_[i].seq.store(i, std::memory_order_relaxed);
+  }
+}
+
+void Logger::start() {
+  if (started_.exchange(true)) {
+    return;
+  }
+  std::thread(&Logger::drain_loop, this).detach();
+}
+
+// Bounded MPSC queue: slot `pos & mask` is free for the producer that
+// claims `pos` once its seq equals `pos`, and readable once the producer has
+// set it to `pos + 1`. The consumer hands it back for the next lap by setting
+// `pos + k_capacity`.
+LogRecord *Logger::claim(uint64_t &pos) {
+  pos = enqueue_pos_.load(std::memory_order_relaxed);
+  while (true) {
+    LogRecord *rec = &ring_[pos & (k_capacity - 1)];
+    uint64_t seq = rec->seq.load(std::memory_order_acquire);
+    int64_t dif = (int64_t)(seq - pos);
+    if (dif == 0) {
+      if (enqueue_pos_.compare_exchange_weak(pos, pos + 1,
+                                             std::memory_order_relaxed)) {
+        return rec;
+      }
+    } else if (dif < 0) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return nullptr;
+    } else {
+      pos = enqueue_pos_.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+void Logger::commit(LogRecord *rec, uint64_t pos) {
+  rec->seq.store(pos + 1, std::memory_order_release);
+}
+
+void Logger::flush() {
+  if (!started_.load()) {
+    // nobody else is draining, so it is safe to do it here
+    std::string out;
+    drain(out);
+    write_out(out);
+    return;
+  }
+  uint64_t target = enqueue_pos_.load();
+  while (written_pos_.load() < target) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+static const char *severity_name(LogSeverity severity) {
+  switch (severity) {
+  case LogSeverity::TRACE:
+    return "Trace";
+  case LogSeverity::DEBUG:
+    return "Debug";
+  case LogSeverity::INFO:
+    return "Info";
+  case LogSeverity::NOTICE:
+    return "Notice";
+  case LogSeverity::WARNING:
+    return "Warn";
+  case LogSeverity::ERROR:
+    return "Error";
+  case LogSeverity::FATAL:
+    return "Fatal";
+  }
+  return "?";
+}
+
+static void format_arg(const LogRecord &rec, const LogArg &arg,
+                       std::string &out) {
+  char buf[32];
+  int n = 0;
+  switch (arg.type) {
+  case LogArg::I64:
+    n = snprintf(buf, sizeof(buf), "%lld", (long long)arg.i);
+    break;
+  case LogArg::U64:
+    n = snprintf(buf, sizeof(buf), "%llu", (unsigned long long)arg.u);
+    break;
+  case LogArg::F64:
+    n = snprintf(buf, sizeof(buf), "%g", arg.d);
+    break;
+  case LogArg::STR:
+    out.append(rec.text + arg.s.off, arg.s.len);
+    return;
+  }
+  out.append(buf, n);
+}
+
+// `2026-01-02 15:04:05.123 [Info] (func) message`
+static void format_record(const LogRecord &rec, std::string &out) {
+  time_t sec = rec.time_ns / 1000000000;
+  struct tm tm = {};
+  localtime_r(&sec, &tm);
+  char head[64];
+  size_t n = strftime(head, sizeof(head), "%Y-%m-%d %H:%M:%S", &tm);
+  out.append(head, n);
+  n = snprintf(head, sizeof(head), ".%03u [",
+               (unsigned)(rec.time_ns / 1000000 % 1000));
+  out.append(head, n);
+  out += severity_name(rec.severity);
+  out += "] (";
+  out += rec.func;
+  out += ") ";
+
+  size_t next = 0;
+  for (const char *p = rec.fmt; *p; p++) {
+    if (p[0] == '{' && p[1] == '}' && next < rec.nargs) {
+      format_arg(rec, rec.args[next++], out);
+      p++;
+    } else {
+      out += *p;
+    }
+  }
+  if (rec.suppressed > 0) {
+    n = snprintf(head, sizeof(head), " (%u similar messages suppressed)",
+                 rec.suppressed);
+    out.append(head, n);
+  }
+  out += '\n';
+}
+
+size_t Logger::drain(std::string &out) {
+  size_t n = 0;
+  uint64_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+  while (true) {
+    LogRecord &rec = ring_[pos & (k_capacity - 1)];
+    if (rec.seq.load(std::memory_order_acquire) != pos + 1) {
+      break; // empty, or the producer has not committed yet
+    }
+    format_record(rec, out);
+    rec.seq.store(pos + k_capacity, std::memory_order_release);
+    pos++;
+    n++;
+    dequeue_pos_.store(pos, std::memory_order_relaxed);
+    if (out.size() >= 64 * 1024) {
+      write_out(out);
+    }
+  }
+  uint64_t dropped = dropped_.exchange(0, std::memory_order_relaxed);
+  if (dropped > 0) {
+    char buf[96];
+    int len = snprintf(buf, sizeof(buf),
+                       "[Warn] (logger) %llu messages dropped, ring full\n",
+                       (unsigned long long)dropped);
+    out.append(buf, len);
+  }
+  return n;
+}
+
+void Logger::write_out(std::string &out) {
+  size_t n = 0;
+  while (n < out.size()) {
+    ssize_t rv = write(STDOUT_FILENO, out.data() + n, out.size() - n);
+    if (rv < 0 && errno == EINTR) {
+      continue;
+    }
+    if (rv <= 0) {
+      break; // nowhere to report it
+    }
+    n += rv;
+  }
+  out.clear();
+  written_pos_.store(dequeue_pos_.load(std::memory_order_relaxed));
+}
+
+// Poll the ring, backing off to 50ms while it stays empty. Producers never
+// have to wake this thread, which keeps a syscall off the logging call.
+void Logger::drain_loop() {
+  std::string out;
+  out.reserve(64 * 1024);
+  int idle_ms = 1;
+  while (true) {
+    if (drain(out) > 0 || !out.empty()) {
+      write_out(out);
+      idle_ms = 1;
+      continue;
+    }
+    written_pos_.store(dequeue_pos_.load(std::memory_order_relaxed));
+    std::this_thread::sleep_for(std::chrono::milliseconds(idle_ms));
+    if (idle_ms < 50) {
+      idle_ms *= 2;
+    }
+  }
+}
@@ -0,0 +1,196 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+// Asynchronous logger.
+//
+// `LOG(INFO, "accepted {}:{}", ip, port)` copies the format pointer and the
+// arguments into a slot of a fixed-size ring and returns; a background thread
+// does the formatting and the write. The format string must be a literal, it
+// is kept by pointer. Strings are copied into the slot (and truncated to
+// fit), so the caller's buffers can go away right after the call. Nothing is
+// allocated and no lock is taken on the producing side; when the ring is full
+// the message is dropped and counted.
+//
+// Messages below `LOG_MIN_SEVERITY` are compiled out. `LOG_RATELIMITED`
+// additionally lets at most `per_sec` messages a second through from one call
+// site, for messages that can fire once per key or per connection.
+
+enum class LogSeverity : uint8_t {
+  TRACE = 0,
+  DEBUG = 1,
+  INFO = 2,
+  NOTICE = 3,
+  WARNING = 4,
+  ERROR = 5,
+  FATAL = 6,
+};
+
+#ifndef LOG_MIN_SEVERITY
+#define LOG_MIN_SEVERITY 2 // INFO
+#endif
+
+#define LOG(severity, ...)                                                     \
+  do {                                                                         \
+    if ((int)LogSeverity::severity >= LOG_MIN_SEVERITY) {                      \
+      log_write(LogSeverity::severity, __func__, 0, __VA_ARGS__);              \
+    }                                                                          \
+  } while (0)
+
+#define LOG_RATELIMITED(severity, per_sec, ...)                                \
+  do {                                                                         \
+    if ((int)LogSeverity::severity >= LOG_MIN_SEVERITY) {                      \
+      static LogRateLimiter log_limiter_(per_sec);                             \
+      uint32_t log_suppressed_ = 0;                                            \
+      if (log_limiter_.allow(log_suppressed_)) {                               \
+        log_write(LogSeverity::severity, __func__, log_suppressed_,            \
+                  __VA_ARGS__);                                                \
+      }                                                                        \
+    }                                                                          \
+  } while (0)
+
+struct LogArg {
+  enum Type : uint8_t { I64, U64, F64, STR };
+  Type type;
+  union {
+    int64_t i;
+    uint64_t u;
+    double d;
+    struct {
+      uint16_t off;
+      uint16_t len;
+    } s; // into LogRecord::text
+  };
+};
+
+struct LogRecord {
+  static const size_t k_max_args = 10;
+  static const size_t k_text_size = 120;
+
+  std::atomic<uint64_t> seq; // ring bookkeeping, see Logger
+  uint64_t time_ns;
+  const char *func;
+  const char *fmt;
+  uint32_t suppressed;
+  LogSeverity severity;
+  uint8_t nargs;
+  uint16_t text_len;
+  LogArg args[k_max_args];
+  char text[k_text_size];
+
+  void add_str(const char *s, size_t len);
+};
+
+class Logger {
+public:
+  static Logger &instance();
+
+  // start the thread draining the ring; messages logged before this are
+  // queued
+  void start();
+  // wait until everything logged so far has been written
+  void flush();
+
+  LogRecord *claim(uint64_t &pos);
+  void commit(LogRecord *rec, uint64_t pos);
+
+private:
+  static const size_t k_capacity = 4096; // power of 2
+
+  Logger();
+  void drain_loop();
+  // format every committed record into `out`, return how many there were
+  size_t drain(std::string &out);
+  void write_out(std::string &out);
+
+  LogRecord *ring_;
+  alignas(64) std::atomic<uint64_t> enqueue_pos_{0};
+  alignas(64) std::atomic<uint64_t> dequeue_pos_{0};
+  std::atomic<uint64_t> written_pos_{0}; // records written out
+  std::atomic<uint64_t> dropped_{0};
+  std::atomic<bool> started_{false};
+};
+
+// Counts messages per one-second window. A call site shares one of these
+// across threads, so the state is atomic, but it does not need to be exact.
+class LogRateLimiter {
+public:
+  explicit LogRateLimiter(uint32_t per_sec) : per_sec_(per_sec) {}
+
+  // `suppressed` is set to how many messages were dropped since the last one
+  // allowed through
+  bool allow(uint32_t &suppressed);
+
+private:
+  const uint32_t per_sec_;
+  std::atomic<uint64_t> window_{0};
+  std::atomic<uint32_t> count_{0};
+  std::atomic<uint32_t> suppressed_{0};
+};
+
+inline void log_capture(LogRecord &rec, const char *s) {
+  rec.add_str(s ? s : "(null)", s ? strlen(s) : 6);
+}
+inline void log_capture(LogRecord &rec, const std::string &s) {
+  rec.add_str(s.data(), s.size());
+}
+inline void log_capture(LogRecord &rec, double v) {
+  if (rec.nargs < LogRecord::k_max_args) {
+    LogArg &arg = rec.args[rec.nargs++];
+    arg.type = LogArg::F64;
+    arg.d = v;
+  }
+}
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value ||
+                        std::is_enum<T>::value>::type
+log_capture(LogRecord &rec, T v) {
+  if (rec.nargs >= LogRecord::k_max_args) {
+    return;
+  }
+  LogArg &arg = rec.args[rec.nargs++];
+  if (std::is_signed<T>::value || std::is_enum<T>::value) {
+    arg.type = LogArg::I64;
+    arg.i = (int64_t)v;
+  } else {
+    arg.type = LogArg::U64;
+    arg.u = (uint64_t)v;
+  }
+}
+
+inline void log_capture_all(LogRecord &) {}
+template <typename T, typename... Rest>
+void log_capture_all(LogRecord &rec, const T &v, const Rest &...rest) {
+  log_capture(rec, v);
+  log_capture_all(rec, rest...);
+}
+
+uint64_t log_now_ns();
+
+template <typename... Args>
+void log_write(LogSeverity severity, const char *func, uint32_t suppressed,
+               const char *fmt, const Args &...args) {
+  Logger &logger = Logger::instance();
+  uint64_t pos = 0;
+  LogRecord *rec = logger.claim(pos);
+  if (rec == nullptr) {
+    return; // full, counted by claim()
+  }
+  rec->time_ns = log_now_ns();
+  rec->func = func;
+  rec->fmt = fmt;
+  rec->suppressed = suppressed;
+  rec->severity = severity;
+  rec->nargs = 0;
+  rec->text_len = 0;
+  log_capture_all(*rec, args...);
+  logger.commit(rec, pos);
+  if (severity == LogSeverity::FATAL) {
+    logger.flush();
+  }
+}
@@ -0,0 +1,278 @@
+#include "protocol.hpp"
+
+static bool read_u32(const uint8_t *&begin, const uint8_t *end,
+                     uint32_t &out) {
+  if (end - begin < 4) {
+    return false;
+  }
+  memcpy(&out, begin, 4);
+  begin += 4;
+  return true;
+}
+
+int parse_request(const uint8_t *data, size_t size,
+                  std::vector<std::string> &out) {
+  const uint8_t *end = data + size;
+  uint32_t nstr = 0;
+  if (!read_u32(data, end, nstr)) {
+    return -1;
+  }
+  while (out.size() < nstr) {
+    uint32_t len = 0;
+    if (!read_u32(data, end, len)) {
+      return -1;
+    }
+    if (data + len > end) {
+      return -1;
+    }
+    out.push_back(std::string(data, data + len));
+    data += len;
+  }
+  if (data != end) {
+    return -1;
+  }
+  return 0;
+}
+
+void encode_request(const std::vector<std::string> &cmd,
+                    std::vector<uint8_t> &out) {
+  uint32_t len = 4;
+  for (const std::string &s : cmd) {
+    len += 4 + s.size();
+  }
+  size_t pos = out.size();
+  out.resize(pos + 4 + len);
+  uint8_t *p = out.data() + pos;
+  uint32_t nstr = cmd.size();
+  memcpy(p, &len, 4);
+  memcpy(p + 4, &nstr, 4);
+  p += 8;
+  for (const std::string &s : cmd) {
+    uint32_t n = s.size();
+    memcpy(p, &n, 4);
+    memcpy(p + 4, s.data(), n);
+    p += 4 + n;
+  }
+}
+
+// decimal digits of `v`
+static size_t count_digits(uint64_t v) {
+  size_t n = 1;
+  while (v >= 10) {
+    v /= 10;
+    n++;
+  }
+  return n;
+}
+
+// `<prefix><value>\r\n` at `p`, which has room for it
+static uint8_t *put_resp_line(uint8_t *p, char prefix, int64_t value) {
+  uint64_t v = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+  *p++ = prefix;
+  if (value < 0) {
+    *p++ = '-';
+  }
+  size_t n = count_digits(v);
+  for (size_t i = n; i > 0; i--) {
+    p[i - 1] = '0' + v % 10;
+    v /= 10;
+  }
+  p += n;
+  *p++ = '\r';
+  *p++ = '\n';
+  return p;
+}
+
+static size_t resp_line_size(int64_t value) {
+  uint64_t v = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+  return 3 + (value < 0) + count_digits(v);
+}
+
+static const char k_nil2[] = "$-1\r\n";
+static const char k_nil3[] = "_\r\n";
+static const char k_ok[] = "+OK\r\n";
+
+void Response::resp_line(char prefix, int64_t value) {
+  put_resp_line(claim(resp_line_size(value)), prefix, value);
+}
+
+void Response::resp_nil() {
+  if (proto_ == Protocol::RESP3) {
+    memcpy(claim(sizeof(k_nil3) - 1), k_nil3, sizeof(k_nil3) - 1);
+  } else {
+    memcpy(claim(sizeof(k_nil2) - 1), k_nil2, sizeof(k_nil2) - 1);
+  }
+}
+
+void Response::resp_ok() {
+  memcpy(claim(sizeof(k_ok) - 1), k_ok, sizeof(k_ok) - 1);
+}
+
+// `$<len>\r\n<data>\r\n` at `p`
+static uint8_t *put_resp_str(uint8_t *p, const char *data, size_t len) {
+  p = put_resp_line(p, '$', len);
+  memcpy(p, data, len);
+  p[len] = '\r';
+  p[len + 1] = '\n';
+  return p + len + 2;
+}
+
+void Response::resp_str(const char *data, size_t len) {
+  put_resp_str(claim(str_size(len)), data, len);
+}
+
+void Response::resp_err(ResponseErrorType err, const std::string &msg) {
+  // the first word is the error code clients match on
+  const char *code = err == ERR_READONLY    ? "-READONLY "
+                     : err == ERR_WRONGTYPE ? "-WRONGTYPE "
+                                            : "-ERR ";
+  size_t code_len = strlen(code);
+  uint8_t *p = claim(code_len + msg.size() + 2);
+  memcpy(p, code, code_len);
+  p += code_len;
+  for (char c : msg) {
+    *p++ = c == '\r' || c == '\n' ? ' ' : c;
+  }
+  p[0] = '\r';
+  p[1] = '\n';
+}
+
+size_t Response::str_size(size_t len) const {
+  if (proto_ == Protocol::NATIVE) {
+    return 5 + len;
+  }
+  return resp_line_size(len) + len + 2;
+}
+
+size_t Response::nil_size() const {
+  if (proto_ == Protocol::NATIVE) {
+    return 1;
+  }
+  return proto_ == Protocol::RESP3 ? sizeof(k_nil3) - 1 : sizeof(k_nil2) - 1;
+}
+
+size_t Response::array_size(uint32_t n) const {
+  return proto_ == Protocol::NATIVE ? 5 : resp_line_size(n);
+}
+
+size_t Response::map_size(uint32_t n) const {
+  return proto_ == Protocol::RESP3 ? resp_line_size(n) : array_size(2 * n);
+}
+
+size_t Response::bulk_array_size(const std::string *const *items,
+                                 size_t n) const {
+  size_t total = array_size(n);
+  for (size_t i = 0; i < n; i++) {
+    total += items[i] ? str_size(items[i]->size()) : nil_size();
+  }
+  return total;
+}
+
+void Response::out_bulk_array(const std::string *const *items, size_t n) {
+  size_t total = bulk_array_size(items, n);
+  if (!fits(total)) {
+    return out_err(ERR_TOO_BIG, "response size too big");
+  }
+  uint8_t *p = claim(total);
+  if (proto_ == Protocol::NATIVE) {
+    *p++ = ResponseType::ARRAY;
+    put_u32(p, n);
+    p += 4;
+    for (size_t i = 0; i < n; i++) {
+      const std::string *s = items[i];
+      if (s) {
+        p = put_str(p, s->data(), s->size());
+      } else {
+        *p++ = ResponseType::NIL;
+      }
+    }
+    return;
+  }
+  p = put_resp_line(p, '*', n);
+  for (size_t i = 0; i < n; i++) {
+    const std::string *s = items[i];
+    if (s) {
+      p = put_resp_str(p, s->data(), s->size());
+    } else {
+      size_t len = nil_size();
+      memcpy(p, proto_ == Protocol::RESP3 ? k_nil3 : k_nil2, len);
+      p += len;
+    }
+  }
+}
+
+// arrays nest, but not this deep in anything the server sends
+static const int k_max_depth = 16;
+
+static bool decode_value(const uint8_t *&cur, const uint8_t *end,
+                         ReplyView &out, int depth) {
+  if (cur == end || depth > k_max_depth) {
+    return false;
+  }
+  out = ReplyView();
+  out.type = (ResponseType)*cur++;
+  uint32_t len = 0;
+  switch (out.type) {
+  case ResponseType::NIL:
+    return true;
+  case ResponseType::ERR:
+    if (!read_u32(cur, end, out.code)) {
+      return false;
+    }
+    // fall through: the message is encoded like a string
+  case ResponseType::STR:
+    if (!read_u32(cur, end, len) || (size_t)(end - cur) < len) {
+      return false;
+    }
+    out.str.data = (const char *)cur;
+    out.str.size = len;
+    cur += len;
+    return true;
+  case ResponseType::INT:
+  case ResponseType::DOUBLE:
+    if (end - cur < 8) {
+      return false;
+    }
+    if (out.type == ResponseType::INT) {
+      memcpy(&out.integer, cur, 8);
+    } else {
+      memcpy(&out.number, cur, 8);
+    }
+    cur += 8;
+    return true;
+  case ResponseType::ARRAY: {
+    if (!read_u32(cur, end, out.count)) {
+      return false;
+    }
+    // check the whole array now, so `elements()` cannot fail
+    out.elems = cur;
+    ReplyView elem;
+    for (uint32_t i = 0; i < out.count; i++) {
+      if (!decode_value(cur, end, elem, depth + 1)) {
+        return false;
+      }
+    }
+    out.elems_end = cur;
+    return true;
+  }
+  }
+  return false; // unknown type
+}
+
+bool decode_value(const uint8_t *&cur, const uint8_t *end, ReplyView &out) {
+  return decode_value(cur, end, out, 0);
+}
+
+bool decode_reply(const uint8_t *data, size_t size, ReplyView &out) {
+  const uint8_t *end = data + size;
+  return decode_value(data, end, out) && data == end;
+}
+
+std::vector<ReplyView> ReplyView::elements() const {
+  std::vector<ReplyView> out(count);
+  const uint8_t *cur = elems;
+  for (ReplyView &elem : out) {
+    decode_value(cur, elems_end, elem);
+  }
+  return out;
+}
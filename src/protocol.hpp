@@ -0,0 +1,222 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "strview.hpp"
+
+// The wire format, shared by the server and the client library.
+//
+// Every message is a u32 length followed by that many bytes (all integers
+// little-endian). A request is a u32 count of strings, each a u32 length and
+// the bytes. A response is one value: a type byte, then
+//   NIL:    nothing
+//   ERR:    u32 code, u32 length, message
+//   STR:    u32 length, bytes
+//   INT:    i64
+//   DOUBLE: f64
+//   ARRAY:  u32 count, then that many values
+
+enum ResponseType {
+  NIL = 0,
+  ERR = 1,
+  STR = 2,
+  INT = 3,
+  DOUBLE = 4,
+  ARRAY = 5,
+};
+
+enum ResponseErrorType {
+  ERR_UNKNOWN = 1,
+  ERR_TOO_BIG = 2,
+  ERR_BAD_ARG = 3,
+  ERR_READONLY = 4,
+  ERR_WRONGTYPE = 5, // the key holds another type of value
+};
+
+// how replies are encoded on a connection
+enum class Protocol {
+  NATIVE, // the framing above
+  RESP2,  // see resp.hpp
+  RESP3,
+};
+
+// Encodes one reply at the end of a buffer. Each value is sized first and
+// the buffer grown once for it, then the bytes are written in place.
+class Response {
+public:
+  // the largest reply; anything bigger is replaced by an ERR_TOO_BIG error
+  static const size_t k_max_size = 100000;
+
+  Response(std::vector<uint8_t> &buffer, Protocol proto = Protocol::NATIVE)
+      : buffer_(buffer), begin_(buffer.size()), proto_(proto) {
+    if (proto_ == Protocol::NATIVE) {
+      claim(sizeof(uint32_t)); // reserve space to add length
+    }
+  }
+
+  void out_nil() {
+    if (proto_ != Protocol::NATIVE) {
+      return resp_nil();
+    }
+    *claim(1) = ResponseType::NIL;
+  }
+  // success with nothing to return: `+OK` in RESP, which has no nil that
+  // clients would not read as "not done"; NIL in the native framing
+  void out_ok() {
+    if (proto_ != Protocol::NATIVE) {
+      return resp_ok();
+    }
+    *claim(1) = ResponseType::NIL;
+  }
+  void out_str(const std::string &s) { out_str(s.data(), s.size()); }
+  void out_str(const char *data, size_t len) {
+    if (proto_ != Protocol::NATIVE) {
+      return resp_str(data, len);
+    }
+    put_str(claim(5 + len), data, len);
+  }
+  void out_err(ResponseErrorType err, const std::string &msg) {
+    if (proto_ != Protocol::NATIVE) {
+      return resp_err(err, msg);
+    }
+    uint8_t *p = claim(9 + msg.size());
+    p[0] = ResponseType::ERR;
+    put_u32(p + 1, err);
+    put_u32(p + 5, msg.size());
+    memcpy(p + 9, msg.data(), msg.size());
+  }
+  void out_int(int64_t value) {
+    if (proto_ != Protocol::NATIVE) {
+      return resp_line(':', value);
+    }
+    uint8_t *p = claim(9);
+    p[0] = ResponseType::INT;
+    memcpy(p + 1, &value, 8);
+  }
+  void out_arrary(uint32_t n) {
+    if (proto_ != Protocol::NATIVE) {
+      return resp_line('*', n);
+    }
+    uint8_t *p = claim(5);
+    p[0] = ResponseType::ARRAY;
+    put_u32(p + 1, n);
+  }
+  // an out-of-band message of `n` values, like a pub/sub message: a push in
+  // RESP3, an array elsewhere
+  void out_push(uint32_t n) {
+    if (proto_ == Protocol::RESP3) {
+      return resp_line('>', n);
+    }
+    out_arrary(n);
+  }
+  // switch RESP versions, before anything is written
+  void set_protocol(Protocol proto) {
+    assert(proto != Protocol::NATIVE && proto_ != Protocol::NATIVE);
+    proto_ = proto;
+  }
+  // `n` key/value pairs: a map in RESP3, a flat array elsewhere
+  void out_map(uint32_t n) {
+    if (proto_ == Protocol::RESP3) {
+      return resp_line('%', n);
+    }
+    out_arrary(2 * n);
+  }
+
+  // The encoded size of a value, so a reply can be checked against
+  // k_max_size and reserved before it is built.
+  size_t str_size(size_t len) const;
+  size_t nil_size() const;
+  size_t array_size(uint32_t n) const;
+  size_t map_size(uint32_t n) const;
+  // an array of `n` strings, nullptr for nil
+  size_t bulk_array_size(const std::string *const *items, size_t n) const;
+  // whether `n` more bytes keep the reply within k_max_size
+  bool fits(size_t n) const { return size() + n <= k_max_size; }
+  void reserve(size_t n) { buffer_.reserve(buffer_.size() + n); }
+  // `out_arrary(n)` and its strings, in a single write; too big a reply is
+  // turned into an error before anything is copied
+  void out_bulk_array(const std::string *const *items, size_t n);
+
+  void build() {
+    size_t size = this->size();
+    if (size > k_max_size) {
+      buffer_.resize(begin_ + header_size());
+      out_err(ResponseErrorType::ERR_TOO_BIG, "response size too big");
+      size = this->size();
+    }
+    if (proto_ != Protocol::NATIVE) {
+      return; // RESP replies carry no length
+    }
+    // insert the while msg length
+    put_u32(buffer_.data() + begin_, size);
+  }
+
+private:
+  std::vector<uint8_t> &buffer_;
+  size_t begin_;
+  Protocol proto_;
+
+  size_t header_size() const {
+    return proto_ == Protocol::NATIVE ? sizeof(uint32_t) : 0;
+  }
+  // the reply so far, without the length prefix
+  size_t size() const { return buffer_.size() - begin_ - header_size(); }
+  // `n` more bytes at the end of the buffer, to be written by the caller
+  uint8_t *claim(size_t n) {
+    size_t old = buffer_.size();
+    buffer_.resize(old + n);
+    return buffer_.data() + old;
+  }
+  static void put_u32(uint8_t *p, uint32_t value) { memcpy(p, &value, 4); }
+  // a native STR, 5 + len bytes
+  static uint8_t *put_str(uint8_t *p, const char *data, size_t len) {
+    p[0] = ResponseType::STR;
+    put_u32(p + 1, len);
+    memcpy(p + 5, data, len);
+    return p + 5 + len;
+  }
+  // `<prefix><value>\r\n`
+  void resp_line(char prefix, int64_t value);
+  void resp_nil();
+  void resp_ok();
+  void resp_str(const char *data, size_t len);
+  void resp_err(ResponseErrorType err, const std::string &msg);
+};
+
+int parse_request(const uint8_t *data, size_t size,
+                  std::vector<std::string> &out);
+// the inverse of `parse_request`, including the leading length prefix
+void encode_request(const std::vector<std::string> &cmd,
+                    std::vector<uint8_t> &out);
+
+// One decoded response value. Strings and array elements point into the
+// buffer it was decoded from, so it is only good as long as that buffer.
+struct ReplyView {
+  ResponseType type = ResponseType::NIL;
+  StrView str;          // STR, and the message of an ERR
+  uint32_t code = 0;    // ERR
+  int64_t integer = 0;  // INT
+  double number = 0;    // DOUBLE
+  uint32_t count = 0;   // ARRAY: number of elements
+  const uint8_t *elems = nullptr; // ARRAY: the encoded elements
+  const uint8_t *elems_end = nullptr;
+
+  bool is_err() const { return type == ResponseType::ERR; }
+  // the elements of an ARRAY (views too, nothing is copied)
+  std::vector<ReplyView> elements() const;
+};
+
+/**
+ * @brief decode one value at `cur`, advancing `cur` past it
+ *
+ * @return false if the value is malformed or runs past `end`
+ */
+bool decode_value(const uint8_t *&cur, const uint8_t *end, ReplyView &out);
+// decode a response whose length prefix has been stripped: exactly one value
+bool decode_reply(const uint8_t *data, size_t size, ReplyView &out);
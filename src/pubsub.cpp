@@ -0,0 +1,214 @@
+#include "pubsub.hpp"
+#include "connection.hpp"
+#include "utils.hpp"
+#include <algorithm>
+
+namespace {
+// One message, encoded for each protocol the first time a subscriber
+// speaking it comes up.
+class Message {
+public:
+  Message(const std::string *pattern, const std::string &channel,
+          const std::string &payload)
+      : pattern_(pattern), channel_(channel), payload_(payload) {}
+
+  const SharedBuffer &encoded(Protocol proto) {
+    SharedBuffer &buf = bufs_[(int)proto];
+    if (!buf) {
+      auto bytes = std::make_shared<std::vector<uint8_t>>();
+      Response out(*bytes, proto);
+      out.out_push(pattern_ ? 4 : 3);
+      out.out_str(pattern_ ? "pmessage" : "message");
+      if (pattern_) {
+        out.out_str(*pattern_);
+      }
+      out.out_str(channel_);
+      out.out_str(payload_);
+      out.build();
+      buf = std::move(bytes);
+    }
+    return buf;
+  }
+
+private:
+  const std::string *pattern_;
+  const std::string &channel_;
+  const std::string &payload_;
+  SharedBuffer bufs_[3]; // by Protocol
+};
+
+struct Ack {
+  const char *kind;
+  const std::string *name; // nullptr when there was nothing to unsubscribe
+  size_t count;
+};
+} // namespace
+
+// the part of `pattern` before the first wildcard or escape
+static std::string literal_prefix(const std::string &pattern) {
+  return pattern.substr(0, pattern.find_first_of("*?[\\"));
+}
+
+bool PubSub::is_command(const char *name) {
+  return strcmp(name, "subscribe") == 0 || strcmp(name, "unsubscribe") == 0 ||
+         strcmp(name, "psubscribe") == 0 ||
+         strcmp(name, "punsubscribe") == 0;
+}
+
+void PubSub::command(Connection *conn, const char *name,
+                     const std::vector<std::string> &cmd) {
+  bool pattern = name[0] == 'p';
+  bool sub = strcmp(name + pattern, "subscribe") == 0;
+  Subscriptions &subs = subs_[conn];
+  std::vector<std::string> names(cmd.begin() + 1, cmd.end());
+  if (!sub && names.empty()) {
+    // everything
+    const auto &all = pattern ? subs.patterns : subs.channels;
+    names.assign(all.begin(), all.end());
+  }
+  auto reply = [](Response &out, void *arg) {
+    Ack &ack = *(Ack *)arg;
+    out.out_push(3);
+    out.out_str(ack.kind);
+    if (ack.name) {
+      out.out_str(*ack.name);
+    } else {
+      out.out_nil();
+    }
+    out.out_int(ack.count);
+  };
+  if (names.empty()) {
+    Ack ack = {name, nullptr, subs.size()};
+    conn->reply(reply, &ack);
+  }
+  for (const std::string &n : names) {
+    if (sub && pattern) {
+      psubscribe(conn, subs, n);
+    } else if (sub) {
+      subscribe(conn, subs, n);
+    } else if (pattern) {
+      punsubscribe(conn, subs, n);
+    } else {
+      unsubscribe(conn, subs, n);
+    }
+    Ack ack = {name, &n, subs.size()};
+    conn->reply(reply, &ack);
+  }
+  conn->set_subscribed(subs.size() > 0);
+  if (subs.size() == 0) {
+    subs_.erase(conn);
+  }
+}
+
+void PubSub::subscribe(Connection *conn, Subscriptions &subs,
+                       const std::string &channel) {
+  if (subs.channels.insert(channel).second) {
+    channels_[channel].insert(conn);
+  }
+}
+
+void PubSub::unsubscribe(Connection *conn, Subscriptions &subs,
+                         const std::string &channel) {
+  if (subs.channels.erase(channel) == 0) {
+    return;
+  }
+  auto it = channels_.find(channel);
+  it->second.erase(conn);
+  if (it->second.empty()) {
+    channels_.erase(it);
+  }
+}
+
+void PubSub::psubscribe(Connection *conn, Subscriptions &subs,
+                        const std::string &pattern) {
+  if (!subs.patterns.insert(pattern).second) {
+    return;
+  }
+  auto it = patterns_.find(pattern);
+  if (it == patterns_.end()) {
+    it = patterns_.emplace(pattern, Pattern()).first;
+    Pattern &p = it->second;
+    p.pattern = pattern;
+    p.prefix = literal_prefix(pattern);
+    by_prefix_[p.prefix].push_back(&p);
+    prefix_lens_[p.prefix.size()]++;
+  }
+  it->second.subscribers.insert(conn);
+}
+
+void PubSub::punsubscribe(Connection *conn, Subscriptions &subs,
+                          const std::string &pattern) {
+  if (subs.patterns.erase(pattern) == 0) {
+    return;
+  }
+  auto it = patterns_.find(pattern);
+  Pattern &p = it->second;
+  p.subscribers.erase(conn);
+  if (!p.subscribers.empty()) {
+    return;
+  }
+  auto group = by_prefix_.find(p.prefix);
+  std::vector<Pattern *> &same = group->second;
+  same.erase(std::find(same.begin(), same.end(), &p));
+  if (same.empty()) {
+    by_prefix_.erase(group);
+  }
+  auto len = prefix_lens_.find(p.prefix.size());
+  if (--len->second == 0) {
+    prefix_lens_.erase(len);
+  }
+  patterns_.erase(it);
+}
+
+int64_t PubSub::publish(const std::string &channel,
+                        const std::string &message) {
+  int64_t n = 0;
+  auto it = channels_.find(channel);
+  if (it != channels_.end()) {
+    Message msg(nullptr, channel, message);
+    for (Connection *conn : it->second) {
+      conn->append_shared(msg.encoded(conn->protocol()));
+      n++;
+    }
+  }
+  std::string prefix;
+  for (const auto &len : prefix_lens_) {
+    if (len.first > channel.size()) {
+      break;
+    }
+    prefix.assign(channel, 0, len.first);
+    auto group = by_prefix_.find(prefix);
+    if (group == by_prefix_.end()) {
+      continue;
+    }
+    for (Pattern *p : group->second) {
+      if (!glob_match(p->pattern.data(), p->pattern.size(), channel.data(),
+                      channel.size())) {
+        continue;
+      }
+      Message msg(&p->pattern, channel, message);
+      for (Connection *conn : p->subscribers) {
+        conn->append_shared(msg.encoded(conn->protocol()));
+        n++;
+      }
+    }
+  }
+  return n;
+}
+
+void PubSub::forget(Connection *conn) {
+  auto it = subs_.find(conn);
+  if (it == subs_.end()) {
+    return;
+  }
+  Subscriptions &subs = it->second;
+  std::vector<std::string> names(subs.channels.begin(), subs.channels.end());
+  for (const std::string &n : names) {
+    unsubscribe(conn, subs, n);
+  }
+  names.assign(subs.patterns.begin(), subs.patterns.end());
+  for (const std::string &n : names) {
+    punsubscribe(conn, subs, n);
+  }
+  subs_.erase(it);
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+class Connection;
+
+// Pub/sub. SUBSCRIBE and PSUBSCRIBE put a connection in the subscribers of
+// a channel or a glob-style pattern, and PUBLISH sends a message to every
+// subscriber of the channel and of each matching pattern.
+//
+// A message is encoded once per protocol in use, into a buffer that the
+// output of every subscriber references rather than copies (see
+// Connection::append_shared()), so a publish to thousands of subscribers
+// costs a pointer each, not the message each. Patterns are indexed by their
+// literal prefix, the part before the first wildcard, and a publish only
+// matches the patterns whose prefix begins the channel name.
+class PubSub {
+public:
+  // whether `name`, a command name, is (un)subscribing, which the
+  // connection runs through command()
+  static bool is_command(const char *name);
+  // `[p]subscribe name...` or `[p]unsubscribe [name...]`, with one reply per
+  // name: [kind, name, number of subscriptions left]
+  void command(Connection *conn, const char *name,
+               const std::vector<std::string> &cmd);
+  // the number of subscribers the message was queued on
+  int64_t publish(const std::string &channel, const std::string &message);
+  // `conn` is going away
+  void forget(Connection *conn);
+
+private:
+  struct Pattern {
+    std::string pattern;
+    std::string prefix;
+    std::unordered_set<Connection *> subscribers;
+  };
+  // what one connection is subscribed to
+  struct Subscriptions {
+    std::unordered_set<std::string> channels;
+    std::unordered_set<std::string> patterns;
+    size_t size() const { return channels.size() + patterns.size(); }
+  };
+
+  std::unordered_map<std::string, std::unordered_set<Connection *>>
+      channels_;
+  std::unordered_map<std::string, Pattern> patterns_;
+  // the patterns by literal prefix, and how many prefixes are of each
+  // length: a channel is only looked up at those lengths
+  std::unordered_map<std::string, std::vector<Pattern *>> by_prefix_;
+  std::map<size_t, size_t> prefix_lens_;
+  std::unordered_map<Connection *, Subscriptions> subs_;
+
+  void subscribe(Connection *conn, Subscriptions &subs,
+                 const std::string &channel);
+  void unsubscribe(Connection *conn, Subscriptions &subs,
+                   const std::string &channel);
+  void psubscribe(Connection *conn, Subscriptions &subs,
+                  const std::string &pattern);
+  void punsubscribe(Connection *conn, Subscriptions &subs,
+                    const std::string &pattern);
+};
@@ -0,0 +1,518 @@
+#include "replication.hpp"
+#include "global.hpp"
+#include "logger.hpp"
+#include "request.hpp"
+#include "utils.hpp"
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <random>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const uint64_t k_reconnect_ms = 1000;
+static const uint64_t k_ack_ms = 1000;
+static const uint64_t k_wait_bgsave_ms = 100;
+
+static std::string random_replid() {
+  static const char hex[] = "0123456789abcdef";
+  std::random_device rd;
+  std::mt19937_64 gen(((uint64_t)rd() << 32) | rd());
+  std::string id(40, '0');
+  for (char &c : id) {
+    c = hex[gen() & 0xf];
+  }
+  return id;
+}
+
+Replication::Replication() : replid_(random_replid()) {}
+
+void Replication::replicaof(const std::string &host, uint16_t port) {
+  if (host.empty()) {
+    if (!is_replica()) {
+      return;
+    }
+    link_close();
+    primary_host_.clear();
+    // our history now diverges from the old primary's
+    replid_ = random_replid();
+    backlog_histlen_ = 0;
+    LOG(INFO, "replication: now a primary at offset {}", offset_);
+    return;
+  }
+
+  // no chained replication: whoever replicates from us has to go
+  std::vector<Replica> replicas;
+  replicas.swap(replicas_);
+  for (Replica &r : replicas) {
+    r.conn->shutdown();
+  }
+  link_close();
+  if (host != primary_host_ || port != primary_port_) {
+    primary_replid_ = "?";
+  }
+  primary_host_ = host;
+  primary_port_ = port;
+  last_connect_ms_ = 0;
+  LOG(INFO, "replication: replicating from {}:{}", host, port);
+}
+
+void Replication::feed(const uint8_t *data, size_t len) {
+  if (is_replica()) {
+    return;
+  }
+  offset_ += len;
+  if (backlog_.empty()) {
+    return;
+  }
+
+  // keep the tail of the stream in the circular backlog
+  const uint8_t *p = data;
+  size_t n = len;
+  if (n > backlog_.size()) {
+    p += n - backlog_.size();
+    n = backlog_.size();
+  }
+  while (n > 0) {
+    size_t chunk = std::min(n, backlog_.size() - backlog_idx_);
+    memcpy(backlog_.data() + backlog_idx_, p, chunk);
+    backlog_idx_ = (backlog_idx_ + chunk) % backlog_.size();
+    p += chunk;
+    n -= chunk;
+  }
+  backlog_histlen_ = std::min<uint64_t>(backlog_histlen_ + len, backlog_.size());
+
+  for (Replica &r : replicas_) {
+    if (r.state == ReplicaState::ONLINE) {
+      r.conn->append_output(data, len);
+    } else if (r.state == ReplicaState::WAIT_BGSAVE_END) {
+      r.pending.insert(r.pending.end(), data, data + len);
+      uint64_t limit = GlobalState::config().replica_output_hard_limit;
+      if (limit > 0 && r.pending.size() > limit) {
+        LOG(WARNING, "replication: replica fd {} fell {} bytes behind during "
+                     "the snapshot, closing it",
+            r.conn->fd(), r.pending.size());
+        r.conn->shutdown();
+      }
+    }
+  }
+}
+
+bool Replication::backlog_copy(uint64_t from, std::vector<uint8_t> &out) const {
+  if (from > offset_ || offset_ - from > backlog_histlen_) {
+    return false;
+  }
+  size_t n = offset_ - from;
+  size_t size = backlog_.size();
+  size_t start = (backlog_idx_ + size - n) % size;
+  size_t first = std::min(n, size - start);
+  out.insert(out.end(), backlog_.data() + start, backlog_.data() + start + first);
+  out.insert(out.end(), backlog_.data(), backlog_.data() + (n - first));
+  return true;
+}
+
+static void send_reply(Connection *conn, const char *kind,
+                       const std::string &replid, uint64_t offset) {
+  std::vector<uint8_t> buf;
+  Response resp(buf);
+  resp.out_arrary(3);
+  resp.out_str(kind);
+  resp.out_str(replid);
+  resp.out_int((int64_t)offset);
+  resp.build();
+  conn->append_output(buf.data(), buf.size());
+}
+
+void Replication::psync(Connection *conn, const std::vector<std::string> &cmd) {
+  char *endp = NULL;
+  int64_t from = strtoll(cmd[2].c_str(), &endp, 10);
+  if (is_replica() || endp != cmd[2].c_str() + cmd[2].size()) {
+    std::vector<uint8_t> buf;
+    Response resp(buf);
+    resp.out_err(ERR_UNKNOWN, is_replica() ? "not a primary" : "expect int");
+    resp.build();
+    conn->append_output(buf.data(), buf.size());
+    return;
+  }
+  if (backlog_.empty()) {
+    backlog_.resize(GlobalState::config().repl_backlog_size);
+    backlog_idx_ = 0;
+    backlog_histlen_ = 0;
+  }
+  conn->set_replica();
+
+  std::vector<uint8_t> missing;
+  if (cmd[1] == replid_ && from >= 0 && backlog_copy(from, missing)) {
+    LOG(INFO, "replication: replica fd {} continues from offset {}",
+        conn->fd(), from);
+    send_reply(conn, "continue", replid_, from);
+    conn->append_output(missing.data(), missing.size());
+    replicas_.push_back(Replica{conn, ReplicaState::ONLINE, (uint64_t)from, {}});
+    return;
+  }
+
+  LOG(INFO, "replication: full resync for replica fd {}", conn->fd());
+  replicas_.push_back(Replica{conn, ReplicaState::WAIT_BGSAVE_START, 0, {}});
+  if (!GlobalState::child_running()) {
+    start_replica_bgsave();
+  }
+}
+
+void Replication::start_replica_bgsave() {
+  if (!GlobalState::snapshot().start_bgsave(GlobalState::config().dbfilename)) {
+    return; // retried from cron()
+  }
+  // the snapshot holds everything up to `offset_`; what comes after is
+  // collected in `pending`
+  for (Replica &r : replicas_) {
+    if (r.state == ReplicaState::WAIT_BGSAVE_START) {
+      send_reply(r.conn, "fullresync", replid_, offset_);
+      r.state = ReplicaState::WAIT_BGSAVE_END;
+    }
+  }
+}
+
+void Replication::send_snapshot(Replica &replica, int fd, uint64_t size) {
+  replica.conn->append_output((const uint8_t *)&size, sizeof(size));
+  replica.conn->send_file(fd, size);
+  replica.conn->append_output(replica.pending.data(), replica.pending.size());
+  std::vector<uint8_t>().swap(replica.pending);
+  replica.state = ReplicaState::ONLINE;
+}
+
+void Replication::bgsave_done(bool ok) {
+  const std::string &path = GlobalState::config().dbfilename;
+  for (Replica &r : replicas_) {
+    if (r.state != ReplicaState::WAIT_BGSAVE_END) {
+      continue;
+    }
+    int fd = ok ? open(path.c_str(), O_RDONLY) : -1;
+    struct stat st = {};
+    if (fd < 0 || fstat(fd, &st) < 0) {
+      LOG(ERROR, "replication: no snapshot for replica fd {}", r.conn->fd());
+      if (fd >= 0) {
+        close(fd);
+      }
+      r.conn->shutdown();
+      continue;
+    }
+    send_snapshot(r, fd, st.st_size);
+  }
+}
+
+void Replication::replica_request(Connection *conn,
+                                  const std::vector<std::string> &cmd) {
+  if (cmd.size() != 3 || cmd[0] != "replconf" || cmd[1] != "ack") {
+    return;
+  }
+  for (Replica &r : replicas_) {
+    if (r.conn == conn) {
+      r.ack_offset = strtoull(cmd[2].c_str(), NULL, 10);
+    }
+  }
+}
+
+void Replication::detach(Connection *conn) {
+  for (size_t i = 0; i < replicas_.size(); i++) {
+    if (replicas_[i].conn == conn) {
+      replicas_.erase(replicas_.begin() + i);
+      return;
+    }
+  }
+}
+
+void Replication::cron() {
+  if (!GlobalState::child_running()) {
+    for (const Replica &r : replicas_) {
+      if (r.state == ReplicaState::WAIT_BGSAVE_START) {
+        start_replica_bgsave();
+        break;
+      }
+    }
+  }
+
+  if (!is_replica()) {
+    return;
+  }
+  uint64_t now = get_monotonic_msec();
+  if (link_state_ == LinkState::NONE &&
+      now - last_connect_ms_ >= k_reconnect_ms) {
+    last_connect_ms_ = now;
+    link_connect();
+  } else if (link_state_ == LinkState::STREAMING &&
+             now - last_ack_ms_ >= k_ack_ms) {
+    last_ack_ms_ = now;
+    link_send({"replconf", "ack", std::to_string(offset_)});
+    if (!link_flush()) {
+      link_close();
+    }
+  }
+}
+
+int64_t Replication::next_cron_ms() const {
+  for (const Replica &r : replicas_) {
+    if (r.state == ReplicaState::WAIT_BGSAVE_START) {
+      return k_wait_bgsave_ms;
+    }
+  }
+  return is_replica() ? std::min(k_reconnect_ms, k_ack_ms) : -1;
+}
+
+void Replication::role(Response &out) const {
+  if (!is_replica()) {
+    out.out_arrary(4);
+    out.out_str("primary");
+    out.out_str(replid_);
+    out.out_int((int64_t)offset_);
+    out.out_int((int64_t)replicas_.size());
+    return;
+  }
+  static const char *states[] = {"none", "connecting", "handshake",
+                                 "transfer", "streaming"};
+  out.out_arrary(5);
+  out.out_str("replica");
+  out.out_str(primary_host_);
+  out.out_int(primary_port_);
+  out.out_str(states[(int)link_state_]);
+  out.out_int((int64_t)offset_);
+}
+
+bool Replication::link_pollfd(struct pollfd &pfd) const {
+  if (link_fd_ == -1) {
+    return false;
+  }
+  pfd.fd = link_fd_;
+  pfd.events = POLLERR;
+  pfd.revents = 0;
+  if (link_state_ == LinkState::CONNECTING || !link_out_.empty()) {
+    pfd.events |= POLLOUT;
+  }
+  if (link_state_ != LinkState::CONNECTING) {
+    pfd.events |= POLLIN;
+  }
+  return true;
+}
+
+void Replication::link_connect() {
+  struct addrinfo hints = {};
+  struct addrinfo *res = NULL;
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  std::string port = std::to_string(primary_port_);
+  if (getaddrinfo(primary_host_.c_str(), port.c_str(), &hints, &res) != 0 ||
+      res == NULL) {
+    LOG(ERROR, "replication: can't resolve {}", primary_host_);
+    return;
+  }
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
+    freeaddrinfo(res);
+    LOG(ERROR, "replication: socket failed: {}", strerror(errno));
+    return;
+  }
+  fd_set_nb(fd);
+  int rv = connect(fd, res->ai_addr, res->ai_addrlen);
+  freeaddrinfo(res);
+  if (rv < 0 && errno != EINPROGRESS) {
+    LOG(ERROR, "replication: connect failed: {}", strerror(errno));
+    close(fd);
+    return;
+  }
+  link_fd_ = fd;
+  link_state_ = LinkState::CONNECTING;
+}
+
+void Replication::link_close() {
+  if (link_fd_ != -1) {
+    close(link_fd_);
+    link_fd_ = -1;
+  }
+  if (transfer_fd_ != -1) {
+    close(transfer_fd_);
+    transfer_fd_ = -1;
+  }
+  link_in_.clear();
+  link_out_.clear();
+  link_state_ = LinkState::NONE;
+}
+
+void Replication::link_send(const std::vector<std::string> &cmd) {
+  encode_request(cmd, link_out_);
+}
+
+bool Replication::link_flush() {
+  while (!link_out_.empty()) {
+    ssize_t rv = write(link_fd_, link_out_.data(), link_out_.size());
+    if (rv < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return errno == EAGAIN;
+    }
+    link_out_.erase(link_out_.begin(), link_out_.begin() + rv);
+  }
+  return true;
+}
+
+void Replication::handle_link(uint32_t revents) {
+  if (link_state_ == LinkState::CONNECTING) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    getsockopt(link_fd_, SOL_SOCKET, SO_ERROR, &err, &len);
+    if (err != 0) {
+      LOG(ERROR, "replication: connect to {}:{} failed: {}", primary_host_,
+          primary_port_, strerror(err));
+      return link_close();
+    }
+    // resume where we left off if the primary still has it
+    std::string from =
+        primary_replid_ == "?" ? "-1" : std::to_string(offset_);
+    link_send({"psync", primary_replid_, from});
+    link_state_ = LinkState::HANDSHAKE;
+    if (!link_flush()) {
+      link_close();
+    }
+    return;
+  }
+
+  if ((revents & POLLOUT) && !link_flush()) {
+    return link_close();
+  }
+  if (!(revents & (POLLIN | POLLERR | POLLHUP))) {
+    return;
+  }
+  const size_t k_chunk = 64 * 1024;
+  size_t old = link_in_.size();
+  link_in_.resize(old + k_chunk);
+  ssize_t rv = read(link_fd_, link_in_.data() + old, k_chunk);
+  link_in_.resize(old + (rv > 0 ? rv : 0));
+  if (rv < 0 && (errno == EAGAIN || errno == EINTR)) {
+    return;
+  }
+  if (rv <= 0) {
+    LOG(ERROR, "replication: lost the link to the primary");
+    return link_close();
+  }
+
+  bool ok = true;
+  if (link_state_ == LinkState::HANDSHAKE) {
+    ok = link_handshake();
+  }
+  if (ok && link_state_ == LinkState::TRANSFER) {
+    ok = link_transfer();
+  }
+  if (ok && link_state_ == LinkState::STREAMING) {
+    ok = link_stream();
+  }
+  if (!ok) {
+    link_close();
+  }
+}
+
+// parse the `[fullresync|continue, replid, offset]` reply to psync
+bool Replication::link_handshake() {
+  const uint8_t *p = link_in_.data();
+  const uint8_t *end = p + link_in_.size();
+  uint32_t len = 0;
+  if (!read_u32(p, end, len) || (size_t)(end - p) < len) {
+    return true; // need read more
+  }
+  ReplyView reply;
+  std::vector<ReplyView> parts;
+  if (decode_reply(p, len, reply) && reply.type == ResponseType::ARRAY) {
+    parts = reply.elements();
+  }
+  if (parts.size() != 3 || parts[0].type != ResponseType::STR ||
+      parts[1].type != ResponseType::STR ||
+      parts[2].type != ResponseType::INT) {
+    LOG(ERROR, "replication: primary refused psync");
+    return false;
+  }
+  std::string mode = parts[0].str.str();
+  primary_replid_ = parts[1].str.str();
+  offset_ = (uint64_t)parts[2].integer;
+  link_in_.erase(link_in_.begin(), link_in_.begin() + 4 + len);
+
+  if (mode == "continue") {
+    LOG(INFO, "replication: partial resync from offset {}", offset_);
+    link_state_ = LinkState::STREAMING;
+  } else {
+    LOG(INFO, "replication: full resync at offset {}", offset_);
+    link_state_ = LinkState::TRANSFER;
+    transfer_sized_ = false;
+  }
+  last_ack_ms_ = get_monotonic_msec();
+  return true;
+}
+
+// receive the u64 length and the snapshot into a temp file, then load it
+bool Replication::link_transfer() {
+  const std::string &path = GlobalState::config().dbfilename;
+  std::string tmp = path + ".repl.tmp";
+  if (!transfer_sized_) {
+    if (link_in_.size() < sizeof(uint64_t)) {
+      return true;
+    }
+    memcpy(&transfer_left_, link_in_.data(), sizeof(uint64_t));
+    link_in_.erase(link_in_.begin(), link_in_.begin() + sizeof(uint64_t));
+    transfer_fd_ = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (transfer_fd_ < 0) {
+      LOG(ERROR, "replication: open {} failed: {}", tmp, strerror(errno));
+      return false;
+    }
+    transfer_sized_ = true;
+  }
+
+  size_t n = std::min<uint64_t>(transfer_left_, link_in_.size());
+  if (!write_all(transfer_fd_, (const char *)link_in_.data(), n)) {
+    LOG(ERROR, "replication: write {} failed: {}", tmp, strerror(errno));
+    return false;
+  }
+  link_in_.erase(link_in_.begin(), link_in_.begin() + n);
+  transfer_left_ -= n;
+  if (transfer_left_ > 0) {
+    return true;
+  }
+
+  bool ok = fdatasync(transfer_fd_) == 0;
+  close(transfer_fd_);
+  transfer_fd_ = -1;
+  if (!ok || rename(tmp.c_str(), path.c_str()) < 0) {
+    LOG(ERROR, "replication: saving {} failed: {}", path, strerror(errno));
+    return false;
+  }
+  GlobalState::store().clear();
+  int64_t nkeys = GlobalState::snapshot().load(path);
+  if (nkeys < 0) {
+    return false;
+  }
+  LOG(INFO, "replication: loaded {} keys from the primary", nkeys);
+  link_state_ = LinkState::STREAMING;
+  return true;
+}
+
+// apply every complete command; the offset moves with each one
+bool Replication::link_stream() {
+  std::vector<uint8_t> sink;
+  size_t consumed = 0;
+  while (link_in_.size() - consumed >= 4) {
+    uint32_t len = 0;
+    memcpy(&len, link_in_.data() + consumed, 4);
+    if (link_in_.size() - consumed - 4 < len) {
+      break;
+    }
+    std::vector<std::string> cmd;
+    if (parse_request(link_in_.data() + consumed + 4, len, cmd) < 0) {
+      LOG(ERROR, "replication: bad command from the primary");
+      return false;
+    }
+    sink.clear();
+    Response resp(sink);
+    do_request(std::move(cmd), resp);
+    consumed += 4 + len;
+    offset_ += 4 + len;
+  }
+  link_in_.erase(link_in_.begin(), link_in_.begin() + consumed);
+  return true;
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <sys/poll.h>
+#include <vector>
+
+class Connection;
+class Response;
+
+// Replication streams the keyspace from a primary to any number of replicas.
+//
+// A replica connects and sends `psync <replid> <offset>`. If the primary's
+// backlog still holds everything from `offset` on, it answers
+// `[continue, replid, offset]` and resends the missing bytes. Otherwise it
+// answers `[fullresync, replid, offset]`, forks a BGSAVE, and sends the
+// snapshot as a u64 length followed by the file. Either way the rest of the
+// link carries the mutating commands in the request wire format, the same
+// bytes that go to the AOF. The replica sends `replconf ack <offset>` once a
+// second and never gets a reply on this link.
+class Replication {
+public:
+  Replication();
+
+  bool is_replica() const { return !primary_host_.empty(); }
+  // start replicating from `host:port`, or become a primary if `host` is
+  // empty
+  void replicaof(const std::string &host, uint16_t port);
+  // whether `feed()` needs to be called at all
+  bool has_backlog() const { return !backlog_.empty(); }
+  // a mutating command, already encoded, to stream to the replicas
+  void feed(const uint8_t *data, size_t len);
+
+  // primary side
+  void psync(Connection *conn, const std::vector<std::string> &cmd);
+  void replica_request(Connection *conn, const std::vector<std::string> &cmd);
+  void detach(Connection *conn);
+  void bgsave_done(bool ok);
+
+  // replica side: the link to the primary is polled with the connections
+  bool link_pollfd(struct pollfd &pfd) const;
+  void handle_link(uint32_t revents);
+
+  // called once per loop iteration
+  void cron();
+  // how soon `cron()` needs to run again, -1 if it is idle
+  int64_t next_cron_ms() const;
+  void role(Response &out) const;
+
+private:
+  enum class ReplicaState {
+    WAIT_BGSAVE_START, // needs a snapshot, but another child is running
+    WAIT_BGSAVE_END,   // the child writing its snapshot is running
+    ONLINE,            // snapshot queued, streaming commands
+  };
+  struct Replica {
+    Connection *conn;
+    ReplicaState state;
+    uint64_t ack_offset;
+    // commands that arrive while the snapshot is being written
+    std::vector<uint8_t> pending;
+  };
+  enum class LinkState {
+    NONE,
+    CONNECTING, // non-blocking connect() in progress
+    HANDSHAKE,  // psync sent, waiting for the reply
+    TRANSFER,   // receiving the snapshot
+    STREAMING,  // applying commands
+  };
+
+  std::string replid_;
+  uint64_t offset_ = 0; // replication offset of the next byte
+
+  // circular backlog of the most recent stream bytes, created when the first
+  // replica attaches
+  std::vector<uint8_t> backlog_;
+  size_t backlog_idx_ = 0;       // where the next byte goes
+  uint64_t backlog_histlen_ = 0; // valid bytes, up to backlog_.size()
+  std::vector<Replica> replicas_;
+
+  // link to our primary
+  std::string primary_host_;
+  uint16_t primary_port_ = 0;
+  LinkState link_state_ = LinkState::NONE;
+  int link_fd_ = -1;
+  std::vector<uint8_t> link_in_;
+  std::vector<uint8_t> link_out_;
+  std::string primary_replid_; // "?" until the first full sync
+  int transfer_fd_ = -1;
+  uint64_t transfer_left_ = 0;
+  bool transfer_sized_ = false;
+  uint64_t last_connect_ms_ = 0;
+  uint64_t last_ack_ms_ = 0;
+
+  bool backlog_copy(uint64_t from, std::vector<uint8_t> &out) const;
+  void start_replica_bgsave();
+  void send_snapshot(Replica &replica, int fd, uint64_t size);
+
+  void link_connect();
+  void link_close();
+  void link_send(const std::vector<std::string> &cmd);
+  bool link_flush();
+  bool link_handshake();
+  bool link_transfer();
+  bool link_stream();
+};
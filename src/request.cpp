@@ -1,143 +1,1187 @@
 #include "request.hpp"
+#include "bitmap.hpp"
+#include "bloom_type.hpp"
 #include "global.hpp"
+#include "hash_type.hpp"
+#include "hyperloglog.hpp"
+#include "list_type.hpp"
+#include "set_type.hpp"
 #include "utils.hpp"
 #include <cstdint>
+#include <strings.h>
 #include <vector>
 
-int parse_request(const uint8_t *data, size_t size,
-                  std::vector<std::string> &out) {
-  const uint8_t *end = data + size;
-  uint32_t nstr = 0;
-  if (!read_u32(data, end, nstr)) {
-    return -1;
+void propagate(const std::vector<std::string> &cmd) {
+  Replication &repl = GlobalState::replication();
+  if (!GlobalState::aof().enabled() && !repl.has_backlog()) {
+    return;
   }
-  while (out.size() < nstr) {
-    uint32_t len = 0;
-    if (!read_u32(data, end, len)) {
-      return -1;
-    }
-    if (data + len > end) {
-      return -1;
-    }
-    out.push_back(std::string(data, data + len));
-    data += len;
-  }
-  if (data != end) {
-    return -1;
-  }
-  return 0;
+  static std::vector<uint8_t> buf;
+  buf.clear();
+  encode_request(cmd, buf);
+  GlobalState::aof().append(buf.data(), buf.size());
+  repl.feed(buf.data(), buf.size());
 }
 
-static bool entry_eq(HashNode *a, HashNode *b) {
-  struct Entry *ea = container_of(a, struct Entry, node);
-  struct Entry *eb = container_of(b, struct Entry, node);
-  return ea->key == eb->key;
+static void out_wrongtype(Response &out) {
+  out.out_err(ERR_WRONGTYPE,
+              "Operation against a key holding the wrong kind of value");
 }
 
-uint64_t hash(const std::string value) {
-  uint32_t h = 0x811c9dc5;
-  for (char c : value) {
-    h = (h + c) * 0x01000193;
+// Find `key` for a command on values of `type`: `ent` is nullptr if there
+// is no such key. Returns false, with the error in `out`, if the key holds
+// another type.
+static bool lookup_typed(const std::string &key, ValueType type, Entry *&ent,
+                         Response &out) {
+  ent = GlobalState::store().lookup(key);
+  if (ent && ent->type != type) {
+    out_wrongtype(out);
+    return false;
   }
-  return h;
+  return true;
 }
 
-void do_get(const std::vector<std::string> &&cmd, Response &out) {
-  // a dummy `Entry` just for the lookup
-  Entry entry;
-  entry.key = std::move(cmd[1]);
-  entry.node.hcode = hash(entry.key);
-  // hashtable lookup
-  HashNode *node = GlobalState::db().lookup(&entry.node, entry_eq);
-  if (!node) {
-    return out.out_nil();
+void do_get(std::vector<std::string> &&cmd, Response &out) {
+  Entry *ent = nullptr;
+  if (!lookup_typed(cmd[1], ValueType::STRING, ent, out)) {
+    return;
   }
-  {
-    const std::string &value = container_of(node, Entry, node)->value;
-    return out.out_str(value);
+  if (!ent) {
+    return out.out_nil();
   }
+  return out.out_str(ent->value);
 }
 
 void do_set(std::vector<std::string> &&cmd, Response &out) {
-  Entry entry;
-  entry.key = std::move(cmd[1]);
-  entry.node.hcode = hash(entry.key);
-  HashNode *node = GlobalState::db().lookup(&entry.node, entry_eq);
-  if (node != nullptr) {
-    container_of(node, Entry, node)->value = std::move(cmd[2]);
-  } else {
-    // We should use `new` to allocate the memory for `Entry`
-    Entry *ent = new Entry;
-    ent->node.hcode = std::move(entry.node.hcode);
-    ent->key = std::move(entry.key);
-    ent->value = std::move(cmd[2]);
-    GlobalState::db().insert(&ent->node);
-  }
-  return out.out_nil();
-}
-
-void do_del(const std::vector<std::string> &&cmd, Response &out) {
-  Entry entry;
-  entry.key = cmd[1];
-  entry.node.hcode = hash(entry.key);
-  HashNode *node = GlobalState::db().remove(&entry.node, entry_eq);
-  if (node) {
-    delete container_of(node, Entry, node);
-    out.out_int(1);
-  } else {
-    out.out_int(0);
+  propagate(cmd);
+  GlobalState::store().set(std::move(cmd[1]), std::move(cmd[2]));
+  return out.out_ok();
+}
+
+void do_del(std::vector<std::string> &&cmd, Response &out) {
+  bool deleted = GlobalState::store().del(cmd[1]);
+  // a replica passes on its primary's DEL of an expired key, which del()
+  // does not count, so its AOF drops the key too
+  if (deleted || GlobalState::replication().is_replica()) {
+    propagate(cmd);
   }
+  out.out_int(deleted ? 1 : 0);
 }
 
-void do_keys(const std::vector<std::string> &&cmd, Response &out) {
-  auto callback_keys = [](HashNode *node, void *arg) {
-    Response &out = *(Response *)arg;
-    const std::string &key = container_of(node, Entry, node)->key;
-    out.out_str(key);
+void do_keys(std::vector<std::string> &&cmd, Response &out) {
+  auto callback_keys = [](Entry *ent, void *arg) {
+    auto &keys = *(std::vector<const std::string *> *)arg;
+    keys.push_back(&ent->key);
     return true;
   };
 
-  out.out_arrary(GlobalState::db().size());
-  GlobalState::db().foreach (callback_keys, reinterpret_cast<void *>(&out));
+  std::vector<const std::string *> keys;
+  keys.reserve(GlobalState::store().size());
+  GlobalState::store().foreach (callback_keys, &keys);
+  out.out_bulk_array(keys.data(), keys.size());
 }
 
-static bool str2int(const std::string &s, int32_t &out) {
+void do_mget(std::vector<std::string> &&cmd, Response &out) {
+  std::vector<const std::string *> values(cmd.size() - 1);
+  for (size_t i = 1; i < cmd.size(); i++) {
+    values[i - 1] = GlobalState::store().get(cmd[i]);
+  }
+  out.out_bulk_array(values.data(), values.size());
+}
+
+static bool str2int(const std::string &s, int64_t &out) {
   char *endp = NULL;
   out = strtoll(s.c_str(), &endp, 10);
   return endp == s.c_str() + s.size();
 }
 
-void do_expire(const std::vector<std::string> &&cmd, Response &out) {
-  int32_t ttl_ms = 0;
-  if (!str2int(cmd[2], ttl_ms)) {
-    return out.out_err(ERR_BAD_ARG, "expect int");
+// `scan cursor [count n]`: the next cursor and a batch of keys
+void do_scan(std::vector<std::string> &&cmd, Response &out) {
+  int64_t cursor = 0;
+  int64_t count = 10;
+  if (!str2int(cmd[1], cursor) || cursor < 0) {
+    return out.out_err(ERR_BAD_ARG, "invalid cursor");
+  }
+  if (cmd.size() == 4 && strcasecmp(cmd[2].c_str(), "count") == 0) {
+    if (!str2int(cmd[3], count) || count <= 0) {
+      return out.out_err(ERR_BAD_ARG, "expect positive int");
+    }
+  } else if (cmd.size() != 2) {
+    return out.out_err(ERR_BAD_ARG, "syntax error");
+  }
+  std::vector<std::string> keys;
+  std::string next = std::to_string(
+      GlobalState::store().scan((uint64_t)cursor, (size_t)count, keys));
+  std::vector<const std::string *> items(keys.size());
+  for (size_t i = 0; i < keys.size(); i++) {
+    items[i] = &keys[i];
+  }
+  // sized as a whole, so it is all there or an error
+  size_t keys_size = out.bulk_array_size(items.data(), items.size());
+  size_t total = out.array_size(2) + out.str_size(next.size()) + keys_size;
+  if (!out.fits(total)) {
+    return out.out_err(ERR_TOO_BIG, "response size too big");
   }
-  Entry entry;
-  entry.key = std::move(cmd[1]);
-  entry.node.hcode = hash(entry.key);
+  out.reserve(total);
+  out.out_arrary(2);
+  out.out_str(next);
+  out.out_bulk_array(items.data(), items.size());
+}
 
-  HashNode *node = GlobalState::db().lookup(&entry.node, &entry_eq);
-  if (node) {
-    Entry *ent = container_of(node, Entry, node);
-    ent->set_ttl(ttl_ms);
+// Set the TTL of the key in `cmd[1]`. The AOF and the replicas always get the
+// absolute wall-clock `deadline`, so replaying it later does not extend the
+// TTL.
+static void expire_key(const std::vector<std::string> &cmd, int64_t ttl_ms,
+                       int64_t deadline, Response &out) {
+  KeyStore &store = GlobalState::store();
+  // an expired key is gone, not to be revived; but a replica takes its
+  // primary's word for it, whatever its own clock says
+  Entry *ent = GlobalState::replication().is_replica() ? store.find(cmd[1])
+                                                       : store.lookup(cmd[1]);
+  if (ent) {
+    store.set_ttl(ent, ttl_ms);
+    propagate({"pexpireat", ent->key, std::to_string(deadline)});
+    if (ent->type != ValueType::STRING) {
+      return out.out_int(1);
+    }
     return out.out_str(ent->value);
   } else {
     return out.out_nil();
   }
 }
 
-void do_request(std::vector<std::string> &&cmd, Response &out) {
-  if (cmd.size() == 2 && cmd[0] == "get") {
-    do_get(std::move(cmd), out);
-  } else if (cmd.size() == 3 && cmd[0] == "set") {
-    do_set(std::move(cmd), out);
-  } else if (cmd.size() == 2 && cmd[0] == "del") {
-    do_del(std::move(cmd), out);
-  } else if (cmd.size() == 1 && cmd[0] == "keys") {
-    do_keys(std::move(cmd), out);
-  } else if (cmd.size() == 3 && cmd[0] == "pexpire") {
-    return do_expire(std::move(cmd), out);
+void do_expire(std::vector<std::string> &&cmd, Response &out) {
+  int64_t ttl_ms = 0;
+  if (!str2int(cmd[2], ttl_ms) || ttl_ms < 0) {
+    return out.out_err(ERR_BAD_ARG, "expect int");
+  }
+  expire_key(cmd, ttl_ms, get_realtime_msec() + ttl_ms, out);
+}
+
+void do_expireat(std::vector<std::string> &&cmd, Response &out) {
+  int64_t deadline = 0;
+  if (!str2int(cmd[2], deadline)) {
+    return out.out_err(ERR_BAD_ARG, "expect int");
+  }
+  int64_t ttl_ms = deadline - (int64_t)get_realtime_msec();
+  expire_key(cmd, ttl_ms < 0 ? 0 : ttl_ms, deadline, out);
+}
+
+// `hset key field value [field value...]`: the number of new fields
+void do_hset(std::vector<std::string> &&cmd, Response &out) {
+  if (cmd.size() % 2 != 0) {
+    return out.out_err(ERR_BAD_ARG, "wrong number of arguments");
+  }
+  Entry *ent = nullptr;
+  if (!lookup_typed(cmd[1], ValueType::HASH, ent, out)) {
+    return;
+  }
+  KeyStore &store = GlobalState::store();
+  propagate(cmd);
+  if (!ent) {
+    ent = store.add(cmd[1], ValueType::HASH);
+  }
+  int64_t added = 0;
+  for (size_t i = 2; i < cmd.size(); i += 2) {
+    added += hash_set(ent, cmd[i], cmd[i + 1], store.limits());
+  }
+  out.out_int(added);
+}
+
+void do_hget(std::vector<std::string> &&cmd, Response &out) {
+  Entry *ent = nullptr;
+  if (!lookup_typed(cmd[1], ValueType::HASH, ent, out)) {
+    return;
+  }
+  std::string value;
+  if (!ent || !hash_get(ent, cmd[2], value)) {
+    return out.out_nil();
+  }
+  out.out_str(value);
+}
+
+// `hdel key field...`: the number of fields removed
+void do_hdel(std::vector<std::string> &&cmd, Response &out) {
+  Entry *ent = nullptr;
+  if (!lookup_typed(cmd[1], ValueType::HASH, ent, out)) {
+    return;
+  }
+  int64_t removed = 0;
+  for (size_t i = 2; ent && i < cmd.size(); i++) {
+    removed += hash_del(ent, cmd[i]);
+  }
+  if (removed > 0) {
+    propagate(cmd);
+    if (hash_len(ent) == 0) {
+      GlobalState::store().del(cmd[1]);
+    }
+  }
+  out.out_int(removed);
+}
+
+void do_hlen(std::vector<std::string> &&cmd, Response &out) {
+  Entry *ent = nullptr;
+  if (!lookup_typed(cmd[1], ValueType::HASH, ent, out)) {
+    return;
+  }
+  out.out_int(ent ? hash_len(ent) : 0);
+}
+
+void do_hgetall(std::vector<std::string> &&cmd, Response &out) {
+  Entry *ent = nullptr;
+  if (!lookup_typed(cmd[1], ValueType::HASH, ent, out)) {
+    return;
+  }
+  if (!ent) {
+    return out.out_map(0);
+  }
+  // sized first, as SCAN is, so too big a hash is an error before anything
+  // is encoded; one with too many fields to fit even empty is not walked
+  size_t n = hash_len(ent);
+  if (!out.fits(2 * n * out.str_size(0))) {
+    return out.out_err(ERR_TOO_BIG, "response size too big");
+  }
+  struct Sizing {
+    const Response *out;
+    size_t total;
+  };
+  Sizing sizing = {&out, out.map_size(n)};
+  auto size_callback = [](StrView field, StrView value, void *arg) {
+    Sizing &sizing = *(Sizing *)arg;
+    sizing.total +=
+        sizing.out->str_size(field.size) + sizing.out->str_size(value.size);
+  };
+  hash_foreach(ent, size_callback, &sizing);
+  if (!out.fits(sizing.total)) {
+    return out.out_err(ERR_TOO_BIG, "response size too big");
+  }
+  out.reserve(sizing.total);
+  out.out_map(n);
+  auto callback = [](StrView field, StrView value, void *arg) {
+    Response &out = *(Response *)arg;
+    out.out_str(field.data, field.size);
+    out.out_str(value.data, value.size);
+  };
+  hash_foreach(ent, callback, &out);
+}
+
+// `hincrby key field n`: the new value. It goes to the AOF and the replicas
+// as an HSET of that value.
+void do_hincrby(std::vector<std::string> &&cmd, Response &out) {
+  int64_t incr = 0;
+  if (!str2int(cmd[3], incr)) {
+    return out.out_err(ERR_BAD_ARG, "expect int");
+  }
+  Entry *ent = nullptr;
+  if (!lookup_typed(cmd[1], ValueType::HASH, ent, out)) {
+    return;
+  }
+  KeyStore &store = GlobalState::store();
+  int64_t value = 0;
+  std::string old;
+  if (ent && hash_get(ent, cmd[2], old) && !str2int(old, value)) {
+    return out.out_err(ERR_BAD_ARG, "hash value is not an integer");
+  }
+  if ((incr > 0 && value > INT64_MAX - incr) ||
+      (incr < 0 && value < INT64_MIN - incr)) {
+    return out.out_err(ERR_BAD_ARG, "increment or decrement would overflow");
+  }
+  value += incr;
+  std::string str = std::to_string(value);
+  propagate({"hset", cmd[1], cmd[2], str});
+  if (!ent) {
+    ent = store.add(cmd[1], ValueType::HASH);
+  }
+  hash_set(ent, cmd[2], str, store.limits());
+  out.out_int(value);
+}
+
+// `lpush|rpush key element...`: the length of the list after the push
+static void push(std::vector<std::string> &cmd, bool front, Response &out) {
+  Entry *ent = nullptr;
+  if (!lookup_typed(cmd[1], ValueType::LIST, ent, out)) {
+    return;
+  }
+  propagate(cmd);
+  if (!ent) {
+    ent = GlobalState::store().add(cmd[1], ValueType::LIST);
+  }
+  Quicklist *list = list_of(ent);
+  for (size_t i = 2; i < cmd.size(); i++) {
+    if (front) {
+      list->push_front(cmd[i].data(), cmd[i].size());
+    } else {
+      list->push_back(cmd[i].data(), cmd[i].size());
+    }
+  }
+  out.out_int(list->size());
+  // clients in BLPOP/BRPOP may take some of it right away
+  GlobalState::blocking().wake(cmd[1]);
+}
+
+void do_lpush(std::vector<std::string> &&cmd, Response &out) {
+  push(cmd, true, out);
+}
+
+void do_rpush(std::vector<std::string> &&cmd, Response &out) {
+  push(cmd, false, out);
+}
+
+// `lpop|rpop key [count]`: one element, or an array of up to `count`
+static void pop(std::vector<std::string> &cmd, bool front, Response &out) {
+  int64_t count = 1;
+  if (cmd.size() > 3) {
+    return out.out_err(ERR_BAD_ARG, "wrong number of arguments");
+  }
+  if (cmd.size() == 3 && (!str2int(cmd[2], count) || count < 0)) {
+    return out.out_err(ERR_BAD_ARG, "expect non-negative int");
+  }
+  Entry *ent = nullptr;
+  if (!lookup_typed(cmd[1], ValueType::LIST, ent, out)) {
+    return;
+  }
+  if (!ent) {
+    return out.out_nil();
+  }
+  Quicklist *list = list_of(ent);
+  size_t n = std::min((size_t)count, list->size());
+  if (cmd.size() == 3) {
+    out.out_arrary(n);
+  }
+  std::string elem;
+  for (size_t i = 0; i < n; i++) {
+    if (front) {
+      list->pop_front(elem);
+    } else {
+      list->pop_back(elem);
+    }
+    out.out_str(elem);
+  }
+  if (n > 0) {
+    propagate(cmd);
+  }
+  if (list->size() == 0) {
+    GlobalState::store().del(cmd[1]);
+  }
+}
+
+void do_lpop(std::vector<std::string> &&cmd, Response &out) {
+  pop(cmd, true, out);
+}
+
+void do_rpop(std::vector<std::string> &&cmd, Response &out) {
+  pop(cmd, false, out);
+}
+
+// `lrange key start stop`, both inclusive; negative indices count from the
+// end
+void do_lrange(std::vector<std::string> &&cmd, Response &out) {
+  int64_t start = 0;
+  int64_t stop = 0;
+  if (!str2int(cmd[2], start) || !str2int(cmd[3], stop)) {
+    return out.out_err(ERR_BAD_ARG, "expect int");
+  }
+  Entry *ent = nullptr;
+  if (!lookup_typed(cmd[1], ValueType::LIST, ent, out)) {
+    return;
+  }
+  int64_t len = ent ? (int64_t)list_of(ent)->size() : 0;
+  start = start < 0 ? std::max<int64_t>(len + start, 0) : start;
+  stop = stop < 0 ? len + stop : std::min(stop, len - 1);
+  if (start > stop) {
+    return out.out_arrary(0);
+  }
+  // sized first, as SCAN is, so too big a range is an error before anything
+  // is encoded; one with too many elements to fit even empty is not walked
+  size_t n = stop - start + 1;
+  if (!out.fits(n * out.str_size(0))) {
+    return out.out_err(ERR_TOO_BIG, "response size too big");
+  }
+  struct Sizing {
+    const Response *out;
+    size_t total;
+  };
+  Sizing sizing = {&out, out.array_size(n)};
+  auto size_callback = [](StrView elem, void *arg) {
+    Sizing &sizing = *(Sizing *)arg;
+    sizing.total += sizing.out->str_size(elem.size);
+  };
+  list_of(ent)->range(start, n, size_callback, &sizing);
+  if (!out.fits(sizing.total)) {
+    return out.out_err(ERR_TOO_BIG, "response size too big");
+  }
+  out.reserve(sizing.total);
+  out.out_arrary(n);
+  auto callback = [](StrView elem, void *arg) {
+    ((Response *)arg)->out_str(elem.data, elem.size);
+  };
+  list_of(ent)->range(start, n, callback, &out);
+}
+
+void do_llen(std::vector<std::string> &&cmd, Response &out) {
+  Entry *ent = nullptr;
+  if (!lookup_typed(cmd[1], ValueType::LIST, ent, out)) {
+    return;
+  }
+  out.out_int(ent ? list_of(ent)->size() : 0);
+}
+
+// `sadd key member...`: the number of new members
+void do_sadd(std::vector<std::string> &&cmd, Response &out) {
+  Entry *ent = nullptr;
+  if (!lookup_typed(cmd[1], ValueType::SET, ent, out)) {
+    return;
+  }
+  KeyStore &store = GlobalState::store();
+  if (!ent) {
+    ent = store.add(cmd[1], ValueType::SET);
+  }
+  int64_t added = 0;
+  for (size_t i = 2; i < cmd.size(); i++) {
+    added += set_add(ent, cmd[i], store.limits());
+  }
+  if (added > 0) {
+    propagate(cmd);
+  }
+  out.out_int(added);
+}
+
+// `srem key member...`: the number of members removed
+void do_srem(std::vector<std::string> &&cmd, Response &out) {
+  Entry *ent = nullptr;
+  if (!lookup_typed(cmd[1], ValueType::SET, ent, out)) {
+    return;
+  }
+  int64_t removed = 0;
+  for (size_t i = 2; ent && i < cmd.size(); i++) {
+    removed += set_del(ent, cmd[i]);
+  }
+  if (removed > 0) {
+    propagate(cmd);
+    if (set_size(ent) == 0) {
+      GlobalState::store().del(cmd[1]);
+    }
+  }
+  out.out_int(removed);
+}
+
+void do_sismember(std::vector<std::string> &&cmd, Response &out) {
+  Entry *ent = nullptr;
+  if (!lookup_typed(cmd[1], ValueType::SET, ent, out)) {
+    return;
+  }
+  out.out_int(ent && set_contains(ent, cmd[2]) ? 1 : 0);
+}
+
+void do_scard(std::vector<std::string> &&cmd, Response &out) {
+  Entry *ent = nullptr;
+  if (!lookup_typed(cmd[1], ValueType::SET, ent, out)) {
+    return;
+  }
+  out.out_int(ent ? set_size(ent) : 0);
+}
+
+// `sinter|sunion key...`: the members of the sets at the keys, in no order.
+// A missing key is an empty set.
+static void set_op(std::vector<std::string> &cmd, bool inter, Response &out) {
+  std::vector<Entry *> sets;
+  for (size_t i = 1; i < cmd.size(); i++) {
+    Entry *ent = nullptr;
+    if (!lookup_typed(cmd[i], ValueType::SET, ent, out)) {
+      return;
+    }
+    if (ent) {
+      sets.push_back(ent);
+    } else if (inter) {
+      sets.clear();
+      break;
+    }
+  }
+  std::vector<std::string> members;
+  if (inter) {
+    set_inter(sets, members);
+  } else {
+    set_union(sets, members);
+  }
+  std::vector<const std::string *> items(members.size());
+  for (size_t i = 0; i < members.size(); i++) {
+    items[i] = &members[i];
+  }
+  out.out_bulk_array(items.data(), items.size());
+}
+
+void do_sinter(std::vector<std::string> &&cmd, Response &out) {
+  set_op(cmd, true, out);
+}
+
+void do_sunion(std::vector<std::string> &&cmd, Response &out) {
+  set_op(cmd, false, out);
+}
+
+// Find the HyperLogLog at `key`, like lookup_typed(): a string that is not
+// one is an error too.
+static bool lookup_hll(const std::string &key, Entry *&ent, Response &out) {
+  if (!lookup_typed(key, ValueType::STRING, ent, out)) {
+    return false;
+  }
+  if (ent && !hll_valid(ent->value)) {
+    out.out_err(ERR_WRONGTYPE, "Key is not a valid HyperLogLog string value");
+    return false;
+  }
+  return true;
+}
+
+// `pfadd key element...`: 1 if the estimate may have changed, or the key
+// was created
+void do_pfadd(std::vector<std::string> &&cmd, Response &out) {
+  Entry *ent = nullptr;
+  if (!lookup_hll(cmd[1], ent, out)) {
+    return;
+  }
+  KeyStore &store = GlobalState::store();
+  bool changed = false;
+  if (!ent) {
+    ent = store.add(cmd[1], ValueType::STRING);
+    hll_init(ent->value);
+    changed = true;
+  }
+  for (size_t i = 2; i < cmd.size(); i++) {
+    changed |= hll_add(ent->value, cmd[i].data(), cmd[i].size(),
+                       store.limits());
+  }
+  if (changed) {
+    propagate(cmd);
+  }
+  out.out_int(changed ? 1 : 0);
+}
+
+// `pfcount key...`: the estimated number of distinct elements added to any
+// of the keys. With one key the estimate is cached in the value.
+void do_pfcount(std::vector<std::string> &&cmd, Response &out) {
+  std::vector<Entry *> hlls;
+  for (size_t i = 1; i < cmd.size(); i++) {
+    Entry *ent = nullptr;
+    if (!lookup_hll(cmd[i], ent, out)) {
+      return;
+    }
+    if (ent) {
+      hlls.push_back(ent);
+    }
+  }
+  if (hlls.empty()) {
+    return out.out_int(0);
+  }
+  if (cmd.size() == 2) {
+    return out.out_int(hll_count(hlls[0]->value));
+  }
+  std::vector<uint8_t> acc(k_hll_registers), regs(k_hll_registers);
+  for (Entry *ent : hlls) {
+    hll_registers(ent->value, regs.data());
+    hll_merge(acc.data(), regs.data());
+  }
+  out.out_int(hll_estimate(acc.data()));
+}
+
+// `pfmerge dest source...`: `dest` counts what it and the sources did
+void do_pfmerge(std::vector<std::string> &&cmd, Response &out) {
+  std::vector<Entry *> hlls;
+  for (size_t i = 1; i < cmd.size(); i++) {
+    Entry *ent = nullptr;
+    if (!lookup_hll(cmd[i], ent, out)) {
+      return;
+    }
+    if (ent) {
+      hlls.push_back(ent);
+    }
+  }
+  std::vector<uint8_t> acc(k_hll_registers), regs(k_hll_registers);
+  for (Entry *ent : hlls) {
+    hll_registers(ent->value, regs.data());
+    hll_merge(acc.data(), regs.data());
+  }
+  std::string value;
+  hll_store(value, acc.data());
+  propagate(cmd);
+  GlobalState::store().set(std::move(cmd[1]), std::move(value));
+  out.out_ok();
+}
+
+// the bit offset of SETBIT and GETBIT, at most 2^32 - 1 as in Redis
+static bool parse_bit_offset(const std::string &s, uint64_t &offset,
+                             Response &out) {
+  int64_t v = 0;
+  if (!str2int(s, v) || v < 0 || v > (int64_t)UINT32_MAX) {
+    out.out_err(ERR_BAD_ARG, "bit offset is not an integer or out of range");
+    return false;
+  }
+  offset = (uint64_t)v;
+  return true;
+}
+
+// `setbit key offset 0|1`: the bit it was
+void do_setbit(std::vector<std::string> &&cmd, Response &out) {
+  uint64_t offset = 0;
+  if (!parse_bit_offset(cmd[2], offset, out)) {
+    return;
+  }
+  if (cmd[3] != "0" && cmd[3] != "1") {
+    return out.out_err(ERR_BAD_ARG, "bit is not an integer or out of range");
+  }
+  Entry *ent = nullptr;
+  if (!lookup_typed(cmd[1], ValueType::STRING, ent, out)) {
+    return;
+  }
+  if (!ent) {
+    ent = GlobalState::store().add(cmd[1], ValueType::STRING);
+  }
+  propagate(cmd);
+  out.out_int(bitmap_setbit(ent->value, offset, cmd[3][0] - '0'));
+}
+
+void do_getbit(std::vector<std::string> &&cmd, Response &out) {
+  uint64_t offset = 0;
+  if (!parse_bit_offset(cmd[2], offset, out)) {
+    return;
+  }
+  Entry *ent = nullptr;
+  if (!lookup_typed(cmd[1], ValueType::STRING, ent, out)) {
+    return;
+  }
+  out.out_int(ent ? bitmap_getbit(ent->value, offset) : 0);
+}
+
+// The `[start [end [BYTE|BIT]]]` from `cmd[at]` on of BITCOUNT and BITPOS,
+// as the bits `[first, last]` of a value of `size` bytes; `has_end` if an
+// end was given. Returns false, with the error in `out`, on a bad argument;
+// an empty range is `first > last`.
+static bool parse_bit_range(const std::vector<std::string> &cmd, size_t at,
+                            size_t size, int64_t &first, int64_t &last,
+                            bool &has_end, Response &out) {
+  int64_t start = 0;
+  int64_t end = -1;
+  bool bits = false;
+  has_end = cmd.size() > at + 1;
+  if ((cmd.size() > at && !str2int(cmd[at], start)) ||
+      (has_end && !str2int(cmd[at + 1], end))) {
+    out.out_err(ERR_BAD_ARG, "expect int");
+    return false;
+  }
+  if (cmd.size() > at + 2) {
+    bits = strcasecmp(cmd[at + 2].c_str(), "bit") == 0;
+    if ((!bits && strcasecmp(cmd[at + 2].c_str(), "byte") != 0) ||
+        cmd.size() > at + 3) {
+      out.out_err(ERR_BAD_ARG, "syntax error");
+      return false;
+    }
+  }
+  // negative indexes count from the end, as in Redis
+  int64_t len = bits ? (int64_t)size * 8 : (int64_t)size;
+  start = start < 0 ? (start + len < 0 ? 0 : start + len) : start;
+  end = end < 0 ? (end + len < 0 ? 0 : end + len) : end;
+  end = end >= len ? len - 1 : end;
+  first = bits ? start : start * 8;
+  last = bits ? end : end * 8 + 7;
+  if (start > end) {
+    first = 1;
+    last = 0;
+  }
+  return true;
+}
+
+// `bitcount key [start end [BYTE|BIT]]`: the set bits in the range, the
+// whole string by default
+void do_bitcount(std::vector<std::string> &&cmd, Response &out) {
+  if (cmd.size() == 3) {
+    return out.out_err(ERR_BAD_ARG, "syntax error");
+  }
+  Entry *ent = nullptr;
+  if (!lookup_typed(cmd[1], ValueType::STRING, ent, out)) {
+    return;
+  }
+  int64_t first = 0;
+  int64_t last = 0;
+  bool has_end = false;
+  size_t size = ent ? ent->value.size() : 0;
+  if (!parse_bit_range(cmd, 2, size, first, last, has_end, out)) {
+    return;
+  }
+  if (!ent || first > last) {
+    return out.out_int(0);
+  }
+  out.out_int(bitmap_count(ent->value, first, last));
+}
+
+// `bitpos key 0|1 [start [end [BYTE|BIT]]]`: the first bit set to 0 or 1 in
+// the range, else -1. Without an end the string is taken to go on with
+// zeros, so a clear bit is found one past its last.
+void do_bitpos(std::vector<std::string> &&cmd, Response &out) {
+  if (cmd[2] != "0" && cmd[2] != "1") {
+    return out.out_err(ERR_BAD_ARG, "The bit argument must be 1 or 0.");
+  }
+  int bit = cmd[2][0] - '0';
+  Entry *ent = nullptr;
+  if (!lookup_typed(cmd[1], ValueType::STRING, ent, out)) {
+    return;
+  }
+  int64_t first = 0;
+  int64_t last = 0;
+  bool has_end = false;
+  size_t size = ent ? ent->value.size() : 0;
+  if (!parse_bit_range(cmd, 3, size, first, last, has_end, out)) {
+    return;
+  }
+  if (!ent) {
+    return out.out_int(bit ? -1 : 0);
+  }
+  if (first > last) {
+    return out.out_int(-1);
+  }
+  int64_t pos = bitmap_pos(ent->value, bit, first, last);
+  if (pos < 0 && bit == 0 && !has_end) {
+    pos = last + 1;
+  }
+  out.out_int(pos);
+}
+
+// `bitop and|or|xor|not dest key...`: the length of the string stored at
+// `dest`, that of the longest source. `dest` is deleted if that is 0.
+void do_bitop(std::vector<std::string> &&cmd, Response &out) {
+  const char *name = cmd[1].c_str();
+  BitOp op = BitOp::AND;
+  if (strcasecmp(name, "or") == 0) {
+    op = BitOp::OR;
+  } else if (strcasecmp(name, "xor") == 0) {
+    op = BitOp::XOR;
+  } else if (strcasecmp(name, "not") == 0) {
+    op = BitOp::NOT;
+  } else if (strcasecmp(name, "and") != 0) {
+    return out.out_err(ERR_BAD_ARG, "syntax error");
+  }
+  if (op == BitOp::NOT && cmd.size() != 4) {
+    return out.out_err(ERR_BAD_ARG,
+                       "BITOP NOT must be called with a single source key.");
+  }
+  // a missing source is an empty string
+  static const std::string empty;
+  std::vector<const std::string *> srcs;
+  for (size_t i = 3; i < cmd.size(); i++) {
+    Entry *ent = nullptr;
+    if (!lookup_typed(cmd[i], ValueType::STRING, ent, out)) {
+      return;
+    }
+    srcs.push_back(ent ? &ent->value : &empty);
+  }
+  std::string value;
+  bitmap_op(op, srcs, value);
+  propagate(cmd);
+  int64_t size = (int64_t)value.size();
+  if (size == 0) {
+    GlobalState::store().del(cmd[2]);
   } else {
-    out.out_err(ResponseErrorType::ERR_UNKNOWN, "unknown command");
+    GlobalState::store().set(std::move(cmd[2]), std::move(value));
+  }
+  out.out_int(size);
+}
+
+// the filter BF.ADD and BF.MADD create, as in RedisBloom
+static const double k_bf_error_rate = 0.01;
+static const int64_t k_bf_capacity = 100;
+static const int64_t k_bf_expansion = 2;
+
+// `bf.reserve key error_rate capacity [expansion n]`: an empty filter
+void do_bf_reserve(std::vector<std::string> &&cmd, Response &out) {
+  char *end = nullptr;
+  double error_rate = strtod(cmd[2].c_str(), &end);
+  if (end != cmd[2].c_str() + cmd[2].size() ||
+      !(error_rate >= k_bloom_min_error_rate && error_rate < 1)) {
+    return out.out_err(ERR_BAD_ARG, "error rate is out of range");
+  }
+  int64_t capacity = 0;
+  if (!str2int(cmd[3], capacity) || capacity <= 0) {
+    return out.out_err(ERR_BAD_ARG, "capacity is out of range");
+  }
+  int64_t expansion = k_bf_expansion;
+  if (cmd.size() == 6 && strcasecmp(cmd[4].c_str(), "expansion") == 0) {
+    if (!str2int(cmd[5], expansion) || expansion < 1 || expansion > 1024) {
+      return out.out_err(ERR_BAD_ARG, "expansion is out of range");
+    }
+  } else if (cmd.size() != 4) {
+    return out.out_err(ERR_BAD_ARG, "syntax error");
+  }
+  KeyStore &store = GlobalState::store();
+  if (store.lookup(cmd[1])) {
+    return out.out_err(ERR_BAD_ARG, "item exists");
+  }
+  // over k_bloom_max_bytes, a capacity this big at this error rate
+  BloomFilter *bf = BloomFilter::create(error_rate, capacity, expansion);
+  if (!bf) {
+    return out.out_err(ERR_TOO_BIG, "filter is too big");
+  }
+  propagate(cmd);
+  Entry *ent = store.add(cmd[1], ValueType::BLOOM);
+  ent->obj.reset(bf);
+  out.out_ok();
+}
+
+// `bf.add key item`, `bf.madd key item...`: 1 for each item that was not in
+// the filter yet, in an array for BF.MADD; an error once the filter is full,
+// though the items before are kept
+static void bloom_add(std::vector<std::string> &cmd, bool multi,
+                      Response &out) {
+  Entry *ent = nullptr;
+  if (!lookup_typed(cmd[1], ValueType::BLOOM, ent, out)) {
+    return;
+  }
+  if (!ent) {
+    BloomFilter *bf =
+        BloomFilter::create(k_bf_error_rate, k_bf_capacity, k_bf_expansion);
+    if (!bf) {
+      return out.out_err(ERR_TOO_BIG, "filter is too big");
+    }
+    ent = GlobalState::store().add(cmd[1], ValueType::BLOOM);
+    ent->obj.reset(bf);
+  }
+  size_t n = cmd.size() - 2;
+  std::vector<uint64_t> hashes(n);
+  std::vector<uint8_t> added(n);
+  for (size_t i = 0; i < n; i++) {
+    hashes[i] = bloom_hash(cmd[i + 2]);
+  }
+  bool fits = bloom_of(ent)->add(hashes.data(), n, added.data());
+  for (uint8_t a : added) {
+    if (a) {
+      propagate(cmd); // replayed, it fills up at the same item
+      break;
+    }
+  }
+  if (!fits) {
+    return out.out_err(ERR_TOO_BIG, "filter is full");
+  }
+  if (!multi) {
+    return out.out_int(added[0]);
+  }
+  out.out_arrary(n);
+  for (uint8_t a : added) {
+    out.out_int(a);
+  }
+}
+
+void do_bf_add(std::vector<std::string> &&cmd, Response &out) {
+  bloom_add(cmd, false, out);
+}
+
+void do_bf_madd(std::vector<std::string> &&cmd, Response &out) {
+  bloom_add(cmd, true, out);
+}
+
+// `bf.exists key item`, `bf.mexists key item...`: 1 for each item that may
+// have been added, 0 for one that was not
+static void bloom_exists(std::vector<std::string> &cmd, bool multi,
+                         Response &out) {
+  Entry *ent = nullptr;
+  if (!lookup_typed(cmd[1], ValueType::BLOOM, ent, out)) {
+    return;
+  }
+  size_t n = cmd.size() - 2;
+  std::vector<uint64_t> hashes(n);
+  std::vector<uint8_t> found(n);
+  for (size_t i = 0; ent && i < n; i++) {
+    hashes[i] = bloom_hash(cmd[i + 2]);
   }
+  if (ent) {
+    bloom_of(ent)->contains(hashes.data(), n, found.data());
+  }
+  if (!multi) {
+    return out.out_int(found[0]);
+  }
+  out.out_arrary(n);
+  for (uint8_t f : found) {
+    out.out_int(f);
+  }
+}
+
+void do_bf_exists(std::vector<std::string> &&cmd, Response &out) {
+  bloom_exists(cmd, false, out);
+}
+
+void do_bf_mexists(std::vector<std::string> &&cmd, Response &out) {
+  bloom_exists(cmd, true, out);
+}
+
+// `bf.load key data`: the filter BloomFilter::pack() wrote, as the AOF
+// rewrite emits it
+void do_bf_load(std::vector<std::string> &&cmd, Response &out) {
+  BloomFilter *bf = BloomFilter::unpack(cmd[2]);
+  if (!bf) {
+    return out.out_err(ERR_BAD_ARG, "invalid filter");
+  }
+  propagate(cmd);
+  Entry *ent = GlobalState::store().add(cmd[1], ValueType::BLOOM);
+  ent->obj.reset(bf);
+  out.out_ok();
+}
+
+// `publish channel message`: the number of subscribers it was sent to. It
+// is not propagated: the AOF and the replicas only carry the keyspace.
+void do_publish(std::vector<std::string> &&cmd, Response &out) {
+  out.out_int(GlobalState::pubsub().publish(cmd[1], cmd[2]));
+}
+
+void do_bgrewriteaof(std::vector<std::string> &&cmd, Response &out) {
+  AppendOnlyFile &aof = GlobalState::aof();
+  if (!aof.enabled()) {
+    return out.out_err(ERR_UNKNOWN, "append only file is disabled");
+  }
+  if (GlobalState::child_running()) {
+    return out.out_err(ERR_UNKNOWN, "a background save or rewrite is running");
+  }
+  if (!aof.start_rewrite()) {
+    return out.out_err(ERR_UNKNOWN, "failed to start the rewrite");
+  }
+  return out.out_str("background aof rewrite started");
+}
+
+void do_save(std::vector<std::string> &&cmd, Response &out) {
+  if (GlobalState::child_running()) {
+    return out.out_err(ERR_UNKNOWN, "a background save or rewrite is running");
+  }
+  if (!GlobalState::snapshot().save(GlobalState::config().dbfilename)) {
+    return out.out_err(ERR_UNKNOWN, "save failed");
+  }
+  return out.out_ok();
+}
+
+void do_bgsave(std::vector<std::string> &&cmd, Response &out) {
+  if (GlobalState::child_running()) {
+    return out.out_err(ERR_UNKNOWN, "a background save or rewrite is running");
+  }
+  if (!GlobalState::snapshot().start_bgsave(GlobalState::config().dbfilename)) {
+    return out.out_err(ERR_UNKNOWN, "failed to start the background save");
+  }
+  return out.out_str("background saving started");
+}
+
+void do_replicaof(std::vector<std::string> &&cmd, Response &out) {
+  if (strcasecmp(cmd[1].c_str(), "no") == 0 &&
+      strcasecmp(cmd[2].c_str(), "one") == 0) {
+    GlobalState::replication().replicaof("", 0);
+    return out.out_ok();
+  }
+  int64_t port = 0;
+  if (!str2int(cmd[2], port) || port <= 0 || port > UINT16_MAX) {
+    return out.out_err(ERR_BAD_ARG, "expect port");
+  }
+  GlobalState::replication().replicaof(cmd[1], (uint16_t)port);
+  return out.out_ok();
+}
+
+// `client list`: one line per connection, see Connection::describe()
+void do_client(std::vector<std::string> &&cmd, Response &out) {
+  if (strcasecmp(cmd[1].c_str(), "list") != 0) {
+    return out.out_err(ERR_BAD_ARG, "unknown subcommand");
+  }
+  std::string list;
+  for (const auto &conn : GlobalState::fd2conn()) {
+    if (conn) {
+      conn->describe(list);
+    }
+  }
+  out.out_str(list);
+}
+
+void do_role(std::vector<std::string> &&cmd, Response &out) {
+  GlobalState::replication().role(out);
+}
+
+void do_ping(std::vector<std::string> &&cmd, Response &out) {
+  if (cmd.size() > 2) {
+    return out.out_err(ERR_BAD_ARG, "wrong number of arguments");
+  }
+  out.out_str(cmd.size() == 2 ? cmd[1] : "PONG");
+}
+
+void do_command(std::vector<std::string> &&cmd, Response &out);
+
+static constexpr Command k_commands[] = {
+    // name, handler, arity, flags, first key, last key, key step
+    {"get", do_get, 2, CMD_READONLY, 1, 1, 1},
+    {"set", do_set, 3, CMD_WRITE, 1, 1, 1},
+    {"del", do_del, 2, CMD_WRITE, 1, 1, 1},
+    {"mget", do_mget, -2, CMD_READONLY, 1, -1, 1},
+    {"keys", do_keys, 1, CMD_READONLY, 0, 0, 0},
+    {"scan", do_scan, -2, CMD_READONLY, 0, 0, 0},
+    {"pexpire", do_expire, 3, CMD_WRITE, 1, 1, 1},
+    {"pexpireat", do_expireat, 3, CMD_WRITE, 1, 1, 1},
+    {"hset", do_hset, -4, CMD_WRITE, 1, 1, 1},
+    {"hget", do_hget, 3, CMD_READONLY, 1, 1, 1},
+    {"hdel", do_hdel, -3, CMD_WRITE, 1, 1, 1},
+    {"hlen", do_hlen, 2, CMD_READONLY, 1, 1, 1},
+    {"hgetall", do_hgetall, 2, CMD_READONLY, 1, 1, 1},
+    {"hincrby", do_hincrby, 4, CMD_WRITE, 1, 1, 1},
+    {"lpush", do_lpush, -3, CMD_WRITE, 1, 1, 1},
+    {"rpush", do_rpush, -3, CMD_WRITE, 1, 1, 1},
+    {"lpop", do_lpop, -2, CMD_WRITE, 1, 1, 1},
+    {"rpop", do_rpop, -2, CMD_WRITE, 1, 1, 1},
+    {"lrange", do_lrange, 4, CMD_READONLY, 1, 1, 1},
+    {"llen", do_llen, 2, CMD_READONLY, 1, 1, 1},
+    {"sadd", do_sadd, -3, CMD_WRITE, 1, 1, 1},
+    {"srem", do_srem, -3, CMD_WRITE, 1, 1, 1},
+    {"sismember", do_sismember, 3, CMD_READONLY, 1, 1, 1},
+    {"scard", do_scard, 2, CMD_READONLY, 1, 1, 1},
+    {"sinter", do_sinter, -2, CMD_READONLY, 1, -1, 1},
+    {"sunion", do_sunion, -2, CMD_READONLY, 1, -1, 1},
+    {"pfadd", do_pfadd, -2, CMD_WRITE, 1, 1, 1},
+    {"pfcount", do_pfcount, -2, CMD_READONLY, 1, -1, 1},
+    {"pfmerge", do_pfmerge, -2, CMD_WRITE, 1, -1, 1},
+    {"setbit", do_setbit, 4, CMD_WRITE, 1, 1, 1},
+    {"getbit", do_getbit, 3, CMD_READONLY, 1, 1, 1},
+    {"bitcount", do_bitcount, -2, CMD_READONLY, 1, 1, 1},
+    {"bitpos", do_bitpos, -3, CMD_READONLY, 1, 1, 1},
+    {"bitop", do_bitop, -4, CMD_WRITE, 2, -1, 1},
+    {"bf.reserve", do_bf_reserve, -4, CMD_WRITE, 1, 1, 1},
+    {"bf.add", do_bf_add, 3, CMD_WRITE, 1, 1, 1},
+    {"bf.madd", do_bf_madd, -3, CMD_WRITE, 1, 1, 1},
+    {"bf.exists", do_bf_exists, 3, CMD_READONLY, 1, 1, 1},
+    {"bf.mexists", do_bf_mexists, -3, CMD_READONLY, 1, 1, 1},
+    {"bf.load", do_bf_load, 3, CMD_WRITE, 1, 1, 1},
+    {"publish", do_publish, 3, 0, 0, 0, 0},
+    {"ping", do_ping, -1, 0, 0, 0, 0},
+    {"command", do_command, -1, 0, 0, 0, 0},
+    {"bgrewriteaof", do_bgrewriteaof, 1, CMD_ADMIN, 0, 0, 0},
+    {"save", do_save, 1, CMD_ADMIN, 0, 0, 0},
+    {"bgsave", do_bgsave, 1, CMD_ADMIN, 0, 0, 0},
+    {"replicaof", do_replicaof, 3, CMD_ADMIN, 0, 0, 0},
+    {"role", do_role, 1, CMD_ADMIN, 0, 0, 0},
+    {"client", do_client, 2, CMD_ADMIN, 0, 0, 0},
+    // see Connection::try_one_request()
+    {"hello", nullptr, -1, 0, 0, 0, 0},
+    {"psync", nullptr, 3, CMD_ADMIN, 0, 0, 0},
+    {"shmattach", nullptr, 1, 0, 0, 0, 0},
+    {"blpop", nullptr, -3, CMD_WRITE, 1, -2, 1},
+    {"brpop", nullptr, -3, CMD_WRITE, 1, -2, 1},
+    {"subscribe", nullptr, -2, 0, 0, 0, 0},
+    {"unsubscribe", nullptr, -1, 0, 0, 0, 0},
+    {"psubscribe", nullptr, -2, 0, 0, 0, 0},
+    {"punsubscribe", nullptr, -1, 0, 0, 0, 0},
+};
+static constexpr size_t k_ncommands =
+    sizeof(k_commands) / sizeof(k_commands[0]);
+static constexpr CommandIndex<k_ncommands> k_command_index =
+    build_command_index(k_commands);
+
+const Command *lookup_command(const std::string &name) {
+  uint32_t h = command_hash(name.data(), name.size(), k_command_index.seed);
+  uint8_t i = k_command_index.slots[h & (k_command_index.k_slots - 1)];
+  if (i == k_command_index.k_empty) {
+    return nullptr;
+  }
+  // lengths first, so a name with a NUL in it cannot run the loop past the
+  // end of `c.name`
+  if (name.size() != k_command_index.lens[i]) {
+    return nullptr;
+  }
+  const Command &c = k_commands[i];
+  for (size_t j = 0; j < name.size(); j++) {
+    if (ascii_lower(name[j]) != c.name[j]) {
+      return nullptr;
+    }
+  }
+  return &c;
+}
+
+void command_keys(const Command &c, const std::vector<std::string> &cmd,
+                  std::vector<size_t> &out) {
+  if (c.first_key == 0) {
+    return;
+  }
+  int last = c.last_key < 0 ? (int)cmd.size() + c.last_key : c.last_key;
+  for (int i = c.first_key; i <= last && i < (int)cmd.size();
+       i += c.key_step) {
+    out.push_back(i);
+  }
+}
+
+static void out_command_info(const Command &c, Response &out) {
+  out.out_arrary(6);
+  out.out_str(c.name);
+  out.out_int(c.arity);
+  std::vector<const char *> flags;
+  if (c.flags & CMD_WRITE) {
+    flags.push_back("write");
+  }
+  if (c.flags & CMD_READONLY) {
+    flags.push_back("readonly");
+  }
+  if (c.flags & CMD_ADMIN) {
+    flags.push_back("admin");
+  }
+  out.out_arrary(flags.size());
+  for (const char *flag : flags) {
+    out.out_str(flag);
+  }
+  out.out_int(c.first_key);
+  out.out_int(c.last_key);
+  out.out_int(c.key_step);
+}
+
+// `command count`, `command info name...`, `command getkeys cmd...`; with no
+// arguments, the info of every command
+void do_command(std::vector<std::string> &&cmd, Response &out) {
+  if (cmd.size() == 1) {
+    out.out_arrary(k_ncommands);
+    for (const Command &c : k_commands) {
+      out_command_info(c, out);
+    }
+    return;
+  }
+  const char *sub = cmd[1].c_str();
+  if (strcasecmp(sub, "count") == 0 && cmd.size() == 2) {
+    return out.out_int(k_ncommands);
+  }
+  if (strcasecmp(sub, "info") == 0) {
+    out.out_arrary(cmd.size() - 2);
+    for (size_t i = 2; i < cmd.size(); i++) {
+      const Command *c = lookup_command(cmd[i]);
+      if (c) {
+        out_command_info(*c, out);
+      } else {
+        out.out_nil();
+      }
+    }
+    return;
+  }
+  if (strcasecmp(sub, "getkeys") == 0 && cmd.size() > 2) {
+    std::vector<std::string> args(cmd.begin() + 2, cmd.end());
+    const Command *c = lookup_command(args[0]);
+    if (!c || !c->check_arity(args.size())) {
+      return out.out_err(ERR_BAD_ARG, "invalid command or arguments");
+    }
+    std::vector<size_t> keys;
+    command_keys(*c, args, keys);
+    out.out_arrary(keys.size());
+    for (size_t i : keys) {
+      out.out_str(args[i]);
+    }
+    return;
+  }
+  out.out_err(ERR_BAD_ARG, "unknown subcommand");
+}
+
+void run_command(const Command *c, std::vector<std::string> &&cmd,
+                 Response &out) {
+  if (!c) {
+    return out.out_err(ResponseErrorType::ERR_UNKNOWN, "unknown command");
+  }
+  if (!c->check_arity(cmd.size())) {
+    return out.out_err(ERR_BAD_ARG, "wrong number of arguments");
+  }
+  if (!c->handler) {
+    return out.out_err(ResponseErrorType::ERR_UNKNOWN, "unknown command");
+  }
+  c->handler(std::move(cmd), out);
+}
+
+void do_request(std::vector<std::string> &&cmd, Response &out) {
+  const Command *c = cmd.empty() ? nullptr : lookup_command(cmd[0]);
+  run_command(c, std::move(cmd), out);
 }
@@ -0,0 +1,184 @@
+#include "resp.hpp"
+#include <cstring>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// arguments in one request
+static const uint64_t k_max_args = 1024 * 1024;
+// digits in a count or a length
+static const size_t k_max_digits = 18;
+// an inline command, all on one line, as in Redis
+static const size_t k_max_inline = 64 * 1024;
+
+int detect_resp(const uint8_t *data, size_t len) {
+  if (len < 2) {
+    return -1;
+  }
+  auto is_alpha = [](uint8_t c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+  };
+  if (data[0] == '*') {
+    return data[1] >= '0' && data[1] <= '9';
+  }
+  return is_alpha(data[0]) && is_alpha(data[1]);
+}
+
+// the first `c` in [p, end), or `end`; 16 bytes at a time with SSE2
+static const uint8_t *find_byte(const uint8_t *p, const uint8_t *end,
+                                uint8_t c) {
+#if defined(__SSE2__)
+  const __m128i needle = _mm_set1_epi8((char)c);
+  while (end - p >= 16) {
+    __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+    int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+    if (mask != 0) {
+      return p + __builtin_ctz(mask);
+    }
+    p += 16;
+  }
+#endif
+  while (p < end && *p != c) {
+    p++;
+  }
+  return p;
+}
+
+// Up to 8 digits at once: check and combine them as the bytes of one word
+// (SWAR), instead of a multiply and a branch per digit.
+static bool parse_digits8(const uint8_t *p, size_t n, uint64_t &out) {
+  char buf[8];
+  memset(buf, '0', sizeof(buf) - n); // leading zeros
+  memcpy(buf + sizeof(buf) - n, p, n);
+  uint64_t v = 0;
+  memcpy(&v, buf, 8);
+  // a byte below '0' borrows into its top bit, one above '9' carries into it
+  if (((v - 0x3030303030303030ull) | (v + 0x4646464646464646ull)) &
+      0x8080808080808080ull) {
+    return false;
+  }
+  v -= 0x3030303030303030ull;
+  // pairs of digits, then groups of 4, then all 8 (first digit is lowest)
+  v = (v * 10) + (v >> 8);
+  v = (((v & 0x000000FF000000FFull) * (100 + (1000000ull << 32))) +
+       (((v >> 16) & 0x000000FF000000FFull) * (1 + (10000ull << 32)))) >>
+      32;
+  out = v;
+  return true;
+}
+
+// the decimal number in [p, q)
+static bool parse_uint(const uint8_t *p, const uint8_t *q, uint64_t &out) {
+  size_t n = q - p;
+  if (n == 0 || n > k_max_digits) {
+    return false;
+  }
+  if (n <= 8) {
+    return parse_digits8(p, n, out);
+  }
+  uint64_t high = 0;
+  uint64_t low = 0;
+  if (!parse_uint(p, q - 8, high) || !parse_digits8(q - 8, 8, low)) {
+    return false;
+  }
+  out = high * 100000000ull + low;
+  return true;
+}
+
+// `<prefix><digits>\r\n` at `p`: 1 with `p` moved past it, 0 if incomplete,
+// -1 if malformed
+static int parse_header(const uint8_t *&p, const uint8_t *end,
+                        uint8_t prefix, uint64_t &out) {
+  if (p == end) {
+    return 0;
+  }
+  if (*p != prefix) {
+    return -1;
+  }
+  const uint8_t *limit = end - p > 32 ? p + 32 : end;
+  const uint8_t *cr = find_byte(p + 1, limit, '\r');
+  if (cr == limit) {
+    return limit == end ? 0 : -1;
+  }
+  if (cr + 1 == end) {
+    return 0;
+  }
+  if (cr[1] != '\n' || !parse_uint(p + 1, cr, out)) {
+    return -1;
+  }
+  p = cr + 2;
+  return 1;
+}
+
+static ssize_t parse_multibulk(const uint8_t *cur, const uint8_t *end,
+                               size_t max_bulk,
+                               std::vector<std::string> *out) {
+  const uint8_t *p = cur;
+  uint64_t count = 0;
+  int rv = parse_header(p, end, '*', count);
+  if (rv <= 0) {
+    return rv;
+  }
+  if (count > k_max_args) {
+    return -1;
+  }
+  for (uint64_t i = 0; i < count; i++) {
+    uint64_t len = 0;
+    rv = parse_header(p, end, '$', len);
+    if (rv <= 0) {
+      return rv;
+    }
+    if (len > max_bulk) {
+      return -1;
+    }
+    if ((size_t)(end - p) < len + 2) {
+      return 0;
+    }
+    if (p[len] != '\r' || p[len + 1] != '\n') {
+      return -1;
+    }
+    if (out) {
+      out->emplace_back((const char *)p, len);
+    }
+    p += len + 2;
+  }
+  return p - cur;
+}
+
+static ssize_t parse_inline(const uint8_t *cur, const uint8_t *end,
+                            std::vector<std::string> *out) {
+  const uint8_t *limit =
+      (size_t)(end - cur) > k_max_inline ? cur + k_max_inline : end;
+  const uint8_t *nl = find_byte(cur, limit, '\n');
+  if (nl == limit) {
+    return limit == end ? 0 : -1;
+  }
+  const uint8_t *line_end = nl > cur && nl[-1] == '\r' ? nl - 1 : nl;
+  if (out) {
+    const uint8_t *p = cur;
+    while (p < line_end) {
+      while (p < line_end && (*p == ' ' || *p == '\t')) {
+        p++;
+      }
+      const uint8_t *word = p;
+      while (p < line_end && *p != ' ' && *p != '\t') {
+        p++;
+      }
+      if (p > word) {
+        out->emplace_back((const char *)word, p - word);
+      }
+    }
+  }
+  return nl + 1 - cur;
+}
+
+ssize_t parse_resp_request(const uint8_t *cur, const uint8_t *end,
+                           size_t max_bulk, std::vector<std::string> *out) {
+  if (cur == end) {
+    return 0;
+  }
+  if (*cur == '*') {
+    return parse_multibulk(cur, end, max_bulk, out);
+  }
+  return parse_inline(cur, end, out);
+}
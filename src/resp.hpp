@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+// RESP, the Redis protocol, spoken next to the native framing so that
+// redis-benchmark, memtier and Redis client libraries can connect.
+//
+// A request is an array of bulk strings, `*2\r\n$3\r\nget\r\n$1\r\nk\r\n`,
+// or an inline command, `get k\r\n` (split on blanks, no quoting). Replies
+// are encoded by `Response` in RESP2 or, after `hello 3`, RESP3.
+
+/**
+ * @brief tell RESP from native frames by the first bytes of a connection
+ *
+ * A native frame starts with its u32 length, at most `k_max_msg`, so its
+ * second byte is small; RESP starts with `*` and a digit, or with the
+ * letters of an inline command.
+ *
+ * @return 1 for RESP, 0 for native, -1 if more bytes are needed
+ */
+int detect_resp(const uint8_t *data, size_t len);
+
+/**
+ * @brief parse the RESP request at `cur`
+ *
+ * @param max_bulk the longest argument accepted in an array; an inline
+ * command is at most 64 KB
+ * @param out where the arguments go; nullptr only checks that the request
+ * is complete. An empty line or array leaves it empty.
+ * @return the length of the request, 0 if it is not all there yet, -1 if it
+ * is malformed or too long
+ */
+ssize_t parse_resp_request(const uint8_t *cur, const uint8_t *end,
+                           size_t max_bulk, std::vector<std::string> *out);
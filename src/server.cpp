@@ -1,13 +1,15 @@
-#include <_types/_uint32_t.h>
+#include <cstdint>
 #include <assert.h>
 #include <cstddef>
-#include <iostream>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <poll.h>
 #include <string.h>
 #include <sys/poll.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <unistd.h>
 #include <vector>
 
@@ -15,8 +17,15 @@
 #include "global.hpp"
 #include "hashtable.hpp"
 #include "heap.hpp"
+#include "request.hpp"
 #include "utils.hpp"
 
+static const uint64_t k_child_check_ms = 100;
+// after shm traffic, poll without sleeping for this long before arming the
+// eventfds, so a busy shm client never has to make a syscall
+static const uint64_t k_shm_spin_us = 50;
+static uint64_t shm_spin_until_us = 0;
+
 static int64_t next_timer_ms() {
   DList *header = GlobalState::timeout_dlist_header();
   uint64_t next_ms = (uint64_t)-1;
@@ -26,11 +35,26 @@ static int64_t next_timer_ms() {
     Connection *conn = Connection::container_of_timeout_node(header->next);
     next_ms = conn->get_last_activate_ms() + GlobalState::k_idle_timeout_ms;
   }
-  if (!GlobalState::ttl_heap().is_empty()) {
-    auto next_ms_ttl = GlobalState::ttl_heap().top().val;
-    if (next_ms > next_ms_ttl) {
-      next_ms = next_ms_ttl;
-    }
+  int64_t next_ms_ttl = GlobalState::store().next_expire_ms();
+  if (next_ms_ttl >= 0 && next_ms > (uint64_t)next_ms_ttl) {
+    next_ms = next_ms_ttl;
+  }
+  int64_t next_ms_block = GlobalState::blocking().next_deadline_ms();
+  if (next_ms_block >= 0 && next_ms > (uint64_t)next_ms_block) {
+    next_ms = next_ms_block;
+  }
+  // a background child is reaped from the loop, so wake up to check on it
+  if (GlobalState::child_running() && next_ms > now_ms + k_child_check_ms) {
+    next_ms = now_ms + k_child_check_ms;
+  }
+  // connections with leftover requests must not wait for a poll timeout
+  if (!GlobalState::pending_dlist_header()->is_empty() ||
+      get_monotonic_usec() < shm_spin_until_us) {
+    return 0;
+  }
+  int64_t repl_ms = GlobalState::replication().next_cron_ms();
+  if (repl_ms >= 0 && next_ms > now_ms + repl_ms) {
+    next_ms = now_ms + repl_ms;
   }
 
   if (next_ms == (uint64_t)-1) {
@@ -54,126 +78,338 @@ static void process_timers() {
     }
     auto &fd2conn = GlobalState::fd2conn();
     int fd = conn->fd();
-    LOG(INFO) << "remove idle connection" << fd << "\n";
-    fd2conn.erase(fd2conn.begin() + fd);
+    LOG_RATELIMITED(INFO, 10, "remove idle connection {}", fd);
+    fd2conn[fd].reset();
   }
+  GlobalState::blocking().expire(now_ms);
 
-  auto &heap = GlobalState::ttl_heap();
-  for (int i = 0; i < GlobalState::k_max_works; i++) {
-    if (heap.is_empty() || heap.top().val > now_ms) {
+  // a replica waits for the DEL from its primary instead
+  if (GlobalState::replication().is_replica()) {
+    return;
+  }
+  auto on_expire = [](const std::string &key, void *) {
+    LOG_RATELIMITED(INFO, 10, "remove expired entry {}", key);
+    propagate({"del", key});
+  };
+  GlobalState::store().tick(now_ms, KeyStore::k_max_expire_work, on_expire,
+                            nullptr);
+}
+
+// Give each connection that ran out of budget on an earlier iteration
+// another one. Those that run out again go back to the tail, behind the
+// connections served on this iteration.
+static void process_pending() {
+  DList *header = GlobalState::pending_dlist_header();
+  if (header->is_empty()) {
+    return;
+  }
+  DList *last = header->prev;
+  while (!header->is_empty()) {
+    DList *node = header->next;
+    node->detach();
+    Connection::container_of_pending_node(node)->resume_input();
+    if (node == last) {
       break;
     }
-    Entry *ent = container_of(heap.top().ref, Entry, heap_idx);
-    HashNode *node = GlobalState::db().remove(
-        &ent->node, [](HashNode *a, HashNode *b) { return a == b; });
-    assert(node == &ent->node);
-    heap.remove(ent->heap_idx);
-    LOG(INFO) << "remove expired entry" << ent->key << "\n";
-
-    delete ent;
   }
 }
 
-static std::unique_ptr<Connection> handle_accept(int fd) {
-  struct sockaddr_in client_addr = {};
-  socklen_t socklen = sizeof(client_addr);
-  int connfd = accept(fd, (struct sockaddr *)&client_addr, &socklen);
-  if (connfd < 0) {
-    LOG(ERROR) << "accept failed: " << strerror(errno) << "\n";
-    return nullptr;
+// Pull requests out of the rings of the shared-memory clients.
+static void process_shm() {
+  DList *header = GlobalState::shm_dlist_header();
+  for (DList *node = header->next; node != header; node = node->next) {
+    Connection *conn = Connection::container_of_shm_node(node);
+    conn->handle_shm();
+    if (conn->state() == ConnectionState::STATE_RES && shm_should_spin()) {
+      shm_spin_until_us = get_monotonic_usec() + k_shm_spin_us;
+    }
   }
-  uint32_t ip = client_addr.sin_addr.s_addr;
-  LOG(INFO) << "Accept connection from " << inet_ntoa({ip}) << ":"
-            << ntohs(client_addr.sin_port) << std::endl;
+}
 
-  fd_set_nb(connfd);
-  auto conn =
-      std::make_unique<Connection>(connfd, GlobalState::timeout_dlist_header());
+// Replies to shm clients go out after the AOF flush, like socket replies.
+static void flush_shm() {
+  DList *header = GlobalState::shm_dlist_header();
+  for (DList *node = header->next; node != header; node = node->next) {
+    Connection *conn = Connection::container_of_shm_node(node);
+    if (conn->state() == ConnectionState::STATE_RES) {
+      conn->handle_write();
+    }
+  }
+}
 
-  return conn;
+static void set_sockopt(int fd, int level, int name, int val) {
+  if (setsockopt(fd, level, name, &val, sizeof(val)) < 0) {
+    LOG_RATELIMITED(WARNING, 10, "setsockopt({}) failed: {}", name,
+                    strerror(errno));
+  }
 }
 
-int main(int argc, char *argv[]) {
-  AixLog::Log::init<AixLog::SinkCout>(AixLog::Severity::trace);
+// Accept until the backlog is empty, but at most `k_max_accepts` per loop
+// iteration so a connection storm cannot starve the clients already served.
+static void handle_accept(int fd, bool is_unix) {
+  const Config &config = GlobalState::config();
+  auto &fd2conn = GlobalState::fd2conn();
+  for (int i = 0; i < GlobalState::k_max_accepts; i++) {
+    struct sockaddr_in client_addr = {};
+    socklen_t socklen = sizeof(client_addr);
+    int connfd = accept4(fd, is_unix ? NULL : (struct sockaddr *)&client_addr,
+                         is_unix ? NULL : &socklen,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (connfd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        LOG_RATELIMITED(ERROR, 10, "accept failed: {}", strerror(errno));
+      }
+      return;
+    }
+    if (is_unix) {
+      LOG_RATELIMITED(INFO, 100, "Accept connection on {}",
+                      config.unixsocket);
+    } else {
+      uint32_t ip = client_addr.sin_addr.s_addr;
+      LOG_RATELIMITED(INFO, 100, "Accept connection from {}:{}",
+                      inet_ntoa({ip}), ntohs(client_addr.sin_port));
+      if (config.tcp_nodelay) {
+        set_sockopt(connfd, IPPROTO_TCP, TCP_NODELAY, 1);
+      }
+    }
+    if (config.tcp_sndbuf > 0) {
+      set_sockopt(connfd, SOL_SOCKET, SO_SNDBUF, config.tcp_sndbuf);
+    }
+    if (config.tcp_rcvbuf > 0) {
+      set_sockopt(connfd, SOL_SOCKET, SO_RCVBUF, config.tcp_rcvbuf);
+    }
 
-  int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
-  if (listen_fd < 0) {
-    LOG(ERROR) << "socket error" << std::endl;
+    if (fd2conn.size() <= (size_t)connfd) {
+      fd2conn.resize(connfd + 1);
+    }
+    assert(fd2conn[connfd] == nullptr);
+    fd2conn[connfd] = std::make_unique<Connection>(
+        connfd, GlobalState::timeout_dlist_header());
+  }
+}
+
+static int listen_tcp(const Config &config) {
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (fd < 0) {
+    LOG(ERROR, "socket error: {}", strerror(errno));
     return -1;
   }
+  // a restarted server can bind while old connections sit in TIME_WAIT
+  set_sockopt(fd, SOL_SOCKET, SO_REUSEADDR, 1);
   struct sockaddr_in server_addr = {};
   server_addr.sin_family = AF_INET;
-  server_addr.sin_port = ntohs(1234);
+  server_addr.sin_port = ntohs(config.port);
   server_addr.sin_addr.s_addr = ntohl(0);
 
-  if (bind(listen_fd, (const struct sockaddr *)&server_addr,
-           sizeof(server_addr)) < 0) {
-    LOG(ERROR) << "bind error" << std::endl;
+  if (bind(fd, (const struct sockaddr *)&server_addr, sizeof(server_addr)) <
+      0) {
+    LOG(ERROR, "bind error: {}", strerror(errno));
+    close(fd);
     return -1;
   }
+  if (listen(fd, (int)config.tcp_backlog) < 0) {
+    LOG(ERROR, "listen error: {}", strerror(errno));
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
 
-  if (listen(listen_fd, 5) < 0) {
-    LOG(ERROR) << "listen error" << std::endl;
+static int listen_unix(const Config &config) {
+  struct sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  if (config.unixsocket.size() >= sizeof(addr.sun_path)) {
+    LOG(ERROR, "unix socket path too long: {}", config.unixsocket);
     return -1;
   }
-  fd_set_nb(listen_fd);
+  memcpy(addr.sun_path, config.unixsocket.data(), config.unixsocket.size());
 
-  std::vector<std::unique_ptr<Connection>> fd2conn;
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (fd < 0) {
+    LOG(ERROR, "socket error: {}", strerror(errno));
+    return -1;
+  }
+  unlink(config.unixsocket.c_str()); // left over from an earlier run
+  if (bind(fd, (const struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    LOG(ERROR, "bind {} error: {}", config.unixsocket, strerror(errno));
+    close(fd);
+    return -1;
+  }
+  if (config.unixsocketperm != 0 &&
+      chmod(config.unixsocket.c_str(), config.unixsocketperm) < 0) {
+    LOG(ERROR, "chmod {} error: {}", config.unixsocket, strerror(errno));
+    close(fd);
+    return -1;
+  }
+  if (listen(fd, (int)config.tcp_backlog) < 0) {
+    LOG(ERROR, "listen error: {}", strerror(errno));
+    close(fd);
+    return -1;
+  }
+  LOG(INFO, "listening on {}", config.unixsocket);
+  return fd;
+}
+
+int main(int argc, char *argv[]) {
+  Logger::instance().start();
+
+  Config &config = GlobalState::config();
+  if (!parse_args(argc, argv, config)) {
+    return -1;
+  }
+  EncodingLimits &limits = GlobalState::store().limits();
+  limits.hash_max_listpack_entries = config.hash_max_listpack_entries;
+  limits.hash_max_listpack_value = config.hash_max_listpack_value;
+  limits.list_max_listpack_size = config.list_max_listpack_size;
+  limits.set_max_intset_entries = config.set_max_intset_entries;
+  limits.hll_sparse_max_bytes = config.hll_sparse_max_bytes;
+  if (config.appendonly) {
+    int64_t n = GlobalState::aof().load(config.appendfilename);
+    if (n < 0) {
+      return -1;
+    }
+    LOG(INFO, "replayed {} commands from {}", n, config.appendfilename);
+    if (!GlobalState::aof().open(config)) {
+      return -1;
+    }
+  } else {
+    int64_t n = GlobalState::snapshot().load(config.dbfilename);
+    if (n < 0) {
+      return -1;
+    }
+    LOG(INFO, "loaded {} keys from {}", n, config.dbfilename);
+  }
+  if (!config.replicaof_host.empty()) {
+    GlobalState::replication().replicaof(config.replicaof_host,
+                                         config.replicaof_port);
+  }
+
+  int listen_fd = listen_tcp(config);
+  if (listen_fd < 0) {
+    return -1;
+  }
+  int unix_fd = -1;
+  if (!config.unixsocket.empty()) {
+    unix_fd = listen_unix(config);
+    if (unix_fd < 0) {
+      return -1;
+    }
+  }
+
+  auto &fd2conn = GlobalState::fd2conn();
+  Replication &repl = GlobalState::replication();
   std::vector<struct pollfd> poll_args;
   while (true) {
-    // poll every fd: first is listen socket, others are connections.
+    // poll every fd: first is listen socket, then the unix socket if there
+    // is one, then the link to our primary if we are a replica, others are
+    // connections.
     poll_args.clear();
     struct pollfd pfd = {listen_fd, POLLIN, 0};
     poll_args.push_back(pfd);
-    for (const auto &conn : fd2conn) {
+    if (unix_fd != -1) {
+      pfd = {unix_fd, POLLIN, 0};
+      poll_args.push_back(pfd);
+    }
+    size_t link_idx = poll_args.size();
+    bool has_link = repl.link_pollfd(pfd);
+    if (has_link) {
+      poll_args.push_back(pfd);
+    }
+    size_t first_conn = poll_args.size();
+    for (auto &conn : fd2conn) {
       if (conn == nullptr) {
         continue;
       }
+      if (conn->state() == ConnectionState::STATE_END) {
+        conn.reset(); // shut down from outside its own callbacks
+        continue;
+      }
       struct pollfd pfd = {conn->fd(), POLLERR, 0};
-      if (conn->state() == ConnectionState::STATE_REQ) {
+      if (conn->has_shm()) {
+        pfd.events |= POLLIN; // only to notice the client going away
+      } else if (conn->state() == ConnectionState::STATE_REQ) {
         pfd.events |= POLLIN;
-      }
-      if (conn->state() == ConnectionState::STATE_RES) {
+      } else if (conn->state() == ConnectionState::STATE_RES) {
         pfd.events |= POLLOUT;
       }
       poll_args.push_back(pfd);
     }
+    // then the eventfds of the shm clients, armed only if we may sleep
+    size_t first_shm = poll_args.size();
     int32_t timeout_ms = next_timer_ms();
+    DList *shm_header = GlobalState::shm_dlist_header();
+    for (DList *node = shm_header->next; node != shm_header;
+         node = node->next) {
+      Connection *conn = Connection::container_of_shm_node(node);
+      if (conn->state() == ConnectionState::STATE_END) {
+        continue;
+      }
+      if (timeout_ms != 0 && !conn->shm_arm()) {
+        timeout_ms = 0;
+      }
+      struct pollfd pfd = {conn->shm_wait_fd(), POLLIN, 0};
+      poll_args.push_back(pfd);
+    }
     int rv = poll(poll_args.data(), poll_args.size(), timeout_ms);
+    for (DList *node = shm_header->next; node != shm_header;
+         node = node->next) {
+      Connection::container_of_shm_node(node)->shm_disarm();
+    }
     if (rv < 0) {
       if (errno == EINTR) {
         continue;
       }
-      LOG(FATAL) << "poll error" << strerror(errno) << "\n";
+      LOG(FATAL, "poll error: {}", strerror(errno));
       return -1;
     }
 
     // handle the listen socket
     if (poll_args[0].revents != 0) {
-      if (auto conn = handle_accept(listen_fd)) {
-        if (fd2conn.size() <= conn->fd()) {
-          fd2conn.resize(conn->fd() + 1);
-        }
-        assert(fd2conn[conn->fd()] == nullptr);
-        fd2conn[conn->fd()] = std::move(conn);
-      }
+      handle_accept(listen_fd, false);
     }
+    if (unix_fd != -1 && poll_args[1].revents != 0) {
+      handle_accept(unix_fd, true);
+    }
+    if (has_link && poll_args[link_idx].revents != 0) {
+      repl.handle_link(poll_args[link_idx].revents);
+    }
+    process_shm();
+    process_pending();
     // handle the connections
-    for (size_t i = 1; i < poll_args.size(); i++) {
+    for (size_t i = first_conn; i < first_shm; i++) {
       uint32_t ready = poll_args[i].revents;
-      if (ready != 0) {
-        int fd = poll_args[i].fd;
-        auto &conn = fd2conn[fd];
+      auto &conn = fd2conn[poll_args[i].fd];
+      if (ready != 0 && conn) {
         conn->update_timer(GlobalState::timeout_dlist_header());
         if (ready & POLLIN) {
           conn->handle_read();
         }
-        if (ready & POLLOUT) {
+      }
+    }
+    // group commit: everything mutated in this iteration reaches the AOF
+    // with a single write (and fsync, under `always`) before any reply
+    // goes out, including those queued for other connections by pending
+    // input, woken BLPOPs and PUBLISH.
+    GlobalState::aof().flush();
+    GlobalState::aof().cron();
+    GlobalState::snapshot().cron();
+    repl.cron();
+    flush_shm();
+    for (size_t i = first_conn; i < first_shm; i++) {
+      uint32_t ready = poll_args[i].revents;
+      auto &conn = fd2conn[poll_args[i].fd];
+      // shm clients can end without any event on their socket
+      if (conn && (ready != 0 || conn->state() == ConnectionState::STATE_END)) {
+        if (ready & (POLLIN | POLLOUT) &&
+            conn->state() == ConnectionState::STATE_RES) {
           conn->handle_write();
         }
         if (ready & POLLERR || conn->state() == ConnectionState::STATE_END) {
-          fd2conn.erase(fd2conn.begin() + fd);
-          LOG(INFO) << "connection closed" << std::endl;
+          conn.reset();
+          LOG_RATELIMITED(INFO, 100, "connection closed");
         }
       }
     }
@@ -0,0 +1,498 @@
+#include "set_type.hpp"
+#include "listpack.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unordered_set>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// `s` as an integer, but only if that is exactly how the integer prints, so
+// the member comes back out of an intset as it went in
+static bool member_to_int(const char *s, size_t len, int64_t &out) {
+  if (len == 0 || len > 20) {
+    return false;
+  }
+  char buf[24];
+  memcpy(buf, s, len);
+  buf[len] = '\0';
+  char *end = nullptr;
+  errno = 0;
+  long long v = strtoll(buf, &end, 10);
+  if (errno != 0 || end != buf + len) {
+    return false;
+  }
+  char back[24];
+  int n = snprintf(back, sizeof(back), "%lld", v);
+  if ((size_t)n != len || memcmp(back, buf, len) != 0) {
+    return false; // "+1", "007", " 1"...
+  }
+  out = v;
+  return true;
+}
+
+// The intset in a string: a width byte, then the members in order.
+
+static size_t width_for(int64_t v) {
+  if (v >= INT16_MIN && v <= INT16_MAX) {
+    return 2;
+  }
+  return v >= INT32_MIN && v <= INT32_MAX ? 4 : 8;
+}
+
+static size_t is_width(const std::string &is) { return (uint8_t)is[0]; }
+
+static size_t is_len(const std::string &is) {
+  return is.empty() ? 0 : (is.size() - 1) / is_width(is);
+}
+
+static int64_t is_get(const std::string &is, size_t i) {
+  const char *p = is.data() + 1 + i * is_width(is);
+  switch (is_width(is)) {
+  case 2: {
+    int16_t v;
+    memcpy(&v, p, 2);
+    return v;
+  }
+  case 4: {
+    int32_t v;
+    memcpy(&v, p, 4);
+    return v;
+  }
+  default: {
+    int64_t v;
+    memcpy(&v, p, 8);
+    return v;
+  }
+  }
+}
+
+static void is_put(std::string &is, size_t i, int64_t v) {
+  char *p = &is[1 + i * is_width(is)];
+  switch (is_width(is)) {
+  case 2: {
+    int16_t n = (int16_t)v;
+    memcpy(p, &n, 2);
+    break;
+  }
+  case 4: {
+    int32_t n = (int32_t)v;
+    memcpy(p, &n, 4);
+    break;
+  }
+  default:
+    memcpy(p, &v, 8);
+  }
+}
+
+// where `v` is, or would go; true if it is there
+static bool is_search(const std::string &is, int64_t v, size_t &pos) {
+  size_t lo = 0;
+  size_t hi = is_len(is);
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    int64_t m = is_get(is, mid);
+    if (m == v) {
+      pos = mid;
+      return true;
+    }
+    if (m < v) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  pos = lo;
+  return false;
+}
+
+// re-encode every member at `width`
+static void is_resize(std::string &is, size_t width) {
+  size_t n = is_len(is);
+  std::string wider(1 + n * width, '\0');
+  wider[0] = (char)width;
+  for (size_t i = 0; i < n; i++) {
+    is_put(wider, i, is_get(is, i));
+  }
+  is.swap(wider);
+}
+
+static bool is_add(std::string &is, int64_t v) {
+  if (is.empty()) {
+    is.assign(1, (char)width_for(v));
+  } else if (width_for(v) > is_width(is)) {
+    is_resize(is, width_for(v));
+  }
+  size_t pos = 0;
+  if (is_search(is, v, pos)) {
+    return false;
+  }
+  size_t width = is_width(is);
+  is.insert(1 + pos * width, width, '\0');
+  is_put(is, pos, v);
+  return true;
+}
+
+static bool is_del(std::string &is, int64_t v) {
+  size_t pos = 0;
+  if (is.empty() || !is_search(is, v, pos)) {
+    return false;
+  }
+  size_t width = is_width(is);
+  is.erase(1 + pos * width, width);
+  return true;
+}
+
+static bool member_eq(HashNode *a, HashNode *b) {
+  return container_of(a, SetMember, node)->member ==
+         container_of(b, SetMember, node)->member;
+}
+
+SetDict::~SetDict() {
+  std::vector<SetMember *> members;
+  members.reserve(size());
+  foreach (
+      [](SetMember *m, void *arg) {
+        ((std::vector<SetMember *> *)arg)->push_back(m);
+        return true;
+      },
+      &members);
+  for (SetMember *m : members) {
+    delete m;
+  }
+}
+
+bool SetDict::contains(const std::string &member) {
+  SetMember key;
+  key.member = member;
+  key.node.hcode = hash(member);
+  return map_.lookup(&key.node, member_eq) != nullptr;
+}
+
+bool SetDict::add(const std::string &member) {
+  if (contains(member)) {
+    return false;
+  }
+  SetMember *m = new SetMember;
+  m->member = member;
+  m->node.hcode = hash(member);
+  map_.insert(&m->node);
+  return true;
+}
+
+bool SetDict::del(const std::string &member) {
+  SetMember key;
+  key.member = member;
+  key.node.hcode = hash(member);
+  HashNode *node = map_.remove(&key.node, member_eq);
+  if (!node) {
+    return false;
+  }
+  delete container_of(node, SetMember, node);
+  return true;
+}
+
+namespace {
+struct ForeachCtx {
+  bool (*fn)(SetMember *m, void *arg);
+  void *arg;
+};
+} // namespace
+
+void SetDict::foreach (bool (*fn)(SetMember *m, void *arg), void *arg) {
+  ForeachCtx ctx = {fn, arg};
+  auto callback = [](HashNode *node, void *arg) {
+    ForeachCtx &ctx = *(ForeachCtx *)arg;
+    return ctx.fn(container_of(node, SetMember, node), ctx.arg);
+  };
+  map_.foreach (callback, &ctx);
+}
+
+static SetDict *dict_of(Entry *ent) { return (SetDict *)ent->obj.get(); }
+
+// move an intset to a SetDict
+static void unpack(Entry *ent) {
+  SetDict *dict = new SetDict;
+  const std::string &is = ent->value;
+  for (size_t i = 0; i < is_len(is); i++) {
+    dict->add(std::to_string(is_get(is, i)));
+  }
+  ent->obj.reset(dict);
+  std::string().swap(ent->value);
+}
+
+bool set_add(Entry *ent, const std::string &member,
+             const EncodingLimits &limits) {
+  if (!ent->obj) {
+    int64_t v = 0;
+    if (member_to_int(member.data(), member.size(), v)) {
+      size_t pos = 0;
+      if (!ent->value.empty() && is_search(ent->value, v, pos)) {
+        return false;
+      }
+      if (is_len(ent->value) < limits.set_max_intset_entries) {
+        return is_add(ent->value, v);
+      }
+    }
+    unpack(ent);
+  }
+  return dict_of(ent)->add(member);
+}
+
+bool set_del(Entry *ent, const std::string &member) {
+  if (ent->obj) {
+    return dict_of(ent)->del(member);
+  }
+  int64_t v = 0;
+  return member_to_int(member.data(), member.size(), v) &&
+         is_del(ent->value, v);
+}
+
+bool set_contains(Entry *ent, const std::string &member) {
+  if (ent->obj) {
+    return dict_of(ent)->contains(member);
+  }
+  int64_t v = 0;
+  size_t pos = 0;
+  return member_to_int(member.data(), member.size(), v) &&
+         !ent->value.empty() && is_search(ent->value, v, pos);
+}
+
+size_t set_size(Entry *ent) {
+  return ent->obj ? dict_of(ent)->size() : is_len(ent->value);
+}
+
+namespace {
+struct SetForeachCtx {
+  void (*fn)(StrView member, void *arg);
+  void *arg;
+};
+} // namespace
+
+void set_foreach(Entry *ent, void (*fn)(StrView member, void *arg),
+                 void *arg) {
+  if (ent->obj) {
+    SetForeachCtx ctx = {fn, arg};
+    auto callback = [](SetMember *m, void *arg) {
+      SetForeachCtx &ctx = *(SetForeachCtx *)arg;
+      ctx.fn(StrView{m->member.data(), m->member.size()}, ctx.arg);
+      return true;
+    };
+    dict_of(ent)->foreach (callback, &ctx);
+    return;
+  }
+  const std::string &is = ent->value;
+  char buf[24];
+  for (size_t i = 0; i < is_len(is); i++) {
+    int n = snprintf(buf, sizeof(buf), "%" PRId64, is_get(is, i));
+    fn(StrView{buf, (size_t)n}, arg);
+  }
+}
+
+// scalar merge of the rest of two sorted arrays
+static size_t merge_tail(const int32_t *a, size_t i, size_t na,
+                         const int32_t *b, size_t j, size_t nb,
+                         int32_t *out) {
+  size_t k = 0;
+  while (i < na && j < nb) {
+    if (a[i] < b[j]) {
+      i++;
+    } else if (a[i] > b[j]) {
+      j++;
+    } else {
+      out[k++] = a[i];
+      i++;
+      j++;
+    }
+  }
+  return k;
+}
+
+// every value of the short `a` looked up in the long `b`, narrowing the
+// range of `b` as it goes
+static size_t gallop(const int32_t *a, size_t na, const int32_t *b,
+                     size_t nb, int32_t *out) {
+  size_t k = 0;
+  const int32_t *lo = b;
+  const int32_t *end = b + nb;
+  for (size_t i = 0; i < na && lo < end; i++) {
+    lo = std::lower_bound(lo, end, a[i]);
+    if (lo < end && *lo == a[i]) {
+      out[k++] = a[i];
+    }
+  }
+  return k;
+}
+
+size_t intersect_sorted(const int32_t *a, size_t na, const int32_t *b,
+                        size_t nb, int32_t *out) {
+  if (na > nb) {
+    std::swap(a, b);
+    std::swap(na, nb);
+  }
+  // past this ratio, binary searches touch less of `b` than a merge
+  if (na * 32 < nb) {
+    return gallop(a, na, b, nb, out);
+  }
+  size_t i = 0;
+  size_t j = 0;
+  size_t k = 0;
+#if defined(__SSE2__)
+  // Four of `a` against all four rotations of four of `b`: the lanes of
+  // `a` that matched anything are in the mask. The block with the smaller
+  // last value is done with (both, if they tie).
+  while (i + 4 <= na && j + 4 <= nb) {
+    __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+    __m128i vb = _mm_loadu_si128((const __m128i *)(b + j));
+    __m128i eq = _mm_cmpeq_epi32(va, vb);
+    vb = _mm_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1));
+    eq = _mm_or_si128(eq, _mm_cmpeq_epi32(va, vb));
+    vb = _mm_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1));
+    eq = _mm_or_si128(eq, _mm_cmpeq_epi32(va, vb));
+    vb = _mm_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1));
+    eq = _mm_or_si128(eq, _mm_cmpeq_epi32(va, vb));
+    int mask = _mm_movemask_ps(_mm_castsi128_ps(eq));
+    while (mask != 0) {
+      out[k++] = a[i + __builtin_ctz(mask)];
+      mask &= mask - 1;
+    }
+    int32_t amax = a[i + 3];
+    int32_t bmax = b[j + 3];
+    i += amax <= bmax ? 4 : 0;
+    j += bmax <= amax ? 4 : 0;
+  }
+#endif
+  return k + merge_tail(a, i, na, b, j, nb, out + k);
+}
+
+// the members of an intset of width 2 or 4, as 32-bit values
+static void is_decode32(const std::string &is, std::vector<int32_t> &out) {
+  size_t n = is_len(is);
+  out.resize(n);
+  if (n > 0 && is_width(is) == 4) {
+    memcpy(out.data(), is.data() + 1, n * 4);
+    return;
+  }
+  for (size_t i = 0; i < n; i++) {
+    out[i] = (int32_t)is_get(is, i);
+  }
+}
+
+namespace {
+struct InterCtx {
+  const std::vector<Entry *> *sets;
+  std::vector<std::string> *out;
+  std::string member;
+};
+} // namespace
+
+void set_inter(const std::vector<Entry *> &sets,
+               std::vector<std::string> &out) {
+  if (sets.empty()) {
+    return;
+  }
+  // smallest first: it bounds the result, and the others are only probed
+  std::vector<Entry *> order(sets);
+  std::sort(order.begin(), order.end(), [](Entry *x, Entry *y) {
+    return set_size(x) < set_size(y);
+  });
+  bool narrow = true;
+  for (Entry *ent : order) {
+    narrow = narrow && !ent->obj && !ent->value.empty() &&
+             is_width(ent->value) <= 4;
+  }
+  if (narrow) {
+    // all sorted 32-bit arrays: merge them with the vector kernel
+    std::vector<int32_t> acc;
+    std::vector<int32_t> other;
+    std::vector<int32_t> tmp;
+    is_decode32(order[0]->value, acc);
+    for (size_t s = 1; s < order.size() && !acc.empty(); s++) {
+      is_decode32(order[s]->value, other);
+      tmp.resize(acc.size());
+      tmp.resize(intersect_sorted(acc.data(), acc.size(), other.data(),
+                                  other.size(), tmp.data()));
+      acc.swap(tmp);
+    }
+    for (int32_t v : acc) {
+      out.push_back(std::to_string(v));
+    }
+    return;
+  }
+  InterCtx ctx = {&order, &out, {}};
+  auto callback = [](StrView member, void *arg) {
+    InterCtx &ctx = *(InterCtx *)arg;
+    ctx.member.assign(member.data, member.size);
+    for (size_t s = 1; s < ctx.sets->size(); s++) {
+      if (!set_contains((*ctx.sets)[s], ctx.member)) {
+        return;
+      }
+    }
+    ctx.out->push_back(ctx.member);
+  };
+  set_foreach(order[0], callback, &ctx);
+}
+
+void set_union(const std::vector<Entry *> &sets,
+               std::vector<std::string> &out) {
+  std::unordered_set<std::string> seen;
+  auto callback = [](StrView member, void *arg) {
+    ((std::unordered_set<std::string> *)arg)->insert(member.str());
+  };
+  for (Entry *ent : sets) {
+    set_foreach(ent, callback, &seen);
+  }
+  out.insert(out.end(), seen.begin(), seen.end());
+}
+
+// A packed set is an intset as it is, or a 0 byte (which no intset starts
+// with) and a listpack of the members.
+void set_pack(Entry *ent, std::string &out) {
+  if (!ent->obj) {
+    out = ent->value;
+    return;
+  }
+  out.assign(1, '\0');
+  auto callback = [](StrView member, void *arg) {
+    lp_append(*(std::string *)arg, member.data, member.size);
+  };
+  set_foreach(ent, callback, &out);
+}
+
+bool set_restore(Entry *ent, const EncodingLimits &limits) {
+  std::string &packed = ent->value;
+  if (packed.empty()) {
+    return false;
+  }
+  if (packed[0] != '\0') {
+    size_t width = is_width(packed);
+    if ((width != 2 && width != 4 && width != 8) ||
+        (packed.size() - 1) % width != 0) {
+      return false;
+    }
+    for (size_t i = 1; i < is_len(packed); i++) {
+      if (is_get(packed, i - 1) >= is_get(packed, i)) {
+        return false; // not sorted
+      }
+    }
+    if (is_len(packed) > limits.set_max_intset_entries) {
+      unpack(ent);
+    }
+    return true;
+  }
+  std::string lp = packed.substr(1);
+  if (!lp_valid(lp)) {
+    return false;
+  }
+  std::string().swap(packed);
+  // whatever it was saved as, it may fit an intset under these limits
+  for (size_t pos = 0; pos < lp.size();) {
+    set_add(ent, lp_get(lp, pos, &pos).str(), limits);
+  }
+  return true;
+}
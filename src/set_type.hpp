@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "keystore.hpp"
+#include "strview.hpp"
+
+// Set values. A small set of integers is an intset packed in `Entry::value`:
+// a width byte (2, 4 or 8) and the members sorted, all of that width, so
+// lookups are a binary search. The width grows to fit the widest member.
+// A member that is not an integer, or more than
+// `EncodingLimits::set_max_intset_entries` members, moves the set to a
+// SetDict in `Entry::obj` for good.
+
+struct SetMember {
+  HashNode node;
+  std::string member;
+};
+
+class SetDict : public Object {
+public:
+  ~SetDict() override;
+
+  bool contains(const std::string &member);
+  // returns true if `member` is new
+  bool add(const std::string &member);
+  bool del(const std::string &member);
+  size_t size() { return map_.size(); }
+  void foreach (bool (*fn)(SetMember *m, void *arg), void *arg);
+
+private:
+  HashMap map_;
+};
+
+// returns true if `member` is new
+bool set_add(Entry *ent, const std::string &member,
+             const EncodingLimits &limits);
+bool set_del(Entry *ent, const std::string &member);
+bool set_contains(Entry *ent, const std::string &member);
+size_t set_size(Entry *ent);
+void set_foreach(Entry *ent, void (*fn)(StrView member, void *arg),
+                 void *arg);
+// the members common to all of `sets`
+void set_inter(const std::vector<Entry *> &sets,
+               std::vector<std::string> &out);
+// the members of any of `sets`
+void set_union(const std::vector<Entry *> &sets,
+               std::vector<std::string> &out);
+// the packed encoding of the set, whichever encoding it is in
+void set_pack(Entry *ent, std::string &out);
+// `ent->value` was packed by set_pack() and read back: check it and
+// unpack it as needed
+bool set_restore(Entry *ent, const EncodingLimits &limits);
+
+/**
+ * @brief the values in both of two sorted arrays without duplicates
+ *
+ * Compares four values of `a` against four of `b` at a time with SSE2, and
+ * gallops with binary searches when one array is much shorter.
+ * @param out room for the shorter of the two
+ * @return the number of values written to `out`
+ */
+size_t intersect_sorted(const int32_t *a, size_t na, const int32_t *b,
+                        size_t nb, int32_t *out);
@@ -0,0 +1,305 @@
+#include "shm.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+size_t ShmRing::readable() const {
+  uint64_t head = header_->head.load(std::memory_order_acquire);
+  uint64_t tail = header_->tail.load(std::memory_order_relaxed);
+  // the peer can write anything into the header; stay inside the mapping
+  return std::min<uint64_t>(head - tail, capacity_);
+}
+
+size_t ShmRing::writable() const {
+  uint64_t head = header_->head.load(std::memory_order_relaxed);
+  uint64_t tail = header_->tail.load(std::memory_order_acquire);
+  return capacity_ - std::min<uint64_t>(head - tail, capacity_);
+}
+
+size_t ShmRing::read(uint8_t *buf, size_t len) {
+  size_t n = std::min(len, readable());
+  if (n == 0) {
+    return 0;
+  }
+  uint64_t tail = header_->tail.load(std::memory_order_relaxed);
+  size_t off = tail & (capacity_ - 1);
+  size_t first = std::min<size_t>(n, capacity_ - off);
+  memcpy(buf, data_ + off, first);
+  memcpy(buf + first, data_, n - first);
+  header_->tail.store(tail + n, std::memory_order_release);
+  return n;
+}
+
+size_t ShmRing::write(const uint8_t *buf, size_t len) {
+  size_t n = std::min(len, writable());
+  if (n == 0) {
+    return 0;
+  }
+  uint64_t head = header_->head.load(std::memory_order_relaxed);
+  size_t off = head & (capacity_ - 1);
+  size_t first = std::min<size_t>(n, capacity_ - off);
+  memcpy(data_ + off, buf, first);
+  memcpy(data_, buf + first, n - first);
+  header_->head.store(head + n, std::memory_order_release);
+  return n;
+}
+
+// The flag store and the re-check pair with the fence in notify_*(): either
+// the sleeper sees the new data, or the other side sees the flag.
+bool ShmRing::arm_consumer() {
+  header_->consumer_waiting.store(1, std::memory_order_seq_cst);
+  if (readable() > 0) {
+    header_->consumer_waiting.store(0, std::memory_order_relaxed);
+    return false;
+  }
+  return true;
+}
+
+bool ShmRing::arm_producer() {
+  header_->producer_waiting.store(1, std::memory_order_seq_cst);
+  if (writable() > 0) {
+    header_->producer_waiting.store(0, std::memory_order_relaxed);
+    return false;
+  }
+  return true;
+}
+
+void ShmRing::disarm_consumer() {
+  header_->consumer_waiting.store(0, std::memory_order_relaxed);
+}
+
+void ShmRing::disarm_producer() {
+  header_->producer_waiting.store(0, std::memory_order_relaxed);
+}
+
+void ShmRing::notify_consumer(int efd) {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (header_->consumer_waiting.load(std::memory_order_relaxed) &&
+      header_->consumer_waiting.exchange(0)) {
+    eventfd_write(efd, 1);
+  }
+}
+
+void ShmRing::notify_producer(int efd) {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (header_->producer_waiting.load(std::memory_order_relaxed) &&
+      header_->producer_waiting.exchange(0)) {
+    eventfd_write(efd, 1);
+  }
+}
+
+bool shm_should_spin() {
+  static const bool spin = sysconf(_SC_NPROCESSORS_ONLN) > 1;
+  return spin;
+}
+
+ShmRegion::~ShmRegion() {
+  if (addr_ != nullptr) {
+    munmap(addr_, size_);
+  }
+  for (int fd : {memfd_, server_efd_, client_efd_}) {
+    if (fd != -1) {
+      close(fd);
+    }
+  }
+}
+
+bool ShmRegion::init_view() {
+  if (size_ <= k_header_size) {
+    return false;
+  }
+  uint64_t capacity = (size_ - k_header_size) / 2;
+  if (capacity == 0 || (capacity & (capacity - 1)) != 0 ||
+      k_header_size + 2 * capacity != size_) {
+    return false;
+  }
+  addr_ = mmap(NULL, size_, PROT_READ | PROT_WRITE, MAP_SHARED, memfd_, 0);
+  if (addr_ == MAP_FAILED) {
+    addr_ = nullptr;
+    return false;
+  }
+  uint8_t *base = (uint8_t *)addr_;
+  requests_ = ShmRing((ShmRingHeader *)base, base + k_header_size, capacity);
+  replies_ = ShmRing((ShmRingHeader *)(base + 256),
+                     base + k_header_size + capacity, capacity);
+  return true;
+}
+
+std::unique_ptr<ShmRegion> ShmRegion::create(size_t ring_size) {
+  static_assert(2 * sizeof(ShmRingHeader) <= k_header_size,
+                "ring headers must fit in the first page");
+  std::unique_ptr<ShmRegion> region(new ShmRegion());
+  region->memfd_ = memfd_create("simple-redis-shm", MFD_CLOEXEC);
+  region->server_efd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  region->client_efd_ = eventfd(0, EFD_CLOEXEC);
+  region->size_ = k_header_size + 2 * ring_size;
+  if (region->memfd_ < 0 || region->server_efd_ < 0 ||
+      region->client_efd_ < 0 ||
+      ftruncate(region->memfd_, region->size_) < 0 || !region->init_view()) {
+    return nullptr;
+  }
+  // fresh pages are zero, which is an empty ring with nobody waiting
+  uint8_t *base = (uint8_t *)region->addr_;
+  new (base) ShmRingHeader();
+  new (base + 256) ShmRingHeader();
+  ((ShmRingHeader *)base)->capacity = ring_size;
+  ((ShmRingHeader *)(base + 256))->capacity = ring_size;
+  return region;
+}
+
+std::unique_ptr<ShmRegion> ShmRegion::map(int memfd, int server_efd,
+                                          int client_efd) {
+  std::unique_ptr<ShmRegion> region(new ShmRegion());
+  region->memfd_ = memfd;
+  region->server_efd_ = server_efd;
+  region->client_efd_ = client_efd;
+  struct stat st = {};
+  if (fstat(memfd, &st) < 0) {
+    return nullptr;
+  }
+  region->size_ = st.st_size;
+  if (!region->init_view()) {
+    return nullptr;
+  }
+  return region;
+}
+
+void ShmRegion::drain_efd(int efd) {
+  eventfd_t value = 0;
+  eventfd_read(efd, &value);
+}
+
+bool shm_send_fds(int sock, const ShmRegion &region, const uint8_t *data,
+                  size_t len) {
+  int fds[3] = {region.memfd(), region.server_efd(), region.client_efd()};
+  union {
+    char buf[CMSG_SPACE(sizeof(fds))];
+    struct cmsghdr align;
+  } control = {};
+  struct iovec iov = {(void *)data, len};
+  struct msghdr msg = {};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+  ssize_t rv = sendmsg(sock, &msg, MSG_NOSIGNAL);
+  return rv == (ssize_t)len;
+}
+
+bool ShmClient::attach(int sock) {
+  // `shmattach` in the request wire format
+  const char name[] = "shmattach";
+  uint32_t nlen = sizeof(name) - 1;
+  uint32_t nstr = 1;
+  uint32_t len = 4 + 4 + nlen;
+  uint8_t req[4 + 4 + 4 + sizeof(name)];
+  memcpy(req, &len, 4);
+  memcpy(req + 4, &nstr, 4);
+  memcpy(req + 8, &nlen, 4);
+  memcpy(req + 12, name, nlen);
+  if (write(sock, req, 4 + len) != (ssize_t)(4 + len)) {
+    return false;
+  }
+
+  // the reply frame, with the descriptors riding on its first bytes
+  uint8_t reply[64];
+  int fds[3] = {-1, -1, -1};
+  union {
+    char buf[CMSG_SPACE(sizeof(fds))];
+    struct cmsghdr align;
+  } control = {};
+  struct iovec iov = {reply, sizeof(reply)};
+  struct msghdr msg = {};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+  ssize_t rv = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+  if (rv < 5) {
+    return false;
+  }
+  for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+        cmsg->cmsg_len == CMSG_LEN(sizeof(fds))) {
+      memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    }
+  }
+  if (fds[0] == -1) {
+    return false; // an error reply, the server kept the socket transport
+  }
+  region_ = ShmRegion::map(fds[0], fds[1], fds[2]);
+  sock_ = sock;
+  return region_ != nullptr;
+}
+
+bool ShmClient::wait() {
+  struct pollfd pfds[2] = {{region_->client_efd(), POLLIN, 0},
+                           {sock_, POLLIN, 0}};
+  while (true) {
+    int rv = poll(pfds, 2, -1);
+    if (rv < 0 && errno != EINTR) {
+      return false;
+    }
+    if (pfds[1].revents != 0) {
+      return false; // nothing else ever arrives on the socket: closed
+    }
+    if (pfds[0].revents != 0) {
+      ShmRegion::drain_efd(region_->client_efd());
+      return true;
+    }
+  }
+}
+
+bool ShmClient::send(const uint8_t *data, size_t len) {
+  ShmRing &ring = region_->requests();
+  while (true) {
+    size_t n = ring.write(data, len);
+    ring.notify_consumer(region_->server_efd());
+    data += n;
+    len -= n;
+    if (len == 0) {
+      return true;
+    }
+    if (ring.arm_producer() && !wait()) {
+      return false;
+    }
+  }
+}
+
+bool ShmClient::recv(uint8_t *buf, size_t len) {
+  ShmRing &ring = region_->replies();
+  while (true) {
+    size_t n = ring.read(buf, len);
+    if (n > 0) {
+      ring.notify_producer(region_->server_efd());
+    }
+    buf += n;
+    len -= n;
+    if (len == 0) {
+      return true;
+    }
+    // a reply is usually a few microseconds away; spin before sleeping
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::microseconds(int(k_spin_us));
+    while (shm_should_spin() && ring.readable() == 0 &&
+           std::chrono::steady_clock::now() < deadline) {
+    }
+    if (ring.readable() == 0 && ring.arm_consumer() && !wait()) {
+      return false;
+    }
+  }
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// Shared-memory transport for clients on the same host.
+//
+// A client connected over the unix socket sends `shmattach` as its first
+// request. The server answers with the usual reply frame, sent with
+// SCM_RIGHTS carrying a memfd and two eventfds. From then on requests go
+// through the request ring and replies come back through the reply ring,
+// in the same length-prefixed frames as on a socket; the socket only tells
+// the server when the client goes away.
+//
+// memfd layout:
+//   page 0:    request ring header, reply ring header (one cache line each
+//              for the producer and consumer fields)
+//   page 1...: request ring data, then reply ring data
+//
+// Each ring has one producer and one consumer that only ever advance their
+// own counter. A side about to block sets the peer's `*_waiting` flag and
+// checks the ring once more; the peer rings the eventfd only when it sees
+// the flag, so a busy pair never makes a syscall. The server's eventfd wakes
+// it for request data and for reply space, the client's for the reverse.
+
+struct ShmRingHeader {
+  alignas(64) std::atomic<uint64_t> head; // bytes written
+  std::atomic<uint32_t> producer_waiting; // producer sleeps until space
+  alignas(64) std::atomic<uint64_t> tail; // bytes read
+  std::atomic<uint32_t> consumer_waiting; // consumer sleeps until data
+  alignas(64) uint64_t capacity;          // power of 2
+};
+
+class ShmRing {
+public:
+  ShmRing() = default;
+  // `capacity` is kept on our side, the header is writable by the peer
+  ShmRing(ShmRingHeader *header, uint8_t *data, uint64_t capacity)
+      : header_(header), data_(data), capacity_(capacity) {}
+
+  size_t readable() const;
+  size_t writable() const;
+  // copy out as much as is there, up to `len`
+  size_t read(uint8_t *buf, size_t len);
+  // copy in as much as fits, up to `len`
+  size_t write(const uint8_t *buf, size_t len);
+
+  // the consumer is about to sleep: returns false if data arrived meanwhile
+  bool arm_consumer();
+  // the producer is about to sleep: returns false if space appeared
+  bool arm_producer();
+  // woken up some other way, no need for the eventfd
+  void disarm_consumer();
+  void disarm_producer();
+  // after a write/read: wake the other side if it is asleep
+  void notify_consumer(int efd);
+  void notify_producer(int efd);
+
+private:
+  ShmRingHeader *header_ = nullptr;
+  uint8_t *data_ = nullptr;
+  uint64_t capacity_ = 0;
+};
+
+// The mapping shared by one client and the server.
+class ShmRegion {
+public:
+  ~ShmRegion();
+
+  // server: create a fresh region with rings of `ring_size` bytes
+  static std::unique_ptr<ShmRegion> create(size_t ring_size);
+  // client: map the region received from the server
+  static std::unique_ptr<ShmRegion> map(int memfd, int server_efd,
+                                        int client_efd);
+
+  int memfd() const { return memfd_; }
+  int server_efd() const { return server_efd_; }
+  int client_efd() const { return client_efd_; }
+  ShmRing &requests() { return requests_; }
+  ShmRing &replies() { return replies_; }
+  // reset an eventfd after it woke us
+  static void drain_efd(int efd);
+
+private:
+  static const size_t k_header_size = 4096;
+
+  ShmRegion() = default;
+  bool init_view();
+
+  int memfd_ = -1;
+  int server_efd_ = -1;
+  int client_efd_ = -1;
+  void *addr_ = nullptr;
+  size_t size_ = 0;
+  ShmRing requests_;
+  ShmRing replies_;
+};
+
+// spinning only pays off when the peer runs on another CPU meanwhile
+bool shm_should_spin();
+
+// send `len` bytes with the region's descriptors attached
+bool shm_send_fds(int sock, const ShmRegion &region, const uint8_t *data,
+                  size_t len);
+
+// Client side of the transport, blocking.
+class ShmClient {
+public:
+  /**
+   * @brief attach over `sock`, a connected unix socket with nothing in
+   * flight
+   *
+   * @return false if the server refused or the descriptors did not arrive
+   */
+  bool attach(int sock);
+  // queue an encoded request, waiting while the ring is full
+  bool send(const uint8_t *data, size_t len);
+  // read exactly `len` bytes of replies, spinning for a short while before
+  // sleeping on the eventfd
+  bool recv(uint8_t *buf, size_t len);
+
+private:
+  static const int k_spin_us = 20;
+  int sock_ = -1;
+  std::unique_ptr<ShmRegion> region_;
+
+  // sleep on our eventfd; false if the server went away
+  bool wait();
+};
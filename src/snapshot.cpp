@@ -0,0 +1,409 @@
+#include "snapshot.hpp"
+#include "global.hpp"
+#include "logger.hpp"
+#include "request.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+static const char k_magic[4] = {'S', 'R', 'D', 'B'};
+static const uint32_t k_version = 3;
+// segments are cut once their payload reaches this size
+static const size_t k_segment_bytes = 4 * 1024 * 1024;
+
+namespace {
+struct FileHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t nrecords;
+};
+static_assert(sizeof(FileHeader) == 16, "FileHeader must be packed");
+
+struct SegmentHeader {
+  uint64_t len;
+  uint32_t nrecords;
+  uint32_t crc;
+};
+static_assert(sizeof(SegmentHeader) == 16, "SegmentHeader must be packed");
+
+struct RecordHeader {
+  uint32_t klen;
+  uint32_t vlen;
+  int64_t expire_at;
+  uint8_t type; // ValueType; the value is what KeyStore::packed() gives
+  uint8_t reserved[7];
+};
+static_assert(sizeof(RecordHeader) == 24, "RecordHeader must be packed");
+
+struct SaveCtx {
+  int fd = -1;
+  std::vector<uint8_t> seg; // payload of the current segment
+  uint32_t nrecords = 0;
+  uint64_t now_mono = 0;
+  uint64_t now_real = 0;
+  std::string scratch; // packed containers
+  bool ok = true;
+
+  void put(const void *data, size_t len) {
+    const uint8_t *p = (const uint8_t *)data;
+    seg.insert(seg.end(), p, p + len);
+  }
+  void write_segment() {
+    SegmentHeader sh = {seg.size(), nrecords, crc32c(0, seg.data(), seg.size())};
+    if (!write_all(fd, (const char *)&sh, sizeof(sh)) ||
+        !write_all(fd, (const char *)seg.data(), seg.size())) {
+      ok = false;
+    }
+    seg.clear();
+    nrecords = 0;
+  }
+};
+} // namespace
+
+// Write the snapshot to `tmp` and rename it to `path`. This also runs in the
+// forked child, so it must not log.
+static bool write_snapshot(const std::string &tmp, const std::string &path) {
+  SaveCtx ctx;
+  ctx.fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (ctx.fd < 0) {
+    return false;
+  }
+  ctx.now_mono = get_monotonic_msec();
+  ctx.now_real = get_realtime_msec();
+  ctx.seg.reserve(k_segment_bytes);
+
+  FileHeader header = {};
+  memcpy(header.magic, k_magic, sizeof(k_magic));
+  header.version = k_version;
+  header.nrecords = GlobalState::store().size();
+  ctx.ok = write_all(ctx.fd, (const char *)&header, sizeof(header));
+
+  auto callback = [](Entry *ent, void *arg) {
+    SaveCtx &ctx = *(SaveCtx *)arg;
+    const std::string &value = GlobalState::store().packed(ent, ctx.scratch);
+    RecordHeader rec = {(uint32_t)ent->key.size(), (uint32_t)value.size(), -1,
+                        (uint8_t)ent->type, {}};
+    if (ent->has_ttl()) {
+      uint64_t expire_at = GlobalState::store().expire_at(ent);
+      uint64_t ttl = expire_at > ctx.now_mono ? expire_at - ctx.now_mono : 0;
+      rec.expire_at = (int64_t)(ctx.now_real + ttl);
+    }
+    ctx.put(&rec, sizeof(rec));
+    ctx.put(ent->key.data(), ent->key.size());
+    ctx.put(value.data(), value.size());
+    ctx.nrecords++;
+    if (ctx.seg.size() >= k_segment_bytes) {
+      ctx.write_segment();
+    }
+    return ctx.ok;
+  };
+  GlobalState::store().foreach (callback, &ctx);
+  if (ctx.nrecords > 0) {
+    ctx.write_segment();
+  }
+
+  SegmentHeader end = {0, 0, crc32c(0, &header, sizeof(header))};
+  bool ok = ctx.ok && write_all(ctx.fd, (const char *)&end, sizeof(end)) &&
+            fdatasync(ctx.fd) == 0;
+  close(ctx.fd);
+  if (!ok || rename(tmp.c_str(), path.c_str()) < 0) {
+    unlink(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+namespace {
+struct Segment {
+  const uint8_t *data;
+  SegmentHeader header;
+};
+
+// what one loader thread produced: the new entries binned by the range of
+// buckets they go to, and the ones that need a TTL
+struct LoadResult {
+  std::vector<std::vector<HashNode *>> parts;
+  std::vector<std::pair<Entry *, int64_t>> ttls;
+  uint64_t nkeys = 0;
+  bool ok = true;
+};
+
+class Stopwatch {
+public:
+  Stopwatch() : last_(std::chrono::steady_clock::now()) {}
+  // milliseconds since the previous lap
+  double lap() {
+    auto now = std::chrono::steady_clock::now();
+    double ms = std::chrono::duration<double, std::milli>(now - last_).count();
+    last_ = now;
+    return ms;
+  }
+
+private:
+  std::chrono::steady_clock::time_point last_;
+};
+} // namespace
+
+static bool parse_segment(const Segment &seg, uint64_t now_real,
+                          size_t bucket_mask, unsigned part_shift,
+                          LoadResult &out) {
+  const uint8_t *p = seg.data;
+  const uint8_t *end = seg.data + seg.header.len;
+  if (crc32c(0, p, seg.header.len) != seg.header.crc) {
+    return false;
+  }
+  for (uint32_t i = 0; i < seg.header.nrecords; i++) {
+    RecordHeader rec = {};
+    if ((size_t)(end - p) < sizeof(rec)) {
+      return false;
+    }
+    memcpy(&rec, p, sizeof(rec));
+    p += sizeof(rec);
+    if ((size_t)(end - p) < (size_t)rec.klen + rec.vlen) {
+      return false;
+    }
+    if (rec.expire_at >= 0 && (uint64_t)rec.expire_at <= now_real) {
+      p += rec.klen + rec.vlen;
+      continue; // expired while on disk
+    }
+    Entry *ent = new Entry;
+    ent->key.assign((const char *)p, rec.klen);
+    std::string value((const char *)p + rec.klen, rec.vlen);
+    p += rec.klen + rec.vlen;
+    // the limits are only read, so the loader threads can share them
+    if (!GlobalState::store().restore(ent, (ValueType)rec.type,
+                                      std::move(value))) {
+      delete ent;
+      return false;
+    }
+    ent->node.hcode = hash(ent->key);
+    out.parts[(ent->node.hcode & bucket_mask) >> part_shift].push_back(
+        &ent->node);
+    if (rec.expire_at >= 0) {
+      out.ttls.emplace_back(ent, rec.expire_at - (int64_t)now_real);
+    }
+    out.nkeys++;
+  }
+  return p == end;
+}
+
+static size_t next_pow2(size_t n) {
+  size_t v = 1;
+  while (v < n) {
+    v <<= 1;
+  }
+  return v;
+}
+
+static unsigned log2_pow2(size_t n) {
+  unsigned k = 0;
+  while (((size_t)1 << k) < n) {
+    k++;
+  }
+  return k;
+}
+
+int64_t Snapshot::load(const std::string &path) {
+  Stopwatch watch;
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    if (errno == ENOENT) {
+      return 0;
+    }
+    LOG(ERROR, "open {} failed: {}", path, strerror(errno));
+    return -1;
+  }
+  struct stat st = {};
+  if (fstat(fd, &st) < 0) {
+    LOG(ERROR, "fstat {} failed: {}", path, strerror(errno));
+    close(fd);
+    return -1;
+  }
+  size_t size = st.st_size;
+  if (size < sizeof(FileHeader) + sizeof(SegmentHeader)) {
+    LOG(ERROR, "{} is too short", path);
+    close(fd);
+    return -1;
+  }
+  void *addr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    LOG(ERROR, "mmap {} failed: {}", path, strerror(errno));
+    return -1;
+  }
+  madvise(addr, size, MADV_WILLNEED);
+  const uint8_t *data = (const uint8_t *)addr;
+  double ms_map = watch.lap();
+
+  // index: hop over the segment headers
+  FileHeader header = {};
+  memcpy(&header, data, sizeof(header));
+  if (memcmp(header.magic, k_magic, sizeof(k_magic)) != 0 ||
+      header.version != k_version) {
+    LOG(ERROR, "{} is not a version {} snapshot", path, k_version);
+    munmap(addr, size);
+    return -1;
+  }
+  std::vector<Segment> segments;
+  uint64_t nrecords = 0;
+  bool ok = false;
+  for (size_t off = sizeof(header); size - off >= sizeof(SegmentHeader);) {
+    Segment seg = {data + off + sizeof(SegmentHeader), {}};
+    memcpy(&seg.header, data + off, sizeof(SegmentHeader));
+    off += sizeof(SegmentHeader);
+    if (seg.header.len == 0 && seg.header.nrecords == 0) {
+      ok = off == size && seg.header.crc == crc32c(0, &header, sizeof(header));
+      break;
+    }
+    if (seg.header.len > size - off) {
+      break;
+    }
+    segments.push_back(seg);
+    nrecords += seg.header.nrecords;
+    off += seg.header.len;
+  }
+  if (!ok || nrecords != header.nrecords) {
+    LOG(ERROR, "{}: bad segment list", path);
+    munmap(addr, size);
+    return -1;
+  }
+  double ms_index = watch.lap();
+
+  // parse: every thread takes the next segment until none are left, and bins
+  // its entries by the slice of the final table they will land in
+  size_t nbuckets = next_pow2(nrecords > 0 ? nrecords : 1);
+  unsigned nthreads = std::max(1u, std::thread::hardware_concurrency());
+  size_t nparts = std::min(next_pow2(nthreads * 8), nbuckets);
+  unsigned part_shift = log2_pow2(nbuckets) - log2_pow2(nparts);
+  uint64_t now_real = get_realtime_msec();
+  std::vector<LoadResult> results(nthreads);
+  std::atomic<size_t> next_seg{0};
+  std::vector<std::thread> threads;
+  for (unsigned t = 0; t < nthreads; t++) {
+    results[t].parts.resize(nparts);
+    threads.emplace_back([&, t]() {
+      LoadResult &out = results[t];
+      for (size_t i = next_seg++; i < segments.size() && out.ok;
+           i = next_seg++) {
+        out.ok = parse_segment(segments[i], now_real, nbuckets - 1, part_shift,
+                               out);
+      }
+    });
+  }
+  for (std::thread &th : threads) {
+    th.join();
+  }
+  threads.clear();
+  munmap(addr, size);
+  uint64_t nkeys = 0;
+  for (const LoadResult &r : results) {
+    ok = ok && r.ok;
+    nkeys += r.nkeys;
+  }
+  if (!ok) {
+    LOG(ERROR, "{}: corrupt segment", path);
+    for (const LoadResult &r : results) {
+      for (const auto &part : r.parts) {
+        for (HashNode *node : part) {
+          delete container_of(node, Entry, node);
+        }
+      }
+    }
+    return -1;
+  }
+  double ms_parse = watch.lap();
+
+  // merge: each slice of buckets is owned by one thread, so the nodes are
+  // linked in without locks, and without rehashing, with the hash codes
+  // computed while parsing
+  HashTable table(nbuckets);
+  std::atomic<size_t> next_part{0};
+  for (unsigned t = 0; t < nthreads; t++) {
+    threads.emplace_back([&]() {
+      for (size_t p = next_part++; p < nparts; p = next_part++) {
+        for (LoadResult &r : results) {
+          for (HashNode *node : r.parts[p]) {
+            table.link(node);
+          }
+          std::vector<HashNode *>().swap(r.parts[p]);
+        }
+      }
+    });
+  }
+  for (std::thread &th : threads) {
+    th.join();
+  }
+  table.set_size(nkeys);
+  double ms_merge = watch.lap();
+
+  KeyStore &store = GlobalState::store();
+  store.install(std::move(table));
+  for (const LoadResult &r : results) {
+    for (const auto &item : r.ttls) {
+      store.set_ttl(item.first, item.second);
+    }
+  }
+  double ms_ttl = watch.lap();
+
+  LOG(INFO,
+      "loaded {} with {} threads: {} segments, mmap {}ms, index {}ms, "
+      "parse {}ms, merge {}ms, ttl {}ms",
+      path, nthreads, segments.size(), ms_map, ms_index, ms_parse, ms_merge,
+      ms_ttl);
+  return nkeys;
+}
+
+bool Snapshot::save(const std::string &path) {
+  if (!write_snapshot(path + ".tmp", path)) {
+    LOG(ERROR, "saving {} failed: {}", path, strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+bool Snapshot::start_bgsave(const std::string &path) {
+  if (saving()) {
+    return false;
+  }
+  pid_t pid = fork();
+  if (pid < 0) {
+    LOG(ERROR, "fork failed: {}", strerror(errno));
+    return false;
+  }
+  if (pid == 0) {
+    std::string tmp = path + ".tmp." + std::to_string(getpid());
+    _exit(write_snapshot(tmp, path) ? 0 : 1);
+  }
+  LOG(INFO, "background saving started by child {}", pid);
+  child_ = pid;
+  path_ = path;
+  return true;
+}
+
+void Snapshot::cron() {
+  if (!saving()) {
+    return;
+  }
+  int status = 0;
+  pid_t pid = waitpid(child_, &status, WNOHANG);
+  if (pid == 0) {
+    return;
+  }
+  bool ok = pid == child_ && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  if (ok) {
+    LOG(INFO, "background saving to {} done", path_);
+  } else {
+    LOG(ERROR, "background saving to {} failed", path_);
+  }
+  child_ = -1;
+  // replicas waiting for a full resync get this snapshot
+  GlobalState::replication().bgsave_done(ok);
+}
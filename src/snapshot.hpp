@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <sys/types.h>
+
+// Snapshot is a point-in-time binary dump of the keyspace and its TTLs.
+//
+// Layout, all integers little endian:
+//   header:  "SRDB" | u32 version | u64 number of records
+//   segment: u64 payload bytes | u32 records | u32 crc32c of payload | payload
+//   end:     a segment header with 0 bytes, 0 records and the crc32c of the
+//            file header
+// The payload of a segment is a run of records:
+//   record:  u32 klen | u32 vlen | i64 expire_at | key | value
+// `expire_at` is a wall-clock deadline in ms, or -1 for no TTL. A record is a
+// fixed-size header followed by the raw bytes, so loading it is one memcpy
+// per field. Segments are self-contained and checksummed on their own, so
+// the loader parses them on all cores.
+class Snapshot {
+public:
+  /**
+   * @brief load the snapshot at `path` into an empty keyspace
+   *
+   * The file is mmapped and its segments are parsed in parallel into a table
+   * presized for all of the records; the time of each phase is logged.
+   *
+   * @return number of keys loaded (expired ones are skipped), 0 if there is
+   * no such file, or -1 on error
+   */
+  int64_t load(const std::string &path);
+  // write the snapshot from the event loop, blocking it
+  bool save(const std::string &path);
+  // fork a child that writes the snapshot while the parent keeps serving
+  bool start_bgsave(const std::string &path);
+  bool saving() const { return child_ != -1; }
+  // called once per loop iteration to reap a finished child
+  void cron();
+
+private:
+  pid_t child_ = -1;
+  std::string path_;
+};
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+// Bytes inside someone else's buffer.
+struct StrView {
+  const char *data = nullptr;
+  size_t size = 0;
+
+  std::string str() const { return std::string(data, size); }
+  bool operator==(const std::string &s) const {
+    return s.size() == size && memcmp(s.data(), data, size) == 0;
+  }
+};
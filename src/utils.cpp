@@ -1,4 +1,6 @@
 #include "utils.hpp"
+#include <algorithm>
+#include <time.h>
 
 uint64_t get_monotonic_msec() {
   struct timespec tv = {0, 0};
@@ -6,6 +8,18 @@ uint64_t get_monotonic_msec() {
   return uint64_t(tv.tv_sec) * 1000 + tv.tv_nsec / 1000 / 1000;
 }
 
+uint64_t get_monotonic_usec() {
+  struct timespec tv = {0, 0};
+  clock_gettime(CLOCK_MONOTONIC, &tv);
+  return uint64_t(tv.tv_sec) * 1000000 + tv.tv_nsec / 1000;
+}
+
+uint64_t get_realtime_msec() {
+  struct timespec tv = {0, 0};
+  clock_gettime(CLOCK_REALTIME, &tv);
+  return uint64_t(tv.tv_sec) * 1000 + tv.tv_nsec / 1000 / 1000;
+}
+
 bool read_all(int fd, char *buf, size_t len) {
   ssize_t n = 0;
   while (n < len) {
@@ -46,13 +60,13 @@ void fd_set_nb(int fd) {
   errno = 0;
   int flags = fcntl(fd, F_GETFL, 0);
   if (errno != 0) {
-    LOG(FATAL) << "fcntl(F_GETFL) failed: " << strerror(errno) << "\n";
+    LOG(FATAL, "fcntl(F_GETFL) failed: {}", strerror(errno));
     abort();
   }
   errno = 0;
   fcntl(fd, F_SETFL, flags | O_NONBLOCK);
   if (errno != 0) {
-    LOG(FATAL) << "fcntl(F_SETFL) failed: " << strerror(errno) << "\n";
+    LOG(FATAL, "fcntl(F_SETFL) failed: {}", strerror(errno));
     abort();
   }
 }
@@ -64,4 +78,189 @@ bool read_u32(const uint8_t *&begin, const uint8_t *end, uint32_t &out) {
   memcpy(&out, begin, 4);
   begin += 4;
   return true;
-}
\ No newline at end of file
+}
+
+namespace {
+struct Crc32cTable {
+  uint32_t t[8][256];
+  Crc32cTable() {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; k++) {
+        c = (c & 1) ? (c >> 1) ^ 0x82f63b78 : c >> 1;
+      }
+      t[0][i] = c;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+      for (int k = 1; k < 8; k++) {
+        t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xff];
+      }
+    }
+  }
+};
+} // namespace
+
+// slicing-by-8
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t *p, size_t len) {
+  static const Crc32cTable table;
+  const uint32_t(*t)[256] = table.t;
+  while (len >= 8) {
+    uint64_t v = 0;
+    memcpy(&v, p, 8);
+    v ^= crc;
+    crc = t[7][v & 0xff] ^ t[6][(v >> 8) & 0xff] ^ t[5][(v >> 16) & 0xff] ^
+          t[4][(v >> 24) & 0xff] ^ t[3][(v >> 32) & 0xff] ^
+          t[2][(v >> 40) & 0xff] ^ t[1][(v >> 48) & 0xff] ^ t[0][v >> 56];
+    p += 8;
+    len -= 8;
+  }
+  while (len-- > 0) {
+    crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+  }
+  return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) static uint32_t
+crc32c_hw(uint32_t crc, const uint8_t *p, size_t len) {
+  uint64_t c = crc;
+  while (len >= 8) {
+    uint64_t v = 0;
+    memcpy(&v, p, 8);
+    c = __builtin_ia32_crc32di(c, v);
+    p += 8;
+    len -= 8;
+  }
+  crc = (uint32_t)c;
+  while (len-- > 0) {
+    crc = __builtin_ia32_crc32qi(crc, *p++);
+  }
+  return crc;
+}
+#endif
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t len) {
+  const uint8_t *p = (const uint8_t *)data;
+  crc = ~crc;
+#if defined(__x86_64__)
+  static const bool has_sse42 = __builtin_cpu_supports("sse4.2");
+  if (has_sse42) {
+    return ~crc32c_hw(crc, p, len);
+  }
+#endif
+  return ~crc32c_sw(crc, p, len);
+}
+
+uint64_t murmurhash64a(const void *data, size_t len, uint64_t seed) {
+  const uint64_t m = 0xc6a4a7935bd1e995ULL;
+  const int r = 47;
+  uint64_t h = seed ^ (len * m);
+  const uint8_t *p = (const uint8_t *)data;
+  const uint8_t *end = p + (len & ~(size_t)7);
+  for (; p != end; p += 8) {
+    uint64_t k = 0;
+    memcpy(&k, p, 8);
+    k *= m;
+    k ^= k >> r;
+    k *= m;
+    h ^= k;
+    h *= m;
+  }
+  switch (len & 7) {
+  case 7:
+    h ^= (uint64_t)p[6] << 48;
+    // fallthrough
+  case 6:
+    h ^= (uint64_t)p[5] << 40;
+    // fallthrough
+  case 5:
+    h ^= (uint64_t)p[4] << 32;
+    // fallthrough
+  case 4:
+    h ^= (uint64_t)p[3] << 24;
+    // fallthrough
+  case 3:
+    h ^= (uint64_t)p[2] << 16;
+    // fallthrough
+  case 2:
+    h ^= (uint64_t)p[1] << 8;
+    // fallthrough
+  case 1:
+    h ^= (uint64_t)p[0];
+    h *= m;
+  }
+  h ^= h >> r;
+  h *= m;
+  h ^= h >> r;
+  return h;
+}
+
+// one element of the pattern at `p[pi]` (a literal, an escape, `?` or a
+// set) against `c`, advancing `pi` past it
+static bool glob_match_one(const char *p, size_t plen, size_t &pi, char c) {
+  switch (p[pi]) {
+  case '?':
+    pi++;
+    return true;
+  case '[': {
+    size_t i = pi + 1;
+    bool negate = i < plen && p[i] == '^';
+    i += negate;
+    bool found = false;
+    while (i < plen && p[i] != ']') {
+      if (p[i] == '\\' && i + 1 < plen) {
+        found = found || p[i + 1] == c;
+        i += 2;
+      } else if (i + 2 < plen && p[i + 1] == '-' && p[i + 2] != ']') {
+        char lo = std::min(p[i], p[i + 2]);
+        char hi = std::max(p[i], p[i + 2]);
+        found = found || (c >= lo && c <= hi);
+        i += 3;
+      } else {
+        found = found || p[i] == c;
+        i++;
+      }
+    }
+    pi = i < plen ? i + 1 : i; // an unclosed set ends with the pattern
+    return found != negate;
+  }
+  case '\\':
+    if (pi + 1 < plen) {
+      pi++;
+    }
+    return p[pi++] == c;
+  default:
+    return p[pi++] == c;
+  }
+}
+
+bool glob_match(const char *pattern, size_t plen, const char *str,
+                size_t slen) {
+  size_t pi = 0;
+  size_t si = 0;
+  // on a mismatch, the last `*` takes one more byte and matching resumes
+  // after it; an earlier `*` never needs to take more than that
+  size_t star_pi = (size_t)-1;
+  size_t star_si = 0;
+  while (si < slen) {
+    if (pi < plen && pattern[pi] == '*') {
+      star_pi = pi++;
+      star_si = si;
+      continue;
+    }
+    size_t next = pi;
+    if (pi < plen && glob_match_one(pattern, plen, next, str[si])) {
+      pi = next;
+      si++;
+    } else if (star_pi != (size_t)-1) {
+      pi = star_pi + 1;
+      si = ++star_si;
+    } else {
+      return false;
+    }
+  }
+  while (pi < plen && pattern[pi] == '*') {
+    pi++;
+  }
+  return pi == plen;
+}
@@ -10,7 +10,7 @@
 #include <cstdlib>
 #include <cstring>
 
-#include "aixlog.hpp"
+#include "logger.hpp"
 
 bool read_all(int fd, char *buf, size_t len);
 bool write_all(int fd, const char *buf, size_t len);
@@ -25,6 +25,29 @@ void fd_set_nb(int fd);
 bool read_u32(const uint8_t *&begin, const uint8_t *end, uint32_t &out);
 
 uint64_t get_monotonic_msec();
+uint64_t get_monotonic_usec();
+// wall-clock time, for deadlines that have to survive a restart
+uint64_t get_realtime_msec();
+
+/**
+ * @brief CRC-32C (Castagnoli) of `len` bytes, continuing from `crc`
+ *
+ * Uses the SSE4.2 crc32 instruction when the CPU has it.
+ */
+uint32_t crc32c(uint32_t crc, const void *data, size_t len);
+
+// MurmurHash64A: a fast 64-bit hash with well-mixed bits, for sketches
+// that take several bits of a hash as independent
+uint64_t murmurhash64a(const void *data, size_t len, uint64_t seed);
+
+/**
+ * @brief whether `str` matches the glob-style `pattern`
+ *
+ * `*` matches any run of bytes, `?` any one byte, `[abc]`, `[a-z]` and
+ * `[^abc]` one byte of a set, and `\` escapes the next byte.
+ */
+bool glob_match(const char *pattern, size_t plen, const char *str,
+                size_t slen);
 
 #define container_of(ptr, T, member) ((T *)((char *)ptr - offsetof(T, member)))
 
@@ -39,6 +62,9 @@ public:
     DList *prev = this->prev;
     next->prev = prev;
     prev->next = next;
+    // unlinked nodes point to themselves, so detaching twice is harmless
+    this->prev = this;
+    this->next = this;
   }
 
   inline void insert_before(DList *rookie) {
@@ -50,7 +76,8 @@ public:
     rookie->prev = prev;
   }
 
-  inline bool is_empty() { return prev == next; }
+  // for a node rather than a list head: whether it is unlinked
+  inline bool is_empty() const { return next == this; }
 
   DList *prev;
   DList *next;